@@ -0,0 +1,426 @@
+#include "adaptive_icosphere.h"
+
+#include <algorithm>
+
+AdaptiveIcosphere::AdaptiveIcosphere(uint32_t _maxLevel) :
+	maxLevel(_maxLevel),
+	faceIndexes(FaceCount),
+	faceDirty(FaceCount, 1),
+	slotCapacity(FaceCount, 0)
+{
+	Icosaedr base;
+	vertex = base.getVertices();
+	radius = glm::length(vertex[0]);
+	for (const auto& v : vertex)
+		normal.push_back(glm::normalize(v));
+	vertexRefs.assign(vertex.size(), 0);
+	vertexEdge.assign(vertex.size(), 0);
+
+	// the roots are nodes 0..19, children come in blocks of four after them
+	const auto& base_indexes = base.getIndexes();
+	nodes.resize(FaceCount);
+	for (uint32_t face = 0; face < FaceCount; face++)
+		initNode(face, base_indexes[face * 3], base_indexes[face * 3 + 1], base_indexes[face * 3 + 2], None, face, 0);
+	for (uint32_t face = 0; face < FaceCount; face++)
+		changed.push_back(face);
+	patches.resize(FaceCount, { 0, 0 });
+	gather();
+}
+
+uint32_t AdaptiveIcosphere::midpoint(uint32_t a, uint32_t b) {
+	const uint64_t key = edgeKey(a, b);
+	auto found = midpoints.find(key);
+	if (found != midpoints.end())
+		return found->second;
+
+	// the same midpoint-then-project step as Icosaedr::subdivideTriangle
+	glm::vec3 mid = (vertex[a] + vertex[b]) / glm::vec3(2);
+	mid *= radius / glm::length(mid);
+
+	uint32_t v;
+	if (!freeVertices.empty())
+	{
+		v = freeVertices.back();
+		freeVertices.pop_back();
+		vertex[v] = mid;
+		normal[v] = glm::normalize(mid);
+		vertexEdge[v] = key;
+	}
+	else
+	{
+		v = static_cast<uint32_t>(vertex.size());
+		vertex.push_back(mid);
+		normal.push_back(glm::normalize(mid));
+		vertexRefs.push_back(0);
+		vertexEdge.push_back(key);
+	}
+	midpoints.emplace(key, v);
+	created.push_back(v);
+	return v;
+}
+
+void AdaptiveIcosphere::releaseVertex(uint32_t v) {
+	// the 12 base vertices are never freed
+	if (--vertexRefs[v] > 0 || v < 12)
+		return;
+	midpoints.erase(vertexEdge[v]);
+	freeVertices.push_back(v);
+}
+
+uint32_t AdaptiveIcosphere::allocateBlock() {
+	if (!freeNodes.empty())
+	{
+		uint32_t block = freeNodes.back();
+		freeNodes.pop_back();
+		return block;
+	}
+	uint32_t block = static_cast<uint32_t>(nodes.size());
+	nodes.resize(nodes.size() + 4);
+	return block;
+}
+
+void AdaptiveIcosphere::initNode(uint32_t id, uint32_t a, uint32_t b, uint32_t c, uint32_t parent, uint32_t face, uint32_t level) {
+	Node& node = nodes[id];
+	node.v[0] = a;
+	node.v[1] = b;
+	node.v[2] = c;
+	node.parent = parent;
+	node.children = None;
+	node.face = face;
+	node.level = level;
+
+	const glm::vec3 &p0 = vertex[a], &p1 = vertex[b], &p2 = vertex[c];
+	node.centroid = (p0 + p1 + p2) / glm::vec3(3);
+	node.axis = glm::normalize(node.centroid);
+	node.capCos = glm::min(glm::dot(node.axis, glm::normalize(p0)), glm::min(glm::dot(node.axis, glm::normalize(p1)), glm::dot(node.axis, glm::normalize(p2))));
+	// gap between the flat triangle and the sphere it stands for
+	const glm::vec3 plane_normal = glm::normalize(glm::cross(p1 - p0, p2 - p0));
+	node.sagitta = radius - glm::abs(glm::dot(plane_normal, p0));
+	node.boundRadius = glm::max(glm::distance(node.centroid, p0), glm::max(glm::distance(node.centroid, p1), glm::distance(node.centroid, p2))) + node.sagitta;
+
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		vertexRefs[node.v[i]]++;
+		auto& on_edge = edgeNodes.emplace(edgeKey(node.v[i], node.v[(i + 1) % 3]), std::array<uint32_t, 2>{ None, None }).first->second;
+		on_edge[on_edge[0] == None ? 0 : 1] = id;
+	}
+}
+
+void AdaptiveIcosphere::destroyNode(uint32_t id) {
+	const Node& node = nodes[id];
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		auto found = edgeNodes.find(edgeKey(node.v[i], node.v[(i + 1) % 3]));
+		auto& on_edge = found->second;
+		if (on_edge[0] == id)
+			on_edge[0] = on_edge[1];
+		on_edge[1] = None;
+		if (on_edge[0] == None)
+			edgeNodes.erase(found);
+	}
+	for (uint32_t i = 0; i < 3; i++)
+		releaseVertex(node.v[i]);
+}
+
+uint32_t AdaptiveIcosphere::neighbour(uint32_t id, uint32_t edge) const {
+	const Node& node = nodes[id];
+	auto found = edgeNodes.find(edgeKey(node.v[edge], node.v[(edge + 1) % 3]));
+	if (found == edgeNodes.end())
+		return None;
+	return found->second[0] == id ? found->second[1] : found->second[0];
+}
+
+void AdaptiveIcosphere::markFace(uint32_t face) {
+	if (!faceDirty[face])
+	{
+		faceDirty[face] = 1;
+		changed.push_back(face);
+	}
+}
+
+void AdaptiveIcosphere::markNeighbourFaces(uint32_t id) {
+	for (uint32_t edge = 0; edge < 3; edge++)
+	{
+		uint32_t other = neighbour(id, edge);
+		if (other != None)
+			markFace(nodes[other].face);
+	}
+}
+
+float AdaptiveIcosphere::projectedError(const Node& node, const View& view) const {
+	float distance = glm::max(glm::distance(view.camera, node.centroid) - node.boundRadius, 1e-6f * radius);
+	return node.sagitta * view.pixelsPerUnit / distance;
+}
+
+bool AdaptiveIcosphere::visible(const Node& node, const View& view) const {
+	if (view.frustum)
+	{
+		BoundingSphere bounds;
+		bounds.center = node.centroid;
+		bounds.radius = node.boundRadius;
+		if (!view.frustum->testSphere(bounds))
+			return false;
+	}
+
+	// hidden behind the horizon when no direction in the cap reaches the visible cap,
+	// whose half angle from the camera direction is acos(radius / distance)
+	const float distance = glm::length(view.camera);
+	if (distance <= radius)
+		return true;
+	const float phi = glm::acos(glm::clamp(glm::dot(node.axis, view.camera) / distance, -1.0f, 1.0f));
+	const float theta = glm::acos(glm::clamp(node.capCos, -1.0f, 1.0f));
+	return glm::cos(glm::max(phi - theta, 0.0f)) >= radius / distance;
+}
+
+bool AdaptiveIcosphere::split(uint32_t id) {
+	if (nodes[id].children != None)
+		return true;
+	if (nodes[id].level >= maxLevel)
+		return false;
+
+	// a missing neighbour means the coarser triangle across that edge is a leaf:
+	// it is split first, which keeps neighbouring leaves within one level
+	for (uint32_t edge = 0; edge < 3; edge++)
+	{
+		if (neighbour(id, edge) != None)
+			continue;
+		const uint32_t parent = nodes[id].parent;
+		if (parent == None)
+			return false;
+		const uint32_t a = nodes[id].v[edge], b = nodes[id].v[(edge + 1) % 3];
+		uint32_t across = None;
+		for (uint32_t parent_edge = 0; parent_edge < 3 && across == None; parent_edge++)
+		{
+			const uint32_t x = nodes[parent].v[parent_edge], y = nodes[parent].v[(parent_edge + 1) % 3];
+			auto mid = midpoints.find(edgeKey(x, y));
+			if (mid == midpoints.end())
+				continue;
+			const uint64_t half = edgeKey(a, b);
+			if (half == edgeKey(x, mid->second) || half == edgeKey(mid->second, y))
+				across = neighbour(parent, parent_edge);
+		}
+		if (across == None || !split(across))
+			return false;
+	}
+
+	const uint32_t v0 = nodes[id].v[0], v1 = nodes[id].v[1], v2 = nodes[id].v[2];
+	const uint32_t face = nodes[id].face, level = nodes[id].level + 1;
+	const uint32_t m0 = midpoint(v0, v1);
+	const uint32_t m1 = midpoint(v1, v2);
+	const uint32_t m2 = midpoint(v2, v0);
+	const uint32_t block = allocateBlock();
+	// children keep the parent's winding, as in Icosaedr
+	initNode(block, v0, m0, m2, id, face, level);
+	initNode(block + 1, m0, v1, m1, id, face, level);
+	initNode(block + 2, m2, m1, v2, id, face, level);
+	initNode(block + 3, m0, m1, m2, id, face, level);
+	nodes[id].children = block;
+
+	markFace(face);
+	markNeighbourFaces(id);
+	return true;
+}
+
+bool AdaptiveIcosphere::canMerge(uint32_t id) const {
+	const uint32_t block = nodes[id].children;
+	if (block == None)
+		return false;
+	for (uint32_t child = block; child < block + 4; child++)
+	{
+		if (nodes[child].children != None)
+			return false;
+		// a split triangle across an outer edge needs this child as its neighbour
+		for (uint32_t edge = 0; edge < 3; edge++)
+		{
+			uint32_t other = neighbour(child, edge);
+			if (other != None && nodes[other].parent != id && nodes[other].children != None)
+				return false;
+		}
+	}
+	return true;
+}
+
+void AdaptiveIcosphere::merge(uint32_t id) {
+	const uint32_t block = nodes[id].children;
+	for (uint32_t child = block; child < block + 4; child++)
+		destroyNode(child);
+	freeNodes.push_back(block);
+	nodes[id].children = None;
+
+	markFace(nodes[id].face);
+	markNeighbourFaces(id);
+}
+
+void AdaptiveIcosphere::refine(uint32_t id, const View& view) {
+	const float error = visible(nodes[id], view) ? projectedError(nodes[id], view) : 0.0f;
+	if (nodes[id].children == None)
+	{
+		if (error > view.thresholdPixels && split(id))
+			for (uint32_t k = 0; k < 4; k++)
+				refine(nodes[id].children + k, view);
+		return;
+	}
+
+	// children first, so a whole branch can collapse in one update; merging only well
+	// below the threshold keeps a triangle near it from flipping every frame
+	for (uint32_t k = 0; k < 4; k++)
+		refine(nodes[id].children + k, view);
+	if (error < view.thresholdPixels * 0.75f && canMerge(id))
+		merge(id);
+}
+
+bool AdaptiveIcosphere::sameView(const View& view) const {
+	if (!refined || view.camera != lastView.camera || view.pixelsPerUnit != lastView.pixelsPerUnit
+		|| view.thresholdPixels != lastView.thresholdPixels || !view.frustum != !lastView.frustum)
+		return false;
+	if (view.frustum)
+		for (int i = 0; i < 6; i++)
+			if (view.frustum->planes[i] != lastFrustum.planes[i])
+				return false;
+	return true;
+}
+
+bool AdaptiveIcosphere::update(const View& view) {
+	relaid = false;
+	// every error and visibility test would come out as last time
+	if (!sameView(view))
+	{
+		for (uint32_t face = 0; face < FaceCount; face++)
+			refine(face, view);
+		refined = true;
+		lastView = view;
+		if (view.frustum)
+			lastFrustum = *view.frustum;
+	}
+	if (changed.empty())
+	{
+		lastChanged.clear();
+		lastCreated.clear();
+		return false;
+	}
+	gather();
+	return true;
+}
+
+void AdaptiveIcosphere::emitLeaf(uint32_t id, std::vector<uint32_t>& out) const {
+	const Node& node = nodes[id];
+	uint32_t mid[3];
+	uint32_t splits = 0;
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		auto found = midpoints.find(edgeKey(node.v[i], node.v[(i + 1) % 3]));
+		mid[i] = found != midpoints.end() ? found->second : None;
+		splits += mid[i] != None;
+	}
+
+	if (splits == 0)
+	{
+		out.insert(out.end(), { node.v[0], node.v[1], node.v[2] });
+		return;
+	}
+	if (splits == 3)
+	{
+		out.insert(out.end(), { node.v[0], mid[0], mid[2], mid[0], node.v[1], mid[1], mid[2], mid[1], node.v[2], mid[0], mid[1], mid[2] });
+		return;
+	}
+
+	// the finer neighbours' midpoints go into the outline, which is fanned from one of them
+	uint32_t first = 0;
+	while (mid[first] == None)
+		first++;
+	uint32_t outline[6];
+	uint32_t count = 0;
+	for (uint32_t k = 0; k < 3; k++)
+	{
+		const uint32_t edge = (first + k) % 3;
+		if (mid[edge] != None)
+			outline[count++] = mid[edge];
+		outline[count++] = node.v[(edge + 1) % 3];
+	}
+	for (uint32_t k = 1; k + 1 < count; k++)
+		out.insert(out.end(), { outline[0], outline[k], outline[k + 1] });
+}
+
+void AdaptiveIcosphere::emitFace(uint32_t face) {
+	std::vector<uint32_t>& out = faceIndexes[face];
+	out.clear();
+	std::vector<uint32_t> stack(1, face);
+	while (!stack.empty())
+	{
+		const uint32_t id = stack.back();
+		stack.pop_back();
+		if (nodes[id].children == None)
+			emitLeaf(id, out);
+		else
+			for (uint32_t k = 4; k-- > 0;)
+				stack.push_back(nodes[id].children + k);
+	}
+}
+
+void AdaptiveIcosphere::gather() {
+	std::sort(changed.begin(), changed.end());
+	for (uint32_t face : changed)
+	{
+		emitFace(face);
+		faceDirty[face] = 0;
+	}
+	lastChanged.swap(changed);
+	changed.clear();
+	// an id freed and reused within one update is listed once
+	std::sort(created.begin(), created.end());
+	created.erase(std::unique(created.begin(), created.end()), created.end());
+	lastCreated.swap(created);
+	created.clear();
+
+	if (vertex.size() > reservedVertices)
+	{
+		reservedVertices = vertex.size() * 2;
+		relaid = true;
+	}
+	for (uint32_t face : lastChanged)
+		if (faceIndexes[face].size() > slotCapacity[face])
+			relaid = true;
+	if (relaid)
+	{
+		layoutSlots();
+		return;
+	}
+	for (uint32_t face : lastChanged)
+		writeSlot(face);
+}
+
+void AdaptiveIcosphere::layoutSlots() {
+	// twice the current size, so a face can refine for a while before the next move
+	uint32_t first = 0;
+	for (uint32_t face = 0; face < FaceCount; face++)
+	{
+		slotCapacity[face] = std::max<uint32_t>(MinSlotIndexes, static_cast<uint32_t>(faceIndexes[face].size()) * 2);
+		patches[face] = { first, 0 };
+		first += slotCapacity[face];
+	}
+	index.assign(first, 0);
+	normalFace.assign(first / 3, glm::vec3(0.0f));
+	for (uint32_t face = 0; face < FaceCount; face++)
+		writeSlot(face);
+}
+
+void AdaptiveIcosphere::writeSlot(uint32_t face) {
+	const std::vector<uint32_t>& source = faceIndexes[face];
+	MeshPatch& slot = patches[face];
+	const uint32_t count = static_cast<uint32_t>(source.size());
+	std::copy(source.begin(), source.end(), index.begin() + slot.firstIndex);
+	// what the face no longer uses turns back into padding
+	if (count < slot.countIndexes)
+	{
+		std::fill(index.begin() + slot.firstIndex + count, index.begin() + slot.firstIndex + slot.countIndexes, 0);
+		std::fill(normalFace.begin() + (slot.firstIndex + count) / 3, normalFace.begin() + (slot.firstIndex + slot.countIndexes) / 3, glm::vec3(0.0f));
+	}
+	slot.countIndexes = count;
+
+	for (uint32_t i = slot.firstIndex; i < slot.firstIndex + count; i += 3)
+	{
+		glm::vec3 vect1 = vertex[index[i + 2]] - vertex[index[i]];
+		glm::vec3 vect2 = vertex[index[i + 1]] - vertex[index[i]];
+		normalFace[i / 3] = -glm::normalize(glm::cross(vect1, vect2));
+	}
+}
@@ -0,0 +1,100 @@
+#include "async_loader.h"
+
+#include <exception>
+#include <iostream>
+
+#include "lod.h"
+
+AsyncLodLoader::AsyncLodLoader(GLFWwindow* mainWindow, uint32_t firstLevel, uint32_t maxLevel) {
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	context = glfwCreateWindow(1, 1, "", NULL, mainWindow);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+	if (context == NULL)
+		throw std::exception("Failed to create loader context");
+
+	worker = std::thread(&AsyncLodLoader::generate, this, firstLevel, maxLevel);
+}
+
+AsyncLodLoader::~AsyncLodLoader() {
+	stop = true;
+	if (worker.joinable())
+		worker.join();
+}
+
+void AsyncLodLoader::generate(uint32_t firstLevel, uint32_t maxLevel) {
+	glfwMakeContextCurrent(context);
+	try {
+		Icosaedr current;
+		for (uint32_t level = 0; level <= maxLevel && !stop; level++)
+		{
+			if (level > 0)
+				current.increaseApproximation(1);
+			if (level < firstLevel)
+				continue;
+
+			// current keeps the subdivision order, only the uploaded copy is reordered
+			auto optimized = std::make_shared<CacheOptimizedMesh>(current);
+			PendingLevel result;
+			result.lod.mesh = optimized;
+			result.lod.patches = optimized->getPatches();
+			result.lod.bounds = BoundsBuilder::compute(*optimized);
+			result.lod.edgeLength = IcosphereLodChain::averageEdgeLength(*optimized);
+			MeshUploader::uploadBuffers(*optimized, result.lod.handles, VertexFormat::choose(*optimized));
+
+			// the fence is what the GL thread waits on; flushing makes it visible there
+			result.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			glFlush();
+
+			std::lock_guard<std::mutex> guard(lock);
+			pending.push_back(result);
+		}
+	}
+	catch (std::exception& ex) {
+		std::cout << "\t\t[LOADER] " << ex.what() << std::endl;
+	}
+	glfwMakeContextCurrent(NULL);
+	done = true;
+}
+
+size_t AsyncLodLoader::poll(std::vector<GpuMesh>& lods) {
+	size_t added = 0;
+	std::lock_guard<std::mutex> guard(lock);
+	while (!pending.empty())
+	{
+		PendingLevel& front = pending.front();
+		GLenum status = glClientWaitSync(front.fence, 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			break;
+		glDeleteSync(front.fence);
+
+		MeshUploader::createVertexArray(front.lod.handles);
+		lods.push_back(front.lod);
+		pending.pop_front();
+		added++;
+	}
+	return added;
+}
+
+bool AsyncLodLoader::finished() const {
+	std::lock_guard<std::mutex> guard(lock);
+	return done && pending.empty();
+}
+
+void AsyncLodLoader::release() {
+	stop = true;
+	if (worker.joinable())
+		worker.join();
+
+	for (auto& level : pending)
+	{
+		glDeleteSync(level.fence);
+		MeshUploader::destroy(level.lod.handles);
+	}
+	pending.clear();
+
+	if (context)
+	{
+		glfwDestroyWindow(context);
+		context = nullptr;
+	}
+}
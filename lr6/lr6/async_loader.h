@@ -0,0 +1,48 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glfw3.h>
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+#include "gpu_mesh.h"
+
+// Builds icosphere levels firstLevel..maxLevel on a worker thread while the window
+// already draws whatever is resident. The worker owns a hidden context shared with
+// the window and uploads each level's buffers there; the GL thread picks a level up
+// only once its fence has signalled, so a half-uploaded level is never drawn.
+class AsyncLodLoader {
+public:
+	// must be called from the thread that created mainWindow
+	AsyncLodLoader(GLFWwindow* mainWindow, uint32_t firstLevel, uint32_t maxLevel);
+	~AsyncLodLoader();
+
+	// GL thread; appends the levels that finished uploading, in level order
+	size_t poll(std::vector<GpuMesh>& lods);
+	// GL thread; stops after the level being generated and frees what was not taken
+	void release();
+
+	// every level was handed out (or the worker stopped)
+	bool finished() const;
+
+private:
+	struct PendingLevel {
+		GpuMesh lod;
+		GLsync fence;
+	};
+
+	void generate(uint32_t firstLevel, uint32_t maxLevel);
+
+	GLFWwindow* context = nullptr;
+	std::thread worker;
+	std::atomic<bool> stop{ false };
+	std::atomic<bool> done{ false };
+
+	mutable std::mutex lock;
+	std::deque<PendingLevel> pending;
+};
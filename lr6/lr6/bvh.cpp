@@ -0,0 +1,576 @@
+#include "bvh.h"
+
+#include <algorithm>
+
+namespace {
+
+const uint32_t BinCount = 16;
+// ranges below this are built by one thread from start to end
+const uint32_t ParallelGrain = 1024;
+
+float surfaceArea(const glm::vec3& min, const glm::vec3& max) {
+	glm::vec3 size = glm::max(max - min, glm::vec3(0.0f));
+	return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+struct SoARay {
+	__m128 ox, oy, oz;
+	__m128 dx, dy, dz;
+	__m128 ix, iy, iz; // 1 / direction
+	__m128 tMin;
+};
+
+SoARay broadcast(const Ray& ray) {
+	SoARay soa;
+	soa.ox = _mm_set1_ps(ray.origin.x);
+	soa.oy = _mm_set1_ps(ray.origin.y);
+	soa.oz = _mm_set1_ps(ray.origin.z);
+	soa.dx = _mm_set1_ps(ray.direction.x);
+	soa.dy = _mm_set1_ps(ray.direction.y);
+	soa.dz = _mm_set1_ps(ray.direction.z);
+	soa.ix = _mm_set1_ps(1.0f / ray.direction.x);
+	soa.iy = _mm_set1_ps(1.0f / ray.direction.y);
+	soa.iz = _mm_set1_ps(1.0f / ray.direction.z);
+	soa.tMin = _mm_set1_ps(ray.tMin);
+	return soa;
+}
+
+// slab test of one ray against four boxes given as arrays; the entry distance goes to tNear
+inline int hitBoxes4(const float* minX, const float* minY, const float* minZ, const float* maxX, const float* maxY, const float* maxZ,
+	const SoARay& ray, __m128 tMax, __m128& tNear) {
+	__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(minX), ray.ox), ray.ix);
+	__m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(maxX), ray.ox), ray.ix);
+	__m128 near_t = _mm_max_ps(_mm_min_ps(t1, t2), ray.tMin);
+	__m128 far_t = _mm_min_ps(_mm_max_ps(t1, t2), tMax);
+	t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(minY), ray.oy), ray.iy);
+	t2 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(maxY), ray.oy), ray.iy);
+	near_t = _mm_max_ps(near_t, _mm_min_ps(t1, t2));
+	far_t = _mm_min_ps(far_t, _mm_max_ps(t1, t2));
+	t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(minZ), ray.oz), ray.iz);
+	t2 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(maxZ), ray.oz), ray.iz);
+	near_t = _mm_max_ps(near_t, _mm_min_ps(t1, t2));
+	far_t = _mm_min_ps(far_t, _mm_max_ps(t1, t2));
+	tNear = near_t;
+	return _mm_movemask_ps(_mm_cmple_ps(near_t, far_t));
+}
+
+// Moller-Trumbore for one ray against the four triangles of a packet; returns the lane mask of hits
+template<typename Packet>
+inline int hitTriangles4(const Packet& p, const SoARay& ray, __m128 tMax, __m128& t, __m128& u, __m128& v) {
+	const __m128 e1x = _mm_load_ps(p.e1x), e1y = _mm_load_ps(p.e1y), e1z = _mm_load_ps(p.e1z);
+	const __m128 e2x = _mm_load_ps(p.e2x), e2y = _mm_load_ps(p.e2y), e2z = _mm_load_ps(p.e2z);
+	const __m128 px = _mm_sub_ps(_mm_mul_ps(ray.dy, e2z), _mm_mul_ps(ray.dz, e2y));
+	const __m128 py = _mm_sub_ps(_mm_mul_ps(ray.dz, e2x), _mm_mul_ps(ray.dx, e2z));
+	const __m128 pz = _mm_sub_ps(_mm_mul_ps(ray.dx, e2y), _mm_mul_ps(ray.dy, e2x));
+	const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+	const __m128 inv = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+	const __m128 sx = _mm_sub_ps(ray.ox, _mm_load_ps(p.v0x));
+	const __m128 sy = _mm_sub_ps(ray.oy, _mm_load_ps(p.v0y));
+	const __m128 sz = _mm_sub_ps(ray.oz, _mm_load_ps(p.v0z));
+	u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inv);
+	const __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+	const __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+	const __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+	v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ray.dx, qx), _mm_mul_ps(ray.dy, qy)), _mm_mul_ps(ray.dz, qz)), inv);
+	t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv);
+
+	// an empty lane has det = 0: inv is infinite, u is NaN and every comparison fails
+	const __m128 zero = _mm_setzero_ps();
+	__m128 mask = _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero));
+	mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+	mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpgt_ps(t, ray.tMin), _mm_cmplt_ps(t, tMax)));
+	return _mm_movemask_ps(mask);
+}
+
+}
+
+MeshBvh::MeshBvh(const Mesh& mesh, ThreadPool& pool) :
+	vertices(&mesh.getVertices()),
+	indexes(&mesh.getIndexes())
+{
+	triangles = indexes->size() / 3;
+	const uint32_t count = static_cast<uint32_t>(triangles);
+	centroids.resize(count);
+	boxMin.resize(count);
+	boxMax.resize(count);
+	order.resize(count);
+	pool.parallelFor(count, 4096, [&](size_t begin, size_t end) {
+		for (size_t t = begin; t < end; t++)
+		{
+			const glm::vec3& a = (*vertices)[(*indexes)[t * 3]];
+			const glm::vec3& b = (*vertices)[(*indexes)[t * 3 + 1]];
+			const glm::vec3& c = (*vertices)[(*indexes)[t * 3 + 2]];
+			boxMin[t] = glm::min(a, glm::min(b, c));
+			boxMax[t] = glm::max(a, glm::max(b, c));
+			centroids[t] = (boxMin[t] + boxMax[t]) * 0.5f;
+			order[t] = static_cast<uint32_t>(t);
+		}
+	});
+
+	// upper levels on this thread until every worker has a few subtrees to build
+	std::vector<BuildNode> tree(1);
+	bounds(0, count, tree[0].min, tree[0].max);
+	std::vector<BuildRange> work{ { 0, 0, count, 0 } };
+	const size_t target = size_t(pool.size() + 1) * 4;
+	while (work.size() < target)
+	{
+		auto largest = std::max_element(work.begin(), work.end(), [](const BuildRange& a, const BuildRange& b) { return a.count < b.count; });
+		if (largest->count <= ParallelGrain)
+			break;
+		const BuildRange range = *largest;
+		work.erase(largest);
+		uint32_t middle;
+		split(range.first, range.count, range.depth, middle);
+
+		const uint32_t left = static_cast<uint32_t>(tree.size());
+		tree.resize(tree.size() + 2);
+		tree[range.node].left = left;
+		tree[range.node].right = left + 1;
+		bounds(range.first, middle - range.first, tree[left].min, tree[left].max);
+		bounds(middle, range.first + range.count - middle, tree[left + 1].min, tree[left + 1].max);
+		work.push_back({ left, range.first, middle - range.first, range.depth + 1 });
+		work.push_back({ left + 1, middle, range.first + range.count - middle, range.depth + 1 });
+	}
+
+	// every range touches only its own part of order, so the subtrees build independently
+	std::vector<std::vector<BuildNode>> subtrees(work.size());
+	pool.parallelFor(work.size(), 1, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+			buildSubtree(subtrees[i], work[i]);
+	});
+	for (size_t i = 0; i < work.size(); i++)
+	{
+		// local node 0 takes the place of the range's node, the rest are appended
+		const uint32_t base = static_cast<uint32_t>(tree.size()) - 1;
+		const uint32_t root = work[i].node;
+		auto remap = [&](uint32_t local) {
+			return local == 0 ? root : base + local;
+		};
+		for (size_t local = 0; local < subtrees[i].size(); local++)
+		{
+			BuildNode node = subtrees[i][local];
+			if (node.count == 0)
+			{
+				node.left = remap(node.left);
+				node.right = remap(node.right);
+			}
+			if (local == 0)
+				tree[root] = node;
+			else
+				tree.push_back(node);
+		}
+	}
+
+	if (count > 0)
+		collapse(tree, 0);
+	else
+	{
+		// nothing to hit: a root with four empty children
+		Node empty;
+		for (int i = 0; i < 4; i++)
+		{
+			empty.minX[i] = empty.minY[i] = empty.minZ[i] = FLT_MAX;
+			empty.maxX[i] = empty.maxY[i] = empty.maxZ[i] = -FLT_MAX;
+			empty.child[i] = EmptyChild;
+		}
+		nodes.push_back(empty);
+	}
+
+	vertices = nullptr;
+	indexes = nullptr;
+	centroids = std::vector<glm::vec3>();
+	boxMin = std::vector<glm::vec3>();
+	boxMax = std::vector<glm::vec3>();
+	order = std::vector<uint32_t>();
+}
+
+void MeshBvh::bounds(uint32_t first, uint32_t count, glm::vec3& min, glm::vec3& max) const {
+	min = glm::vec3(FLT_MAX);
+	max = glm::vec3(-FLT_MAX);
+	for (uint32_t i = first; i < first + count; i++)
+	{
+		min = glm::min(min, boxMin[order[i]]);
+		max = glm::max(max, boxMax[order[i]]);
+	}
+}
+
+bool MeshBvh::split(uint32_t first, uint32_t count, uint32_t depth, uint32_t& middle) {
+	if (count <= MaxLeafTriangles)
+		return false;
+
+	glm::vec3 centroid_min(FLT_MAX), centroid_max(-FLT_MAX);
+	for (uint32_t i = first; i < first + count; i++)
+	{
+		centroid_min = glm::min(centroid_min, centroids[order[i]]);
+		centroid_max = glm::max(centroid_max, centroids[order[i]]);
+	}
+	const glm::vec3 extent = centroid_max - centroid_min;
+	const int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+
+	auto median = [&]() {
+		middle = first + count / 2;
+		std::nth_element(order.begin() + first, order.begin() + middle, order.begin() + first + count,
+			[&](uint32_t a, uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+		return true;
+	};
+	if (extent[axis] <= 0.0f || depth >= SahDepth)
+		return median();
+
+	// triangles binned by centroid; the plane between two bins with the lowest SAH cost wins
+	struct Bin {
+		glm::vec3 min = glm::vec3(FLT_MAX), max = glm::vec3(-FLT_MAX);
+		uint32_t count = 0;
+	} bins[BinCount];
+	const float scale = BinCount / extent[axis] * 0.9999f;
+	auto bin_of = [&](uint32_t triangle) {
+		return std::min<uint32_t>(BinCount - 1, static_cast<uint32_t>((centroids[triangle][axis] - centroid_min[axis]) * scale));
+	};
+	for (uint32_t i = first; i < first + count; i++)
+	{
+		Bin& bin = bins[bin_of(order[i])];
+		bin.min = glm::min(bin.min, boxMin[order[i]]);
+		bin.max = glm::max(bin.max, boxMax[order[i]]);
+		bin.count++;
+	}
+
+	float right_area[BinCount];
+	uint32_t right_count[BinCount];
+	glm::vec3 min(FLT_MAX), max(-FLT_MAX);
+	uint32_t accumulated = 0;
+	for (uint32_t b = BinCount - 1; b > 0; b--)
+	{
+		min = glm::min(min, bins[b].min);
+		max = glm::max(max, bins[b].max);
+		accumulated += bins[b].count;
+		right_area[b] = surfaceArea(min, max);
+		right_count[b] = accumulated;
+	}
+	float best_cost = FLT_MAX;
+	uint32_t best_plane = 0;
+	min = glm::vec3(FLT_MAX);
+	max = glm::vec3(-FLT_MAX);
+	accumulated = 0;
+	for (uint32_t plane = 1; plane < BinCount; plane++)
+	{
+		min = glm::min(min, bins[plane - 1].min);
+		max = glm::max(max, bins[plane - 1].max);
+		accumulated += bins[plane - 1].count;
+		if (accumulated == 0 || right_count[plane] == 0)
+			continue;
+		const float cost = surfaceArea(min, max) * accumulated + right_area[plane] * right_count[plane];
+		if (cost < best_cost)
+		{
+			best_cost = cost;
+			best_plane = plane;
+		}
+	}
+	if (best_plane == 0)
+		return median();
+
+	middle = static_cast<uint32_t>(std::partition(order.begin() + first, order.begin() + first + count,
+		[&](uint32_t triangle) { return bin_of(triangle) < best_plane; }) - order.begin());
+	return true;
+}
+
+void MeshBvh::buildSubtree(std::vector<BuildNode>& out, const BuildRange& root) {
+	// local node 0 is the root
+	out.emplace_back();
+	bounds(root.first, root.count, out[0].min, out[0].max);
+	std::vector<BuildRange> stack{ { 0, root.first, root.count, root.depth } };
+	while (!stack.empty())
+	{
+		const BuildRange range = stack.back();
+		stack.pop_back();
+		uint32_t middle;
+		if (!split(range.first, range.count, range.depth, middle))
+		{
+			out[range.node].first = range.first;
+			out[range.node].count = range.count;
+			continue;
+		}
+		const uint32_t left = static_cast<uint32_t>(out.size());
+		out.resize(out.size() + 2);
+		out[range.node].left = left;
+		out[range.node].right = left + 1;
+		bounds(range.first, middle - range.first, out[left].min, out[left].max);
+		bounds(middle, range.first + range.count - middle, out[left + 1].min, out[left + 1].max);
+		stack.push_back({ left, range.first, middle - range.first, range.depth + 1 });
+		stack.push_back({ left + 1, middle, range.first + range.count - middle, range.depth + 1 });
+	}
+}
+
+uint32_t MeshBvh::collapse(const std::vector<BuildNode>& tree, uint32_t node) {
+	const uint32_t index = static_cast<uint32_t>(nodes.size());
+	nodes.emplace_back();
+
+	// open the largest inner child until there are four
+	std::vector<uint32_t> children;
+	if (tree[node].count > 0)
+		children.push_back(node);
+	else
+		children = { tree[node].left, tree[node].right };
+	while (children.size() < 4)
+	{
+		int widest = -1;
+		float widest_area = -1.0f;
+		for (int i = 0; i < int(children.size()); i++)
+			if (tree[children[i]].count == 0 && surfaceArea(tree[children[i]].min, tree[children[i]].max) > widest_area)
+			{
+				widest = i;
+				widest_area = surfaceArea(tree[children[i]].min, tree[children[i]].max);
+			}
+		if (widest < 0)
+			break;
+		const BuildNode& opened = tree[children[widest]];
+		children[widest] = opened.left;
+		children.push_back(opened.right);
+	}
+
+	Node result;
+	for (int i = 0; i < 4; i++)
+	{
+		if (i >= int(children.size()))
+		{
+			result.minX[i] = result.minY[i] = result.minZ[i] = FLT_MAX;
+			result.maxX[i] = result.maxY[i] = result.maxZ[i] = -FLT_MAX;
+			result.child[i] = EmptyChild;
+			continue;
+		}
+		const BuildNode& child = tree[children[i]];
+		result.minX[i] = child.min.x;
+		result.minY[i] = child.min.y;
+		result.minZ[i] = child.min.z;
+		result.maxX[i] = child.max.x;
+		result.maxY[i] = child.max.y;
+		result.maxZ[i] = child.max.z;
+		result.child[i] = child.count > 0 ? LeafFlag | makePacket(child) : collapse(tree, children[i]);
+	}
+	nodes[index] = result;
+	return index;
+}
+
+uint32_t MeshBvh::makePacket(const BuildNode& leaf) {
+	TrianglePacket packet = {};
+	for (uint32_t lane = 0; lane < 4; lane++)
+	{
+		packet.id[lane] = RayHit::None;
+		if (lane >= leaf.count)
+			continue;
+		const uint32_t triangle = order[leaf.first + lane];
+		const glm::vec3& v0 = (*vertices)[(*indexes)[triangle * 3]];
+		const glm::vec3 e1 = (*vertices)[(*indexes)[triangle * 3 + 1]] - v0;
+		const glm::vec3 e2 = (*vertices)[(*indexes)[triangle * 3 + 2]] - v0;
+		packet.v0x[lane] = v0.x; packet.v0y[lane] = v0.y; packet.v0z[lane] = v0.z;
+		packet.e1x[lane] = e1.x; packet.e1y[lane] = e1.y; packet.e1z[lane] = e1.z;
+		packet.e2x[lane] = e2.x; packet.e2y[lane] = e2.y; packet.e2z[lane] = e2.z;
+		packet.id[lane] = triangle;
+	}
+	packets.push_back(packet);
+	return static_cast<uint32_t>(packets.size() - 1);
+}
+
+RayHit MeshBvh::closestHit(const Ray& ray) const {
+	const SoARay soa = broadcast(ray);
+	RayHit hit;
+	hit.t = ray.tMax;
+
+	struct Entry {
+		uint32_t index;
+		float tNear;
+	} stack[StackSize];
+	int top = 0;
+	stack[top++] = { 0, ray.tMin };
+	while (top > 0)
+	{
+		const Entry entry = stack[--top];
+		if (entry.tNear > hit.t)
+			continue;
+
+		if (entry.index & LeafFlag)
+		{
+			const TrianglePacket& packet = packets[entry.index & ~LeafFlag];
+			__m128 t, u, v;
+			int mask = hitTriangles4(packet, soa, _mm_set1_ps(hit.t), t, u, v);
+			if (!mask)
+				continue;
+			alignas(16) float ts[4], us[4], vs[4];
+			_mm_store_ps(ts, t);
+			_mm_store_ps(us, u);
+			_mm_store_ps(vs, v);
+			for (int lane = 0; lane < 4; lane++)
+				if ((mask & (1 << lane)) && ts[lane] < hit.t)
+				{
+					hit.t = ts[lane];
+					hit.u = us[lane];
+					hit.v = vs[lane];
+					hit.triangle = packet.id[lane];
+				}
+			continue;
+		}
+
+		const Node& node = nodes[entry.index];
+		__m128 near_t;
+		int mask = hitBoxes4(node.minX, node.minY, node.minZ, node.maxX, node.maxY, node.maxZ, soa, _mm_set1_ps(hit.t), near_t);
+		alignas(16) float distances[4];
+		_mm_store_ps(distances, near_t);
+		// pushed far to near, so the nearest child is visited first
+		Entry children[4];
+		int count = 0;
+		for (int i = 0; i < 4; i++)
+			if ((mask & (1 << i)) && node.child[i] != EmptyChild)
+				children[count++] = { node.child[i], distances[i] };
+		std::sort(children, children + count, [](const Entry& a, const Entry& b) { return a.tNear > b.tNear; });
+		for (int i = 0; i < count; i++)
+			stack[top++] = children[i];
+	}
+	return hit;
+}
+
+bool MeshBvh::anyHit(const Ray& ray) const {
+	const SoARay soa = broadcast(ray);
+	const __m128 t_max = _mm_set1_ps(ray.tMax);
+	uint32_t stack[StackSize];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0)
+	{
+		const uint32_t index = stack[--top];
+		if (index & LeafFlag)
+		{
+			__m128 t, u, v;
+			if (hitTriangles4(packets[index & ~LeafFlag], soa, t_max, t, u, v))
+				return true;
+			continue;
+		}
+		const Node& node = nodes[index];
+		__m128 near_t;
+		int mask = hitBoxes4(node.minX, node.minY, node.minZ, node.maxX, node.maxY, node.maxZ, soa, t_max, near_t);
+		for (int i = 0; i < 4; i++)
+			if ((mask & (1 << i)) && node.child[i] != EmptyChild)
+				stack[top++] = node.child[i];
+	}
+	return false;
+}
+
+void MeshBvh::closestHit4(const Ray* rays, RayHit* hits) const {
+	// one lane per ray for the box tests; leaves fall back to a ray at a time against the packet
+	SoARay packet_rays;
+	alignas(16) float values[10][4];
+	for (int lane = 0; lane < 4; lane++)
+	{
+		const Ray& ray = rays[lane];
+		values[0][lane] = ray.origin.x; values[1][lane] = ray.origin.y; values[2][lane] = ray.origin.z;
+		values[3][lane] = ray.direction.x; values[4][lane] = ray.direction.y; values[5][lane] = ray.direction.z;
+		values[6][lane] = 1.0f / ray.direction.x; values[7][lane] = 1.0f / ray.direction.y; values[8][lane] = 1.0f / ray.direction.z;
+		values[9][lane] = ray.tMin;
+		hits[lane] = RayHit();
+		hits[lane].t = ray.tMax;
+	}
+	packet_rays.ox = _mm_load_ps(values[0]); packet_rays.oy = _mm_load_ps(values[1]); packet_rays.oz = _mm_load_ps(values[2]);
+	packet_rays.dx = _mm_load_ps(values[3]); packet_rays.dy = _mm_load_ps(values[4]); packet_rays.dz = _mm_load_ps(values[5]);
+	packet_rays.ix = _mm_load_ps(values[6]); packet_rays.iy = _mm_load_ps(values[7]); packet_rays.iz = _mm_load_ps(values[8]);
+	packet_rays.tMin = _mm_load_ps(values[9]);
+	SoARay single[4];
+	for (int lane = 0; lane < 4; lane++)
+		single[lane] = broadcast(rays[lane]);
+
+	// each entry keeps the four entry distances, so it is skipped once every ray found something nearer
+	struct Entry {
+		__m128 tNear;
+		uint32_t index;
+	} stack[StackSize];
+	int top = 0;
+	stack[top++] = { packet_rays.tMin, 0 };
+	__m128 t_max = _mm_setr_ps(hits[0].t, hits[1].t, hits[2].t, hits[3].t);
+	while (top > 0)
+	{
+		const Entry entry = stack[--top];
+		const int alive = _mm_movemask_ps(_mm_cmple_ps(entry.tNear, t_max));
+		if (!alive)
+			continue;
+
+		if (entry.index & LeafFlag)
+		{
+			const TrianglePacket& packet = packets[entry.index & ~LeafFlag];
+			for (int lane = 0; lane < 4; lane++)
+			{
+				if (!(alive & (1 << lane)))
+					continue;
+				__m128 t, u, v;
+				int mask = hitTriangles4(packet, single[lane], _mm_set1_ps(hits[lane].t), t, u, v);
+				if (!mask)
+					continue;
+				alignas(16) float ts[4], us[4], vs[4];
+				_mm_store_ps(ts, t);
+				_mm_store_ps(us, u);
+				_mm_store_ps(vs, v);
+				for (int k = 0; k < 4; k++)
+					if ((mask & (1 << k)) && ts[k] < hits[lane].t)
+					{
+						hits[lane].t = ts[k];
+						hits[lane].u = us[k];
+						hits[lane].v = vs[k];
+						hits[lane].triangle = packet.id[k];
+					}
+			}
+			t_max = _mm_setr_ps(hits[0].t, hits[1].t, hits[2].t, hits[3].t);
+			continue;
+		}
+
+		// each child's box against the four rays, nearest child (by its nearest ray) visited first
+		const Node& node = nodes[entry.index];
+		Entry children[4];
+		float order[4];
+		int count = 0;
+		for (int i = 0; i < 4; i++)
+		{
+			if (node.child[i] == EmptyChild)
+				continue;
+			alignas(16) float box[6][4];
+			const float* bounds[6] = { node.minX, node.minY, node.minZ, node.maxX, node.maxY, node.maxZ };
+			for (int k = 0; k < 6; k++)
+				_mm_store_ps(box[k], _mm_set1_ps(bounds[k][i]));
+			__m128 near_t;
+			const int mask = hitBoxes4(box[0], box[1], box[2], box[3], box[4], box[5], packet_rays, t_max, near_t);
+			if (!mask)
+				continue;
+			alignas(16) float distances[4];
+			_mm_store_ps(distances, near_t);
+			float nearest = FLT_MAX;
+			for (int lane = 0; lane < 4; lane++)
+				if (mask & (1 << lane))
+					nearest = std::min(nearest, distances[lane]);
+				else
+					distances[lane] = FLT_MAX; // a ray that misses never keeps the child alive
+			order[count] = nearest;
+			children[count++] = { _mm_load_ps(distances), node.child[i] };
+		}
+		for (int i = 1; i < count; i++)
+			for (int j = i; j > 0 && order[j] > order[j - 1]; j--)
+			{
+				std::swap(order[j], order[j - 1]);
+				std::swap(children[j], children[j - 1]);
+			}
+		for (int i = 0; i < count; i++)
+			stack[top++] = children[i];
+	}
+}
+
+void MeshBvh::closestHits(const std::vector<Ray>& rays, std::vector<RayHit>& hits, ThreadPool& pool) const {
+	hits.resize(rays.size());
+	const size_t packet_count = (rays.size() + 3) / 4;
+	pool.parallelFor(packet_count, 64, [&](size_t begin, size_t end) {
+		for (size_t packet = begin; packet < end; packet++)
+		{
+			const size_t first = packet * 4;
+			if (first + 4 <= rays.size())
+			{
+				closestHit4(&rays[first], &hits[first]);
+				continue;
+			}
+			for (size_t i = first; i < rays.size(); i++)
+				hits[i] = closestHit(rays[i]);
+		}
+	});
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cfloat>
+
+#include <immintrin.h>
+#include <glm.hpp>
+
+#include "figure.h"
+#include "thread_pool.h"
+
+struct Ray {
+	glm::vec3 origin = glm::vec3(0.0f);
+	glm::vec3 direction = glm::vec3(0.0f, 0.0f, 1.0f); // need not be normalised; t is in its units
+	float tMin = 0.0f;
+	float tMax = FLT_MAX;
+};
+
+struct RayHit {
+	static const uint32_t None = UINT32_MAX;
+
+	float t = FLT_MAX;
+	uint32_t triangle = None; // index of the triangle in getIndexes() / 3
+	float u = 0.0f;           // barycentrics of the second and third corner
+	float v = 0.0f;
+
+	bool hit() const {
+		return triangle != None;
+	}
+};
+
+// Bounding volume hierarchy over the triangles of a Mesh, for picking, collision and
+// CPU ray casting. Built top-down with a binned SAH: the upper levels are split on the
+// calling thread until there is enough independent work, the subtrees below are built
+// in parallel. The binary tree is then collapsed to four children per node, stored as
+// structure-of-arrays boxes, and every leaf holds at most four triangles as one SIMD
+// packet, so both the box and the triangle tests run four-wide in SSE registers.
+//
+// The mesh is copied into the packets; the BVH does not reference it afterwards.
+class MeshBvh {
+public:
+	MeshBvh(const Mesh& mesh, ThreadPool& pool);
+
+	RayHit closestHit(const Ray& ray) const;
+	// true as soon as any triangle is hit between tMin and tMax; for shadow and collision rays
+	bool anyHit(const Ray& ray) const;
+
+	// four rays traversed together: a node is visited while any of them still may hit it;
+	// pays off for coherent rays (neighbouring camera pixels), not for scattered ones
+	void closestHit4(const Ray* rays, RayHit* hits) const;
+	// rays in packets of four, the packets spread over the pool
+	void closestHits(const std::vector<Ray>& rays, std::vector<RayHit>& hits, ThreadPool& pool) const;
+
+	size_t nodeCount() const {
+		return nodes.size();
+	}
+	size_t triangleCount() const {
+		return triangles;
+	}
+
+private:
+	static const uint32_t LeafFlag = 0x80000000u;
+	static const uint32_t EmptyChild = UINT32_MAX;
+	static const uint32_t MaxLeafTriangles = 4;
+	// past SahDepth ranges are halved at the median, so after at most 32 more levels (a
+	// range never holds 2^32 triangles) every range is a leaf, whatever the mesh; the
+	// traversal stacks are sized for that depth: each visit pops one entry and pushes four
+	static const uint32_t SahDepth = 32;
+	static const uint32_t MaxDepth = SahDepth + 32;
+	static const uint32_t StackSize = 3 * MaxDepth + 1;
+
+	struct alignas(16) Node {
+		float minX[4], minY[4], minZ[4];
+		float maxX[4], maxY[4], maxZ[4];
+		uint32_t child[4]; // node index, LeafFlag | packet index, or EmptyChild
+	};
+	// up to four triangles as first corner and two edges; unused lanes have zero edges and never hit
+	struct alignas(16) TrianglePacket {
+		float v0x[4], v0y[4], v0z[4];
+		float e1x[4], e1y[4], e1z[4];
+		float e2x[4], e2y[4], e2z[4];
+		uint32_t id[4];
+	};
+
+	struct BuildNode {
+		glm::vec3 min, max;
+		uint32_t left = 0, right = 0;
+		uint32_t first = 0, count = 0; // count > 0: leaf over order[first, first + count)
+	};
+	struct BuildRange {
+		uint32_t node;
+		uint32_t first, count;
+		uint32_t depth;
+	};
+
+	// splits order[first, first + count) in two; false for a leaf
+	bool split(uint32_t first, uint32_t count, uint32_t depth, uint32_t& middle);
+	void bounds(uint32_t first, uint32_t count, glm::vec3& min, glm::vec3& max) const;
+	void buildSubtree(std::vector<BuildNode>& out, const BuildRange& range);
+	uint32_t collapse(const std::vector<BuildNode>& tree, uint32_t node);
+	uint32_t makePacket(const BuildNode& leaf);
+
+	// build only
+	const std::vector<glm::vec3>* vertices = nullptr;
+	const std::vector<uint32_t>* indexes = nullptr;
+	std::vector<glm::vec3> centroids;
+	std::vector<glm::vec3> boxMin, boxMax;
+	std::vector<uint32_t> order;
+
+	size_t triangles = 0;
+	std::vector<Node> nodes; // nodes[0] is the root
+	std::vector<TrianglePacket> packets;
+};
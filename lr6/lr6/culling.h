@@ -0,0 +1,292 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cfloat>
+
+#include <immintrin.h>
+
+#include <glm.hpp>
+
+#include "figure.h"
+
+struct BoundingBox {
+	glm::vec3 min = glm::vec3(FLT_MAX);
+	glm::vec3 max = glm::vec3(-FLT_MAX);
+};
+
+struct BoundingSphere {
+	glm::vec3 center = glm::vec3(0.0f);
+	float radius = 0.0f;
+
+	BoundingSphere transformed(const glm::mat4& m) const {
+		float scale = glm::max(glm::length(glm::vec3(m[0])), glm::max(glm::length(glm::vec3(m[1])), glm::length(glm::vec3(m[2]))));
+		BoundingSphere result;
+		result.center = glm::vec3(m * glm::vec4(center, 1.0f));
+		result.radius = radius * scale;
+		return result;
+	}
+};
+
+// Normals of a patch lie within the cone; with the patch's bounding sphere this tells
+// whether every triangle faces away from a point (meshoptimizer's cluster cone test).
+struct NormalCone {
+	glm::vec3 axis = glm::vec3(0.0f, 0.0f, 1.0f);
+	float cutoff = 1.0f; // sin of the cone's half angle; 1 never culls
+
+	bool backfacing(const BoundingSphere& sphere, const glm::vec3& camera) const {
+		glm::vec3 to_center = sphere.center - camera;
+		return glm::dot(to_center, axis) >= cutoff * glm::length(to_center) + sphere.radius;
+	}
+};
+
+struct MeshBounds {
+	BoundingBox box;
+	BoundingSphere sphere;
+	std::vector<BoundingSphere> patches; // one per Mesh::getPatches() entry
+	std::vector<NormalCone> cones;       // one per patch, in mesh space
+};
+
+class BoundsBuilder {
+public:
+	static BoundingBox computeBox(const glm::vec3* v, size_t count) {
+		__m128 mn_x = _mm_set1_ps(FLT_MAX), mn_y = mn_x, mn_z = mn_x;
+		__m128 mx_x = _mm_set1_ps(-FLT_MAX), mx_y = mx_x, mx_z = mx_x;
+
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128 x, y, z;
+			loadSoA4(&v[i].x, x, y, z);
+			mn_x = _mm_min_ps(mn_x, x); mx_x = _mm_max_ps(mx_x, x);
+			mn_y = _mm_min_ps(mn_y, y); mx_y = _mm_max_ps(mx_y, y);
+			mn_z = _mm_min_ps(mn_z, z); mx_z = _mm_max_ps(mx_z, z);
+		}
+
+		BoundingBox box;
+		box.min = glm::vec3(horizontalMin(mn_x), horizontalMin(mn_y), horizontalMin(mn_z));
+		box.max = glm::vec3(horizontalMax(mx_x), horizontalMax(mx_y), horizontalMax(mx_z));
+		for (; i < count; i++)
+		{
+			box.min = glm::min(box.min, v[i]);
+			box.max = glm::max(box.max, v[i]);
+		}
+		return box;
+	}
+
+	// centered on the box, radius = farthest vertex
+	static BoundingSphere computeSphere(const glm::vec3* v, size_t count, const BoundingBox& box) {
+		BoundingSphere sphere;
+		if (count == 0)
+			return sphere;
+		sphere.center = (box.min + box.max) * 0.5f;
+
+		const __m128 c_x = _mm_set1_ps(sphere.center.x);
+		const __m128 c_y = _mm_set1_ps(sphere.center.y);
+		const __m128 c_z = _mm_set1_ps(sphere.center.z);
+		__m128 max_d2 = _mm_setzero_ps();
+
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128 x, y, z;
+			loadSoA4(&v[i].x, x, y, z);
+			x = _mm_sub_ps(x, c_x);
+			y = _mm_sub_ps(y, c_y);
+			z = _mm_sub_ps(z, c_z);
+			__m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+			max_d2 = _mm_max_ps(max_d2, d2);
+		}
+
+		float radius2 = horizontalMax(max_d2);
+		for (; i < count; i++)
+		{
+			glm::vec3 d = v[i] - sphere.center;
+			radius2 = glm::max(radius2, glm::dot(d, d));
+		}
+		sphere.radius = glm::sqrt(radius2);
+		return sphere;
+	}
+
+	static MeshBounds compute(const Mesh& msh) {
+		MeshBounds bounds;
+		const auto& vertices = msh.getVertices();
+		bounds.box = computeBox(vertices.data(), vertices.size());
+		bounds.sphere = computeSphere(vertices.data(), vertices.size(), bounds.box);
+
+		const auto& indexes = msh.getIndexes();
+		std::vector<glm::vec3> gathered;
+		for (const auto& patch : msh.getPatches())
+		{
+			gathered.clear();
+			for (uint32_t i = patch.firstIndex; i < patch.firstIndex + patch.countIndexes; i++)
+				gathered.push_back(vertices[indexes[i]]);
+			BoundingBox box = computeBox(gathered.data(), gathered.size());
+			bounds.patches.push_back(computeSphere(gathered.data(), gathered.size(), box));
+			bounds.cones.push_back(computeCone(vertices, indexes, patch));
+		}
+		return bounds;
+	}
+
+	// one patch per face of a subdivided icosahedron, whatever its level: the sphere around
+	// the face's spherical cap and the cone of the cap's normals; three corners per face
+	static MeshBounds sphereCaps(const std::vector<glm::vec3>& corners, float radius) {
+		MeshBounds bounds;
+		for (size_t face = 0; face + 2 < corners.size(); face += 3)
+		{
+			glm::vec3 axis = glm::normalize(corners[face] + corners[face + 1] + corners[face + 2]);
+			float cos_angle = glm::dot(axis, glm::normalize(corners[face]));
+			BoundingSphere cap;
+			cap.center = axis * radius * cos_angle;
+			cap.radius = radius * glm::max(glm::sqrt(1.0f - cos_angle * cos_angle), 1.0f - cos_angle);
+			bounds.patches.push_back(cap);
+
+			// the cap's normals are its positions, the widest one at a corner
+			NormalCone cone;
+			cone.axis = axis;
+			cone.cutoff = glm::sqrt(1.0f - cos_angle * cos_angle);
+			bounds.cones.push_back(cone);
+		}
+		bounds.box.min = glm::vec3(-radius);
+		bounds.box.max = glm::vec3(radius);
+		bounds.sphere.center = glm::vec3(0.0f);
+		bounds.sphere.radius = radius;
+		return bounds;
+	}
+
+	// axis along the summed triangle normals, opened to the widest one
+	static NormalCone computeCone(const std::vector<glm::vec3>& vertices, const std::vector<uint32_t>& indexes, const MeshPatch& patch) {
+		NormalCone cone;
+		std::vector<glm::vec3> normals;
+		glm::vec3 sum(0.0f);
+		for (uint32_t i = patch.firstIndex; i + 2 < patch.firstIndex + patch.countIndexes; i += 3)
+		{
+			const glm::vec3& p0 = vertices[indexes[i]];
+			glm::vec3 normal = glm::cross(vertices[indexes[i + 1]] - p0, vertices[indexes[i + 2]] - p0);
+			float length = glm::length(normal);
+			if (length == 0.0f)
+				continue;
+			normals.push_back(normal / length);
+			sum += normals.back();
+		}
+		if (normals.empty() || glm::length(sum) == 0.0f)
+			return cone;
+
+		cone.axis = glm::normalize(sum);
+		float min_dot = 1.0f;
+		for (const auto& normal : normals)
+			min_dot = glm::min(min_dot, glm::dot(cone.axis, normal));
+		// at 90 degrees or more some triangle faces every direction
+		cone.cutoff = min_dot <= 0.0f ? 1.0f : glm::sqrt(1.0f - min_dot * min_dot);
+		return cone;
+	}
+
+private:
+	// 4 packed vec3 (12 floats) -> x, y, z lanes
+	static void loadSoA4(const float* p, __m128& x, __m128& y, __m128& z) {
+		__m128 a = _mm_loadu_ps(p);     // x0 y0 z0 x1
+		__m128 b = _mm_loadu_ps(p + 4); // y1 z1 x2 y2
+		__m128 c = _mm_loadu_ps(p + 8); // z2 x3 y3 z3
+
+		x = _mm_shuffle_ps(a, _mm_shuffle_ps(b, c, _MM_SHUFFLE(0, 1, 0, 2)), _MM_SHUFFLE(2, 0, 3, 0));
+		y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 0, 1)), _mm_shuffle_ps(b, c, _MM_SHUFFLE(0, 2, 0, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+		z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 1, 0, 2)), _mm_shuffle_ps(c, c, _MM_SHUFFLE(0, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+	}
+	static float horizontalMin(__m128 v) {
+		v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+		v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+		return _mm_cvtss_f32(v);
+	}
+	static float horizontalMax(__m128 v) {
+		v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+		v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+		return _mm_cvtss_f32(v);
+	}
+};
+
+// Spheres in SoA form, padded to a multiple of 4 so the frustum test needs no tail.
+class SphereBatch {
+public:
+	void clear() {
+		x.clear(); y.clear(); z.clear(); r.clear();
+		count = 0;
+	}
+	void push(const BoundingSphere& s) {
+		if (count == x.size())
+		{
+			for (int i = 0; i < 4; i++)
+			{
+				x.push_back(0.0f); y.push_back(0.0f); z.push_back(0.0f);
+				r.push_back(-FLT_MAX); // padding lanes are never visible
+			}
+		}
+		x[count] = s.center.x;
+		y[count] = s.center.y;
+		z[count] = s.center.z;
+		r[count] = s.radius;
+		count++;
+	}
+	size_t size() const {
+		return count;
+	}
+
+	std::vector<float> x, y, z, r;
+private:
+	size_t count = 0;
+};
+
+class Frustum {
+public:
+	Frustum() = default;
+
+	// planes from a projection * view matrix, normals pointing inside
+	explicit Frustum(const glm::mat4& PV) {
+		glm::vec4 row[4];
+		for (int i = 0; i < 4; i++)
+			row[i] = glm::vec4(PV[0][i], PV[1][i], PV[2][i], PV[3][i]);
+
+		planes[0] = row[3] + row[0];
+		planes[1] = row[3] - row[0];
+		planes[2] = row[3] + row[1];
+		planes[3] = row[3] - row[1];
+		planes[4] = row[3] + row[2];
+		planes[5] = row[3] - row[2];
+		for (auto& plane : planes)
+			plane /= glm::length(glm::vec3(plane));
+	}
+
+	bool testSphere(const BoundingSphere& s) const {
+		for (const auto& plane : planes)
+			if (glm::dot(glm::vec3(plane), s.center) + plane.w < -s.radius)
+				return false;
+		return true;
+	}
+
+	// visible[i] = 1 if sphere i intersects the frustum; four spheres per iteration
+	void testSpheres(const SphereBatch& batch, std::vector<uint8_t>& visible) const {
+		visible.resize(batch.x.size());
+		for (size_t i = 0; i < batch.x.size(); i += 4)
+		{
+			__m128 x = _mm_loadu_ps(&batch.x[i]);
+			__m128 y = _mm_loadu_ps(&batch.y[i]);
+			__m128 z = _mm_loadu_ps(&batch.z[i]);
+			__m128 neg_r = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&batch.r[i]));
+
+			__m128 inside = _mm_cmpge_ps(neg_r, neg_r); // all ones, except NaN
+			for (const auto& plane : planes)
+			{
+				__m128 d = _mm_add_ps(
+					_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(plane.x)), _mm_mul_ps(y, _mm_set1_ps(plane.y))),
+					_mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(d, neg_r));
+			}
+
+			int mask = _mm_movemask_ps(inside);
+			for (int lane = 0; lane < 4; lane++)
+				visible[i + lane] = (mask >> lane) & 1;
+		}
+		visible.resize(batch.size());
+	}
+
+	glm::vec4 planes[6];
+};
@@ -32,12 +32,22 @@ struct Comparator
 	};
 };
 
+// contiguous range of getIndexes() that can be culled on its own
+struct MeshPatch {
+	uint32_t firstIndex;
+	uint32_t countIndexes;
+};
+
 class Mesh {
 public:
 	virtual const std::vector<glm::vec3>& getVertices() const = 0;
 	virtual const std::vector<glm::vec3>& getNormals() const = 0;
 	virtual const std::vector<uint32_t>& getIndexes() const = 0;
 	virtual const std::vector<glm::vec3>& getFaceNormals() const = 0;
+	virtual const std::vector<MeshPatch>& getPatches() const {
+		static const std::vector<MeshPatch> none;
+		return none;
+	}
 };
 class Icosaedr : public Mesh {
 private:
@@ -268,4 +278,38 @@ public:
 		fout << "endsolid name";
 		fout.close();
 	}
+
+	// Wavefront OBJ with per-vertex normals and, when given, texture coordinates (one per
+	// vertex); unlike STL the mesh stays indexed, so seam copies keep their own UVs
+	static void toObj(const Mesh& msh, std::string filename, const std::vector<glm::vec2>* uvs = nullptr)
+	{
+		const auto& vertices = msh.getVertices();
+		const auto& normals = msh.getNormals();
+		const auto& indexes = msh.getIndexes();
+
+		std::ofstream fout(filename + ".obj");
+		for (const auto& v : vertices)
+			fout << "v " << v.x << " " << v.y << " " << v.z << "\n";
+		for (const auto& n : normals)
+			fout << "vn " << n.x << " " << n.y << " " << n.z << "\n";
+		if (uvs)
+			for (const auto& uv : *uvs)
+				fout << "vt " << uv.x << " " << uv.y << "\n";
+
+		// OBJ counts from 1; position, coordinate and normal share the vertex index
+		for (uint32_t i = 0; i + 2 < indexes.size(); i += 3)
+		{
+			fout << "f";
+			for (uint32_t j = 0; j < 3; j++)
+			{
+				const uint32_t k = indexes[i + j] + 1;
+				if (uvs)
+					fout << " " << k << "/" << k << "/" << k;
+				else
+					fout << " " << k << "//" << k;
+			}
+			fout << "\n";
+		}
+		fout.close();
+	}
 };
\ No newline at end of file
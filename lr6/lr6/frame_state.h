@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cstdint>
+
+#include <glm.hpp>
+
+struct SceneObject {
+	glm::mat4 modelMatrix = glm::mat4(1.0f);
+	bool dynamic = false; // draws the streamed mesh once it has content
+
+	bool specular = true;
+	bool customColor = false; // otherwise the material colour baked into the shader
+	glm::vec3 color = glm::vec3(1.0f);
+	uint32_t texture = 0; // handle from Renderer::loadTexture; 0 for none
+};
+struct PointLight {
+	glm::vec3 position;
+	glm::vec3 color;
+	float radius = 100.0f; // clustered shading only: the light fades to zero at this distance
+};
+
+// Everything the update thread owns and may change between frames.
+struct SceneState {
+	glm::mat4 viewMatrix = glm::mat4(1.0f);
+	glm::mat4 projectionMatrix = glm::mat4(1.0f);
+	std::vector<PointLight> lights;
+	std::vector<SceneObject> objects;
+};
+
+// One object as the render thread sees it: matrices are already multiplied out.
+struct ObjectState {
+	glm::mat4 modelMatrix;
+	glm::mat4 VM;
+	glm::mat4 PVM;
+	glm::mat3 normalMatrix;
+	glm::vec3 color;
+	uint32_t shaderVariant;
+	uint32_t texture;
+	bool dynamic;
+};
+
+// Immutable snapshot of one simulation step.
+struct FrameState {
+	uint64_t frame = 0;
+	glm::mat4 viewMatrix;
+	glm::mat4 projectionMatrix;
+	glm::vec3 cameraPosition;
+	std::vector<PointLight> lights;
+	std::vector<ObjectState> objects;
+};
+
+// Lock-free single producer / single consumer hand-off. The writer fills back() and
+// publishes it, the reader takes the newest published slot; neither ever waits and
+// an unread snapshot is simply overwritten by a newer one. Slots are reused, so the
+// vectors inside T keep their capacity and steady state does not allocate.
+template<typename T>
+class TripleBuffer {
+public:
+	// writer
+	T& back() {
+		return slots[backIndex];
+	}
+	void publish() {
+		uint32_t previous = middle.exchange(backIndex | Fresh, std::memory_order_acq_rel);
+		backIndex = previous & IndexMask;
+	}
+
+	// reader; false if nothing was published since the last call
+	bool acquire() {
+		if (!(middle.load(std::memory_order_relaxed) & Fresh))
+			return false;
+		uint32_t previous = middle.exchange(frontIndex, std::memory_order_acq_rel);
+		frontIndex = previous & IndexMask;
+		return true;
+	}
+	const T& front() const {
+		return slots[frontIndex];
+	}
+
+private:
+	static const uint32_t IndexMask = 3;
+	static const uint32_t Fresh = 4;
+
+	T slots[3];
+	uint32_t backIndex = 0;
+	std::atomic<uint32_t> middle{ 1 };
+	uint32_t frontIndex = 2;
+};
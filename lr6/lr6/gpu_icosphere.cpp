@@ -0,0 +1,87 @@
+#include "gpu_icosphere.h"
+
+#include <algorithm>
+
+#include "lod.h"
+
+GpuIcosphereGenerator::GpuIcosphereGenerator(uint32_t _program) : program(_program)
+{
+	IcosphereGrid base(0);
+	corners = base.getCorners();
+	radius = base.getRadius();
+	baseEdgeLength = IcosphereLodChain::averageEdgeLength(base);
+}
+
+void GpuIcosphereGenerator::dispatch(uint32_t mode, uint32_t level, uint32_t count) const {
+	const uint32_t group_size = 64;
+	const uint32_t max_groups = 65535;
+	const uint32_t groups = (count + group_size - 1) / group_size;
+
+	glUniform1ui(glGetUniformLocation(program, "mode"), mode);
+	glUniform1ui(glGetUniformLocation(program, "level"), level);
+	glUniform1ui(glGetUniformLocation(program, "count"), count);
+	glDispatchCompute(std::min(groups, max_groups), (groups + max_groups - 1) / max_groups, 1);
+}
+
+GpuMesh GpuIcosphereGenerator::generate(uint32_t level) const {
+	const uint32_t vertex_count = IcosphereGrid::vertexCount(level);
+	const uint32_t index_count = IcosphereGrid::indexCount(level);
+
+	GpuMesh lod;
+	MeshDeviceHandles& handles = lod.handles;
+	handles.format.interleaved = true;
+	handles.indexType = GL_UNSIGNED_INT;
+	handles.countElements = index_count;
+
+	glGenBuffers(1, &handles.VBO_vertex);
+	glGenBuffers(1, &handles.EBO);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, handles.VBO_vertex);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, size_t(vertex_count) * handles.format.stride(), NULL, GL_STATIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, handles.EBO);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, size_t(index_count) * sizeof(uint32_t), NULL, GL_STATIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glUseProgram(program);
+	glUniform3fv(glGetUniformLocation(program, "faceCorners"), corners.size(), &corners[0].x);
+	glUniform1f(glGetUniformLocation(program, "sphereRadius"), radius);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, handles.VBO_vertex);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, handles.EBO);
+	dispatch(0, level, vertex_count);
+	dispatch(1, level, index_count / 3);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+	glUseProgram(0);
+
+	glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_ELEMENT_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+	MeshUploader::createVertexArray(handles);
+
+	// one patch per base face; each is bounded by the sphere around its spherical cap
+	const uint32_t face_indexes = index_count / IcosphereGrid::FaceCount;
+	for (uint32_t face = 0; face < IcosphereGrid::FaceCount; face++)
+		lod.patches.push_back({ face * face_indexes, face_indexes });
+	lod.bounds = BoundsBuilder::sphereCaps(corners, radius);
+	lod.edgeLength = baseEdgeLength / IcosphereGrid::side(level);
+	return lod;
+}
+
+MeshDifference GpuIcosphereGenerator::validate(const MeshDeviceHandles& handles, const Mesh& reference) {
+	std::vector<float> packed;
+	GLint64 vertex_bytes = 0;
+	glBindBuffer(GL_ARRAY_BUFFER, handles.VBO_vertex);
+	glGetBufferParameteri64v(GL_ARRAY_BUFFER, GL_BUFFER_SIZE, &vertex_bytes);
+	packed.resize(vertex_bytes / sizeof(float));
+	glGetBufferSubData(GL_ARRAY_BUFFER, 0, vertex_bytes, packed.data());
+
+	std::vector<uint32_t> indexes(handles.countElements);
+	glBindBuffer(GL_ARRAY_BUFFER, handles.EBO);
+	glGetBufferSubData(GL_ARRAY_BUFFER, 0, indexes.size() * sizeof(uint32_t), indexes.data());
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	std::vector<glm::vec3> vertices, normals;
+	for (size_t i = 0; i + 5 < packed.size(); i += 6)
+	{
+		vertices.push_back(glm::vec3(packed[i], packed[i + 1], packed[i + 2]));
+		normals.push_back(glm::vec3(packed[i + 3], packed[i + 4], packed[i + 5]));
+	}
+	return MeshComparer::compare(vertices, normals, indexes, reference);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <vector>
+#include <cstdint>
+
+#include "gpu_mesh.h"
+#include "icosphere_grid.h"
+#include "mesh_compare.h"
+
+// Builds icosphere levels with the icosphere_compute_shader straight into the vertex
+// and element buffers the renderer draws from: nothing is generated on the CPU and
+// nothing is uploaded except the 20 base faces. GL 4.3.
+class GpuIcosphereGenerator {
+public:
+	// program: shaders_source::icosphere_compute_shader, linked by the caller
+	explicit GpuIcosphereGenerator(uint32_t _program);
+
+	// GL thread; the result owns its buffers and has no CPU mesh
+	GpuMesh generate(uint32_t level) const;
+
+	// GL thread; reads the buffers back (stalls) and compares them with reference
+	static MeshDifference validate(const MeshDeviceHandles& handles, const Mesh& reference);
+
+private:
+	void dispatch(uint32_t mode, uint32_t level, uint32_t count) const;
+
+	uint32_t program;
+	std::vector<glm::vec3> corners;
+	float radius;
+	float baseEdgeLength;
+};
@@ -0,0 +1,195 @@
+#include "gpu_mesh.h"
+
+#include <vector>
+
+void MeshUploader::uploadBuffers(const Mesh& msh, MeshDeviceHandles& handles, const VertexFormat& format) {
+	handles.format = format;
+
+	glGenBuffers(1, &handles.EBO);
+	glGenBuffers(1, &handles.VBO_vertex);
+	if (!format.interleaved)
+		glGenBuffers(1, &handles.VBO_normals);
+
+	std::vector<uint8_t> vertices = VertexPacker::packVertices(format, msh);
+	glBindBuffer(GL_ARRAY_BUFFER, handles.VBO_vertex);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size(), vertices.data(), GL_STATIC_DRAW);
+
+	if (!format.interleaved)
+	{
+		std::vector<uint8_t> normals = VertexPacker::packNormals(format, msh);
+		glBindBuffer(GL_ARRAY_BUFFER, handles.VBO_normals);
+		glBufferData(GL_ARRAY_BUFFER, normals.size(), normals.data(), GL_STATIC_DRAW);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	// bound as an array buffer: without a VAO there is no element array binding
+	std::vector<uint8_t> indexes = VertexPacker::packIndexes(format, msh);
+	glBindBuffer(GL_ARRAY_BUFFER, handles.EBO);
+	glBufferData(GL_ARRAY_BUFFER, indexes.size(), indexes.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	handles.indexType = format.shortIndices ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	handles.countElements = msh.getIndexes().size();
+}
+
+void MeshUploader::respecify(const Mesh& msh, MeshDeviceHandles& handles) {
+	const VertexFormat& format = handles.format;
+	std::vector<uint8_t> vertices = VertexPacker::packVertices(format, msh);
+	glBindBuffer(GL_ARRAY_BUFFER, handles.VBO_vertex);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size(), vertices.data(), GL_DYNAMIC_DRAW);
+	if (!format.interleaved)
+	{
+		std::vector<uint8_t> normals = VertexPacker::packNormals(format, msh);
+		glBindBuffer(GL_ARRAY_BUFFER, handles.VBO_normals);
+		glBufferData(GL_ARRAY_BUFFER, normals.size(), normals.data(), GL_DYNAMIC_DRAW);
+	}
+	std::vector<uint8_t> indexes = VertexPacker::packIndexes(format, msh);
+	glBindBuffer(GL_ARRAY_BUFFER, handles.EBO);
+	glBufferData(GL_ARRAY_BUFFER, indexes.size(), indexes.data(), GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	handles.countElements = msh.getIndexes().size();
+}
+
+void MeshUploader::createVertexArray(MeshDeviceHandles& handles) {
+	const VertexFormat& format = handles.format;
+	const GLenum position_type = format.halfPositions ? GL_HALF_FLOAT : GL_FLOAT;
+	const GLint position_components = format.halfPositions ? 4 : 3;
+	const GLenum normal_type = format.packedNormals ? GL_INT_2_10_10_10_REV : GL_FLOAT;
+	const GLint normal_components = format.packedNormals ? 4 : 3;
+
+	glGenVertexArrays(1, &handles.VAO);
+	glBindVertexArray(handles.VAO);
+
+	glBindBuffer(GL_ARRAY_BUFFER, handles.VBO_vertex);
+	glVertexAttribPointer(0, position_components, position_type, GL_FALSE, format.stride(), (void*)0);
+	glEnableVertexAttribArray(0);
+
+	if (format.interleaved)
+		glVertexAttribPointer(1, normal_components, normal_type, GL_TRUE, format.stride(), (void*)(uintptr_t)format.positionSize());
+	else
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, handles.VBO_normals);
+		glVertexAttribPointer(1, normal_components, normal_type, GL_TRUE, format.normalSize(), (void*)0);
+	}
+	glEnableVertexAttribArray(1);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, handles.EBO);
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+void MeshUploader::destroy(MeshDeviceHandles& handles) {
+	glDeleteVertexArrays(1, &handles.VAO);
+	glDeleteBuffers(1, &handles.EBO);
+	glDeleteBuffers(1, &handles.VBO_normals);
+	glDeleteBuffers(1, &handles.VBO_vertex);
+	handles.VAO = handles.EBO = handles.VBO_normals = handles.VBO_vertex = 0;
+}
+
+void PatchUploader::createSlots(const PatchedIcosphere& sphere, MeshDeviceHandles& handles) {
+	const uint32_t max_level = sphere.getMaxLevel();
+	const size_t vertices = size_t(PatchedIcosphere::FaceCount) * PatchedIcosphere::slotVertices(max_level);
+	const size_t indexes = size_t(PatchedIcosphere::FaceCount) * PatchedIcosphere::slotIndexes(max_level);
+	handles.format = VertexFormat::separate();
+
+	glGenBuffers(1, &handles.EBO);
+	glGenBuffers(1, &handles.VBO_vertex);
+	glGenBuffers(1, &handles.VBO_normals);
+	glBindBuffer(GL_ARRAY_BUFFER, handles.VBO_vertex);
+	glBufferData(GL_ARRAY_BUFFER, vertices * sizeof(glm::vec3), NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, handles.VBO_normals);
+	glBufferData(GL_ARRAY_BUFFER, vertices * sizeof(glm::vec3), NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, handles.EBO);
+	glBufferData(GL_ARRAY_BUFFER, indexes * sizeof(uint32_t), NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	handles.indexType = GL_UNSIGNED_INT;
+	handles.countElements = indexes;
+	MeshUploader::createVertexArray(handles);
+
+	for (uint32_t patch = 0; patch < PatchedIcosphere::FaceCount; patch++)
+		uploadPatch(sphere, handles, patch);
+}
+
+void PatchUploader::uploadChanged(const PatchedIcosphere& sphere, MeshDeviceHandles& handles) {
+	for (uint32_t patch : sphere.changedPatches())
+		uploadPatch(sphere, handles, patch);
+}
+
+void PatchUploader::uploadPatch(const PatchedIcosphere& sphere, MeshDeviceHandles& handles, uint32_t patch) {
+	const uint32_t max_level = sphere.getMaxLevel();
+	const auto& vertices = sphere.patchVertices(patch);
+	const auto& normals = sphere.patchNormals(patch);
+	const auto& indexes = sphere.patchIndexes(patch);
+	const GLintptr vertex_offset = GLintptr(patch) * PatchedIcosphere::slotVertices(max_level) * sizeof(glm::vec3);
+
+	glBindBuffer(GL_ARRAY_BUFFER, handles.VBO_vertex);
+	glBufferSubData(GL_ARRAY_BUFFER, vertex_offset, vertices.size() * sizeof(glm::vec3), vertices.data());
+	glBindBuffer(GL_ARRAY_BUFFER, handles.VBO_normals);
+	glBufferSubData(GL_ARRAY_BUFFER, vertex_offset, normals.size() * sizeof(glm::vec3), normals.data());
+	glBindBuffer(GL_ARRAY_BUFFER, handles.EBO);
+	glBufferSubData(GL_ARRAY_BUFFER, GLintptr(patch) * PatchedIcosphere::slotIndexes(max_level) * sizeof(uint32_t),
+		indexes.size() * sizeof(uint32_t), indexes.data());
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void AdaptiveUploader::upload(const Mesh& mesh, size_t vertexCapacity, MeshDeviceHandles& handles) {
+	const bool created = handles.VAO == 0;
+	if (created)
+	{
+		handles.format = VertexFormat::separate();
+		glGenBuffers(1, &handles.EBO);
+		glGenBuffers(1, &handles.VBO_vertex);
+		glGenBuffers(1, &handles.VBO_normals);
+	}
+	const auto& vertices = mesh.getVertices();
+	const auto& normals = mesh.getNormals();
+	const auto& indexes = mesh.getIndexes();
+	const size_t reserved = vertexCapacity * sizeof(glm::vec3);
+
+	// respecified in place, so the VAO stays valid
+	glBindBuffer(GL_ARRAY_BUFFER, handles.VBO_vertex);
+	glBufferData(GL_ARRAY_BUFFER, reserved, NULL, GL_DYNAMIC_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, vertices.size() * sizeof(glm::vec3), vertices.data());
+	glBindBuffer(GL_ARRAY_BUFFER, handles.VBO_normals);
+	glBufferData(GL_ARRAY_BUFFER, reserved, NULL, GL_DYNAMIC_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, normals.size() * sizeof(glm::vec3), normals.data());
+	glBindBuffer(GL_ARRAY_BUFFER, handles.EBO);
+	glBufferData(GL_ARRAY_BUFFER, indexes.size() * sizeof(uint32_t), indexes.data(), GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	handles.indexType = GL_UNSIGNED_INT;
+	handles.countElements = indexes.size();
+	if (created)
+		MeshUploader::createVertexArray(handles);
+}
+
+void AdaptiveUploader::uploadChanged(const Mesh& mesh, const std::vector<uint32_t>& changed, const std::vector<uint32_t>& changedFaces, MeshDeviceHandles& handles) {
+	const auto& vertices = mesh.getVertices();
+	const auto& normals = mesh.getNormals();
+	for (size_t i = 0; i < changed.size(); )
+	{
+		const uint32_t first = changed[i];
+		uint32_t last = first;
+		for (i++; i < changed.size() && changed[i] <= last + MergeGap; i++)
+			last = changed[i];
+		const GLintptr offset = GLintptr(first) * sizeof(glm::vec3);
+		const GLsizeiptr bytes = GLsizeiptr(last - first + 1) * sizeof(glm::vec3);
+		glBindBuffer(GL_ARRAY_BUFFER, handles.VBO_vertex);
+		glBufferSubData(GL_ARRAY_BUFFER, offset, bytes, &vertices[first]);
+		glBindBuffer(GL_ARRAY_BUFFER, handles.VBO_normals);
+		glBufferSubData(GL_ARRAY_BUFFER, offset, bytes, &normals[first]);
+	}
+
+	// the padding past a shrunk face is never drawn, so only the used part is sent
+	const auto& indexes = mesh.getIndexes();
+	const auto& slots = mesh.getPatches();
+	glBindBuffer(GL_ARRAY_BUFFER, handles.EBO);
+	for (uint32_t face : changedFaces)
+		if (slots[face].countIndexes > 0)
+			glBufferSubData(GL_ARRAY_BUFFER, GLintptr(slots[face].firstIndex) * sizeof(uint32_t),
+				GLsizeiptr(slots[face].countIndexes) * sizeof(uint32_t), &indexes[slots[face].firstIndex]);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
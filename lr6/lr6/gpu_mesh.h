@@ -0,0 +1,102 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+#include "figure.h"
+#include "vertex_format.h"
+#include "culling.h"
+#include "icosphere_patches.h"
+#include "adaptive_icosphere.h"
+
+struct MeshDeviceHandles {
+	uint32_t VAO = 0;
+	uint32_t EBO = 0;
+	uint32_t VBO_vertex = 0;
+	uint32_t VBO_normals = 0;
+
+	VertexFormat format;
+	uint32_t indexType = GL_UNSIGNED_INT;
+	size_t countElements = 0;
+};
+// layout fixed by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand {
+	uint32_t count;
+	uint32_t instanceCount;
+	uint32_t firstIndex;
+	int32_t baseVertex;
+	uint32_t baseInstance;
+};
+
+// one resident level of detail
+struct GpuMesh {
+	std::shared_ptr<Mesh> mesh; // null when the buffers were produced on the GPU
+	MeshDeviceHandles handles;
+	std::vector<MeshPatch> patches;
+	MeshBounds bounds;
+	float edgeLength = 0.0f;
+};
+
+// Buffers are shared between contexts but vertex array objects are not, so the
+// upload is split: uploadBuffers may run on any context sharing with the window,
+// createVertexArray must run on the context that draws.
+class MeshUploader {
+public:
+	static void uploadBuffers(const Mesh& msh, MeshDeviceHandles& handles, const VertexFormat& format);
+	static void createVertexArray(MeshDeviceHandles& handles);
+
+	static void upload(const Mesh& msh, MeshDeviceHandles& handles, const VertexFormat& format) {
+		uploadBuffers(msh, handles, format);
+		createVertexArray(handles);
+	}
+	// refills the buffers of an uploaded mesh whose sizes changed; the VAO stays valid
+	static void respecify(const Mesh& msh, MeshDeviceHandles& handles);
+	static void destroy(MeshDeviceHandles& handles);
+};
+
+// Fixed-size slots for the patches of a PatchedIcosphere: patch p starts at vertex
+// p * slotVertices and index p * slotIndexes, with indexes relative to the slot, so a
+// rebuilt patch is rewritten in place and drawn with a base vertex.
+class PatchUploader {
+public:
+	// GL thread; float positions and normals, 32-bit indexes, every patch uploaded
+	static void createSlots(const PatchedIcosphere& sphere, MeshDeviceHandles& handles);
+	// the patches PatchedIcosphere::rebuild changed last
+	static void uploadChanged(const PatchedIcosphere& sphere, MeshDeviceHandles& handles);
+
+private:
+	static void uploadPatch(const PatchedIcosphere& sphere, MeshDeviceHandles& handles, uint32_t patch);
+};
+
+// Buffers mirroring an AdaptiveIcosphere: vertices at their id with room up to
+// vertexCapacity(), indexes in the mesh's face slots. After an update only the changed
+// faces' slots and the changed vertex ids are written with glBufferSubData; the buffers
+// are reallocated only when the mesh reports a layout change. A mesh derived from one
+// with the same layout, such as a DisplacedSphere following it, goes through the Mesh
+// overloads with its own lists of what changed.
+class AdaptiveUploader {
+public:
+	// GL thread; float positions and normals, 32-bit indexes, everything uploaded
+	static void upload(const AdaptiveIcosphere& sphere, MeshDeviceHandles& handles) {
+		upload(sphere, sphere.vertexCapacity(), handles);
+	}
+	// what the last AdaptiveIcosphere::update changed
+	static void uploadChanged(const AdaptiveIcosphere& sphere, MeshDeviceHandles& handles) {
+		if (sphere.layoutChanged())
+			upload(sphere, handles);
+		else
+			uploadChanged(sphere, sphere.changedVertices(), sphere.changedFaces(), handles);
+	}
+
+	// vertex buffers sized for vertexCapacity vertices
+	static void upload(const Mesh& mesh, size_t vertexCapacity, MeshDeviceHandles& handles);
+	// changedVertices ascending; faces index getPatches()
+	static void uploadChanged(const Mesh& mesh, const std::vector<uint32_t>& changedVertices, const std::vector<uint32_t>& changedFaces, MeshDeviceHandles& handles);
+
+private:
+	// vertex ids come from a free list, so runs closer than this are sent as one
+	static const uint32_t MergeGap = 16;
+};
@@ -0,0 +1,155 @@
+#include "heightmap.h"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+
+#include <glm.hpp>
+
+namespace {
+
+inline __m128 floor4(__m128 x) {
+	__m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+	return _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, x), _mm_set1_ps(1.0f)));
+}
+
+std::mutex cacheMutex;
+std::map<std::string, std::shared_ptr<const Heightmap>> cache;
+
+}
+
+Heightmap::Heightmap(const Image& image) {
+	if (image.width == 0 || image.height == 0)
+		throw std::exception("Heightmap: empty image");
+
+	Level base;
+	base.width = image.width;
+	base.height = image.height;
+	base.texels.resize(size_t(image.width) * image.height);
+	for (size_t i = 0; i < base.texels.size(); i++)
+	{
+		const uint8_t* rgba = &image.pixels[i * 4];
+		base.texels[i] = (0.2126f * rgba[0] + 0.7152f * rgba[1] + 0.0722f * rgba[2]) / 255.0f;
+	}
+	levels.push_back(std::move(base));
+
+	while (levels.back().width > 1 || levels.back().height > 1)
+	{
+		Level next;
+		downsample(levels.back(), next);
+		levels.push_back(std::move(next));
+	}
+}
+
+std::shared_ptr<const Heightmap> Heightmap::load(const std::string& path) {
+	{
+		std::lock_guard<std::mutex> lock(cacheMutex);
+		auto found = cache.find(path);
+		if (found != cache.end())
+			return found->second;
+	}
+	// decoded outside the lock; if two threads race, both decode and the first one wins
+	auto heightmap = std::make_shared<const Heightmap>(ImageDecoder::decode(path));
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	return cache.emplace(path, heightmap).first->second;
+}
+
+void Heightmap::clearCache() {
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	cache.clear();
+}
+
+void Heightmap::downsample(const Level& source, Level& target) {
+	target.width = std::max<uint32_t>(1, source.width / 2);
+	target.height = std::max<uint32_t>(1, source.height / 2);
+	target.texels.resize(size_t(target.width) * target.height);
+
+	// an odd last row or column is folded into its neighbour by clamping
+	const __m128 quarter = _mm_set1_ps(0.25f);
+	for (uint32_t y = 0; y < target.height; y++)
+	{
+		const float* row0 = &source.texels[size_t(std::min(2 * y, source.height - 1)) * source.width];
+		const float* row1 = &source.texels[size_t(std::min(2 * y + 1, source.height - 1)) * source.width];
+		float* out = &target.texels[size_t(y) * target.width];
+
+		uint32_t x = 0;
+		for (; 2 * x + 8 <= source.width && x + 4 <= target.width; x += 4)
+		{
+			__m128 a = _mm_add_ps(_mm_loadu_ps(row0 + 2 * x), _mm_loadu_ps(row1 + 2 * x));
+			__m128 b = _mm_add_ps(_mm_loadu_ps(row0 + 2 * x + 4), _mm_loadu_ps(row1 + 2 * x + 4));
+			__m128 even = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+			__m128 odd = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+			_mm_storeu_ps(out + x, _mm_mul_ps(_mm_add_ps(even, odd), quarter));
+		}
+		for (; x < target.width; x++)
+		{
+			const uint32_t x0 = std::min(2 * x, source.width - 1), x1 = std::min(2 * x + 1, source.width - 1);
+			out[x] = (row0[x0] + row0[x1] + row1[x0] + row1[x1]) * 0.25f;
+		}
+	}
+}
+
+uint32_t Heightmap::levelFor(float angle) const {
+	const float max_width = 2.0f * glm::pi<float>() / glm::max(angle, 1e-9f);
+	for (uint32_t level = 0; level < levels.size(); level++)
+		if (float(levels[level].width) <= max_width)
+			return level;
+	return static_cast<uint32_t>(levels.size() - 1);
+}
+
+__m128 Heightmap::sample4(uint32_t level, __m128 u, __m128 v) const {
+	const Level& map = levels[std::min<size_t>(level, levels.size() - 1)];
+	const __m128 width = _mm_set1_ps(float(map.width));
+	const __m128 last_row = _mm_set1_ps(float(map.height - 1));
+	const __m128 one = _mm_set1_ps(1.0f);
+
+	// texel centres sit at half-integer coordinates
+	__m128 x = _mm_sub_ps(_mm_mul_ps(u, width), _mm_set1_ps(0.5f));
+	__m128 y = _mm_sub_ps(_mm_mul_ps(v, _mm_set1_ps(float(map.height))), _mm_set1_ps(0.5f));
+	y = _mm_min_ps(_mm_max_ps(y, _mm_setzero_ps()), last_row);
+
+	__m128 x0 = floor4(x);
+	__m128 y0 = floor4(y);
+	const __m128 tx = _mm_sub_ps(x, x0);
+	const __m128 ty = _mm_sub_ps(y, y0);
+	// wrap x into [0, width), exactly, since the values are whole numbers
+	x0 = _mm_sub_ps(x0, _mm_mul_ps(floor4(_mm_div_ps(x0, width)), width));
+	__m128 x1 = _mm_add_ps(x0, one);
+	x1 = _mm_andnot_ps(_mm_cmpge_ps(x1, width), x1);
+	const __m128 y1 = _mm_min_ps(_mm_add_ps(y0, one), last_row);
+
+	alignas(16) int32_t ix0[4], ix1[4], iy0[4], iy1[4];
+	_mm_store_si128(reinterpret_cast<__m128i*>(ix0), _mm_cvttps_epi32(x0));
+	_mm_store_si128(reinterpret_cast<__m128i*>(ix1), _mm_cvttps_epi32(x1));
+	_mm_store_si128(reinterpret_cast<__m128i*>(iy0), _mm_cvttps_epi32(y0));
+	_mm_store_si128(reinterpret_cast<__m128i*>(iy1), _mm_cvttps_epi32(y1));
+
+	// SSE2 has no gather: the four corners are fetched per lane, the filter runs on all lanes
+	alignas(16) float c00[4], c10[4], c01[4], c11[4];
+	for (int lane = 0; lane < 4; lane++)
+	{
+		const float* row0 = &map.texels[size_t(iy0[lane]) * map.width];
+		const float* row1 = &map.texels[size_t(iy1[lane]) * map.width];
+		c00[lane] = row0[ix0[lane]];
+		c10[lane] = row0[ix1[lane]];
+		c01[lane] = row1[ix0[lane]];
+		c11[lane] = row1[ix1[lane]];
+	}
+	__m128 top = _mm_load_ps(c00), bottom = _mm_load_ps(c01);
+	top = _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(_mm_load_ps(c10), top), tx));
+	bottom = _mm_add_ps(bottom, _mm_mul_ps(_mm_sub_ps(_mm_load_ps(c11), bottom), tx));
+	return _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), ty));
+}
+
+float Heightmap::sample(uint32_t level, float u, float v) const {
+	return _mm_cvtss_f32(sample4(level, _mm_set1_ps(u), _mm_set1_ps(v)));
+}
+
+float Heightmap::poleHeight(uint32_t level, bool top) const {
+	const Level& map = levels[std::min<size_t>(level, levels.size() - 1)];
+	const float* row = &map.texels[top ? 0 : size_t(map.height - 1) * map.width];
+	double sum = 0.0;
+	for (uint32_t x = 0; x < map.width; x++)
+		sum += row[x];
+	return float(sum / map.width);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <immintrin.h>
+
+#include "image.h"
+
+// A single-channel height texture with its full mip chain, sampled on the CPU.
+// Levels are made with a 2x2 box filter; u wraps around, v is clamped, which suits
+// an equirectangular map of a sphere.
+class Heightmap {
+public:
+	struct Level {
+		uint32_t width = 0;
+		uint32_t height = 0;
+		std::vector<float> texels;
+	};
+
+	// luminance of the image in [0, 1]
+	explicit Heightmap(const Image& image);
+
+	// decoded on the first call for a path; later calls share the same map
+	static std::shared_ptr<const Heightmap> load(const std::string& path);
+	static void clearCache();
+
+	const std::vector<Level>& getLevels() const {
+		return levels;
+	}
+	// finest level whose texels span at least the given longitude angle, in radians
+	uint32_t levelFor(float angle) const;
+
+	// bilinear filtering of four (u, v) pairs at once
+	__m128 sample4(uint32_t level, __m128 u, __m128 v) const;
+	float sample(uint32_t level, float u, float v) const;
+	// mean of the first (v = 0) or last row, the one height all directions at a pole get
+	float poleHeight(uint32_t level, bool top) const;
+
+	static void downsample(const Level& source, Level& target);
+
+private:
+	std::vector<Level> levels;
+};
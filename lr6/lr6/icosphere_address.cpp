@@ -0,0 +1,201 @@
+#include "icosphere_address.h"
+
+#include <algorithm>
+#include <cfloat>
+
+namespace {
+
+struct Vec4 {
+	__m128 x, y, z;
+};
+
+inline __m128 select(__m128 mask, __m128 a, __m128 b) {
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+inline Vec4 select(__m128 mask, const Vec4& a, const Vec4& b) {
+	return { select(mask, a.x, b.x), select(mask, a.y, b.y), select(mask, a.z, b.z) };
+}
+
+inline __m128 dot(const Vec4& a, const Vec4& b) {
+	return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a.x, b.x), _mm_mul_ps(a.y, b.y)), _mm_mul_ps(a.z, b.z));
+}
+
+inline Vec4 cross(const Vec4& a, const Vec4& b) {
+	return {
+		_mm_sub_ps(_mm_mul_ps(a.y, b.z), _mm_mul_ps(a.z, b.y)),
+		_mm_sub_ps(_mm_mul_ps(a.z, b.x), _mm_mul_ps(a.x, b.z)),
+		_mm_sub_ps(_mm_mul_ps(a.x, b.y), _mm_mul_ps(a.y, b.x)),
+	};
+}
+
+// the direction of a + b, as Icosaedr projects an edge midpoint
+inline Vec4 midpoint(const Vec4& a, const Vec4& b) {
+	Vec4 sum = { _mm_add_ps(a.x, b.x), _mm_add_ps(a.y, b.y), _mm_add_ps(a.z, b.z) };
+	const __m128 scale = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(dot(sum, sum)));
+	return { _mm_mul_ps(sum.x, scale), _mm_mul_ps(sum.y, scale), _mm_mul_ps(sum.z, scale) };
+}
+
+glm::vec3 midpoint(const glm::vec3& a, const glm::vec3& b) {
+	return glm::normalize(a + b);
+}
+
+}
+
+IcosphereAddressing::IcosphereAddressing(uint32_t _level) :
+	level(std::min(_level, MaxLevel))
+{
+	// the base faces in Icosaedr's own order and winding
+	Icosaedr base;
+	const auto& vertices = base.getVertices();
+	const auto& indexes = base.getIndexes();
+	for (uint32_t face = 0; face < FaceCount; face++)
+	{
+		for (int corner = 0; corner < 3; corner++)
+			baseCorners[face][corner] = glm::normalize(vertices[indexes[face * 3 + corner]]);
+		const auto& c = baseCorners[face];
+		faceAxis[face] = glm::normalize(c[0] + c[1] + c[2]);
+		faceWinding[face] = glm::dot(c[0], glm::cross(c[1], c[2])) > 0.0f ? 1.0f : -1.0f;
+	}
+}
+
+void IcosphereAddressing::locate4(const glm::vec3* directions, TriangleId* ids) const {
+	alignas(16) float values[3][4];
+	for (int lane = 0; lane < 4; lane++)
+		for (int axis = 0; axis < 3; axis++)
+			values[axis][lane] = directions[lane][axis];
+	const Vec4 d = { _mm_load_ps(values[0]), _mm_load_ps(values[1]), _mm_load_ps(values[2]) };
+
+	// the icosahedron is regular, so the face whose axis is nearest contains the direction
+	__m128 best = _mm_set1_ps(-FLT_MAX);
+	__m128 best_face = _mm_setzero_ps();
+	for (uint32_t face = 0; face < FaceCount; face++)
+	{
+		const __m128 cosine = _mm_add_ps(_mm_add_ps(_mm_mul_ps(d.x, _mm_set1_ps(faceAxis[face].x)),
+			_mm_mul_ps(d.y, _mm_set1_ps(faceAxis[face].y))), _mm_mul_ps(d.z, _mm_set1_ps(faceAxis[face].z)));
+		const __m128 better = _mm_cmpgt_ps(cosine, best);
+		best = select(better, cosine, best);
+		best_face = select(better, _mm_set1_ps(static_cast<float>(face)), best_face);
+	}
+	alignas(16) float faces[4];
+	_mm_store_ps(faces, best_face);
+
+	alignas(16) float corner_values[3][3][4];
+	alignas(16) float winding_values[4];
+	for (int lane = 0; lane < 4; lane++)
+	{
+		const uint32_t face = static_cast<uint32_t>(faces[lane]);
+		ids[lane] = face;
+		winding_values[lane] = faceWinding[face];
+		for (int corner = 0; corner < 3; corner++)
+			for (int axis = 0; axis < 3; axis++)
+				corner_values[corner][axis][lane] = baseCorners[face][corner][axis];
+	}
+	Vec4 v[3];
+	for (int corner = 0; corner < 3; corner++)
+		v[corner] = { _mm_load_ps(corner_values[corner][0]), _mm_load_ps(corner_values[corner][1]), _mm_load_ps(corner_values[corner][2]) };
+	const __m128 winding = _mm_load_ps(winding_values);
+	const __m128 zero = _mm_setzero_ps();
+
+	for (uint32_t depth = 0; depth < level; depth++)
+	{
+		const Vec4 m[3] = { midpoint(v[0], v[1]), midpoint(v[1], v[2]), midpoint(v[2], v[0]) };
+		// corner j is cut off by the plane through m[j] and m[j + 2]
+		__m128 inside[3];
+		for (int j = 0; j < 3; j++)
+			inside[j] = _mm_cmpgt_ps(_mm_mul_ps(winding, dot(d, cross(m[j], m[(j + 2) % 3]))), zero);
+		// the planes do not overlap inside the parent; should rounding say otherwise, the lower corner wins
+		const __m128 take0 = inside[0];
+		const __m128 take1 = _mm_andnot_ps(take0, inside[1]);
+		const __m128 take2 = _mm_andnot_ps(_mm_or_ps(take0, take1), inside[2]);
+		const __m128 center = _mm_andnot_ps(_mm_or_ps(_mm_or_ps(take0, take1), take2), _mm_castsi128_ps(_mm_set1_epi32(-1)));
+
+		// child codes 0 1 2 3 as two bit masks
+		const int low = _mm_movemask_ps(_mm_or_ps(take1, center));
+		const int high = _mm_movemask_ps(_mm_or_ps(take2, center));
+		for (int lane = 0; lane < 4; lane++)
+			ids[lane] = (ids[lane] << 2) | ((low >> lane) & 1) | (((high >> lane) & 1) << 1);
+
+		const Vec4 corner0 = select(take0, v[0], select(take1, v[1], select(take2, v[2], m[0])));
+		const Vec4 corner1 = select(take0, m[0], select(take1, m[1], select(take2, m[2], m[1])));
+		const Vec4 corner2 = select(take0, m[2], select(take1, m[0], select(take2, m[1], m[2])));
+		v[0] = corner0;
+		v[1] = corner1;
+		v[2] = corner2;
+	}
+}
+
+TriangleId IcosphereAddressing::locate(const glm::vec3& direction) const {
+	// through the SSE path, so single and batched lookups agree to the bit
+	const glm::vec3 directions[4] = { direction, direction, direction, direction };
+	TriangleId ids[4];
+	locate4(directions, ids);
+	return ids[0];
+}
+
+void IcosphereAddressing::locate(const glm::vec3* directions, TriangleId* ids, size_t count) const {
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+		locate4(directions + i, ids + i);
+	if (i == count)
+		return;
+	glm::vec3 tail[4];
+	TriangleId tail_ids[4];
+	for (size_t lane = 0; lane < 4; lane++)
+		tail[lane] = directions[std::min(i + lane, count - 1)];
+	locate4(tail, tail_ids);
+	for (size_t lane = 0; i + lane < count; lane++)
+		ids[i + lane] = tail_ids[lane];
+}
+
+void IcosphereAddressing::locate(const std::vector<glm::vec3>& directions, std::vector<TriangleId>& ids, ThreadPool& pool) const {
+	ids.resize(directions.size());
+	const size_t packets = (directions.size() + 3) / 4;
+	pool.parallelFor(packets, 1024, [&](size_t begin, size_t end) {
+		const size_t first = begin * 4;
+		const size_t last = std::min(end * 4, directions.size());
+		locate(directions.data() + first, ids.data() + first, last - first);
+	});
+}
+
+uint64_t IcosphereAddressing::triangleIndex(TriangleId id) const {
+	uint64_t triangle = face(id, level);
+	for (uint32_t depth = 1; depth <= level; depth++)
+	{
+		const Child code = child(id, level, depth);
+		if (code != Center)
+			triangle = triangleCount(depth - 1) + 3 * triangle + code;
+	}
+	return triangle;
+}
+
+TriangleId IcosphereAddressing::idOf(uint64_t triangleIndex) const {
+	// undo the appends from the finest level up
+	TriangleId codes = 0;
+	for (uint32_t depth = level; depth > 0; depth--)
+	{
+		const uint64_t parents = triangleCount(depth - 1);
+		uint64_t code = Center;
+		if (triangleIndex >= parents)
+		{
+			code = (triangleIndex - parents) % 3;
+			triangleIndex = (triangleIndex - parents) / 3;
+		}
+		codes |= code << (2 * (level - depth));
+	}
+	return (triangleIndex << (2 * level)) | codes;
+}
+
+std::array<glm::vec3, 3> IcosphereAddressing::corners(TriangleId id) const {
+	std::array<glm::vec3, 3> v = baseCorners[face(id, level)];
+	for (uint32_t depth = 1; depth <= level; depth++)
+	{
+		const glm::vec3 m[3] = { midpoint(v[0], v[1]), midpoint(v[1], v[2]), midpoint(v[2], v[0]) };
+		const Child code = child(id, level, depth);
+		if (code == Center)
+			v = { m[0], m[1], m[2] };
+		else
+			v = { v[code], m[code], m[(code + 2) % 3] };
+	}
+	return v;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cstdint>
+
+#include <immintrin.h>
+#include <glm.hpp>
+
+#include "figure.h"
+#include "thread_pool.h"
+
+// Triangle of a subdivided Icosaedr named by its path down the subdivision tree: the
+// base face (0..19) in the top bits, then two bits per level for the child taken, the
+// first level highest. Ids of one level are dense in [0, triangleCount(level)).
+typedef uint64_t TriangleId;
+
+// Point location and id <-> triangle mapping for Icosaedr after `level` passes of
+// increaseApproximation, without the mesh. A triangle (v0, v1, v2) with edge midpoints
+// m0 (v0 v1), m1 (v1 v2), m2 (v2 v0) has the children Icosaedr gives it:
+//   Corner0 (v0, m0, m2), Corner1 (v1, m1, m0), Corner2 (v2, m2, m1), Center (m0, m1, m2)
+// Its region on the sphere is the central projection of the flat triangle, bounded by
+// planes through the origin, so locating a direction costs one choice of base face and
+// three plane tests per level. Directions exactly on an edge go to either side.
+class IcosphereAddressing {
+public:
+	static const uint32_t FaceCount = 20;
+	static const uint32_t MaxLevel = 27; // 5 bits of face and 2 per level fill 59 of the 64
+	enum Child : uint32_t {
+		Corner0 = 0,
+		Corner1 = 1,
+		Corner2 = 2,
+		Center = 3,
+	};
+
+	explicit IcosphereAddressing(uint32_t _level);
+
+	uint32_t getLevel() const {
+		return level;
+	}
+	static uint64_t triangleCount(uint32_t level) {
+		return uint64_t(FaceCount) << (2 * level);
+	}
+
+	static uint32_t face(TriangleId id, uint32_t level) {
+		return static_cast<uint32_t>(id >> (2 * level));
+	}
+	// the child taken on the way from depth - 1 to depth (1..level)
+	static Child child(TriangleId id, uint32_t level, uint32_t depth) {
+		return static_cast<Child>((id >> (2 * (level - depth))) & 3);
+	}
+
+	// direction need not be normalised; a zero (or NaN) direction lies in no triangle and
+	// comes back as face 0 followed by Center at every level, so callers must reject it
+	TriangleId locate(const glm::vec3& direction) const;
+	// four directions per SSE pass
+	void locate(const glm::vec3* directions, TriangleId* ids, size_t count) const;
+	void locate(const std::vector<glm::vec3>& directions, std::vector<TriangleId>& ids, ThreadPool& pool) const;
+
+	// position in Icosaedr::getIndexes() / 3: subdivision keeps the center child in the
+	// parent's slot and appends the corner children of triangle t at count + 3 t + corner
+	uint64_t triangleIndex(TriangleId id) const;
+	TriangleId idOf(uint64_t triangleIndex) const;
+	// corners on the unit sphere, in the order the index buffer lists them
+	std::array<glm::vec3, 3> corners(TriangleId id) const;
+
+private:
+	void locate4(const glm::vec3* directions, TriangleId* ids) const;
+
+	uint32_t level;
+	std::array<std::array<glm::vec3, 3>, FaceCount> baseCorners; // unit length
+	std::array<glm::vec3, FaceCount> faceAxis;   // unit direction of the centroid
+	std::array<float, FaceCount> faceWinding;    // +1 or -1, the sign of det(v0, v1, v2)
+};
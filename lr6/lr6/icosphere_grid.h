@@ -0,0 +1,179 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include <glm.hpp>
+
+#include "figure.h"
+
+// Closed-form layout of a subdivided icosahedron: every base face carries its own
+// triangular grid of (n + 1)(n + 2) / 2 vertices, n = 2^level, so any vertex or
+// triangle can be produced from its index alone (compute and vertex shaders use the
+// same mapping). Vertices on face borders are duplicated, one copy per face.
+//
+// A grid vertex is located by descending the same midpoint subdivision Icosaedr
+// performs, one level per step, so positions agree with Icosaedr up to rounding.
+class IcosphereGrid : public Mesh {
+public:
+	static const uint32_t FaceCount = 20;
+
+	explicit IcosphereGrid(uint32_t _level) : level(_level)
+	{
+		Icosaedr base;
+		corners.reserve(FaceCount * 3);
+		for (uint32_t i : base.getIndexes())
+			corners.push_back(base.getVertices()[i]);
+		radius = glm::length(base.getVertices()[0]);
+
+		const uint32_t n = side(level);
+		const uint32_t face_vertices = faceVertexCount(level);
+		vertex.reserve(FaceCount * face_vertices);
+		for (uint32_t face = 0; face < FaceCount; face++)
+			for (uint32_t row = 0; row <= n; row++)
+				for (uint32_t col = 0; col <= row; col++)
+				{
+					glm::vec3 p = gridPosition(&corners[face * 3], radius, level, row, col);
+					vertex.push_back(p);
+					normal.push_back(glm::normalize(p));
+				}
+
+		const uint32_t face_triangles = n * n;
+		index.resize(FaceCount * face_triangles * 3);
+		for (uint32_t face = 0; face < FaceCount; face++)
+		{
+			for (uint32_t t = 0; t < face_triangles; t++)
+				triangle(level, face, t, &index[(face * face_triangles + t) * 3]);
+			patches.push_back({ face * face_triangles * 3, face_triangles * 3 });
+		}
+
+		for (uint32_t i = 0; i < index.size(); i += 3)
+		{
+			glm::vec3 vect1 = vertex[index[i + 2]] - vertex[index[i]];
+			glm::vec3 vect2 = vertex[index[i + 1]] - vertex[index[i]];
+			normalFace.push_back(-glm::normalize(glm::cross(vect1, vect2)));
+		}
+	}
+
+	static uint32_t side(uint32_t level) {
+		return 1u << level;
+	}
+	static uint32_t faceVertexCount(uint32_t level) {
+		const uint32_t n = side(level);
+		return (n + 1) * (n + 2) / 2;
+	}
+	static uint32_t vertexCount(uint32_t level) {
+		return FaceCount * faceVertexCount(level);
+	}
+	static uint32_t indexCount(uint32_t level) {
+		return FaceCount * side(level) * side(level) * 3;
+	}
+
+	// row 0 is corner 0; along a row the point moves from the corner 0-1 edge to the
+	// corner 0-2 edge. In barycentric grid units: (n - row, row - col, col).
+	static glm::vec3 gridPosition(const glm::vec3* face, float radius, uint32_t level, uint32_t row, uint32_t col) {
+		glm::vec3 p0 = face[0], p1 = face[1], p2 = face[2];
+		uint32_t n = side(level);
+		uint32_t a = n - row, b = row - col, c = col;
+		auto toSphere = [radius](const glm::vec3& v) {
+			return v * (radius / glm::length(v));
+		};
+
+		while (n > 1)
+		{
+			if (a == n)
+				return p0;
+			if (b == n)
+				return p1;
+			if (c == n)
+				return p2;
+
+			const uint32_t h = n / 2;
+			const glm::vec3 m0 = toSphere((p0 + p1) / glm::vec3(2));
+			const glm::vec3 m1 = toSphere((p1 + p2) / glm::vec3(2));
+			const glm::vec3 m2 = toSphere((p2 + p0) / glm::vec3(2));
+			if (a >= h)
+			{
+				p1 = m0; p2 = m2; a -= h;
+			}
+			else if (b >= h)
+			{
+				p0 = m0; p2 = m1; b -= h;
+			}
+			else if (c >= h)
+			{
+				p0 = m2; p1 = m1; c -= h;
+			}
+			else
+			{
+				// centre child (m1, m2, m0)
+				const uint32_t na = h - a, nb = h - b, nc = h - c;
+				p0 = m1; p1 = m2; p2 = m0;
+				a = na; b = nb; c = nc;
+			}
+			n = h;
+		}
+		return a ? p0 : b ? p1 : p2;
+	}
+
+	// t in [0, n^2): row r holds 2r + 1 triangles, upright ones at even positions;
+	// winding follows the base face
+	static void triangle(uint32_t level, uint32_t face, uint32_t t, uint32_t* out) {
+		uint32_t row = 0;
+		while ((row + 1) * (row + 1) <= t)
+			row++;
+		const uint32_t k = t - row * row;
+		const uint32_t base = face * faceVertexCount(level);
+		auto at = [base](uint32_t r, uint32_t c) {
+			return base + r * (r + 1) / 2 + c;
+		};
+		if (k % 2 == 0)
+		{
+			const uint32_t col = k / 2;
+			out[0] = at(row, col);
+			out[1] = at(row + 1, col);
+			out[2] = at(row + 1, col + 1);
+		}
+		else
+		{
+			const uint32_t col = k / 2;
+			out[0] = at(row, col);
+			out[1] = at(row + 1, col + 1);
+			out[2] = at(row, col + 1);
+		}
+	}
+
+	const std::vector<glm::vec3>& getVertices() const override {
+		return vertex;
+	}
+	const std::vector<glm::vec3>& getNormals() const override {
+		return normal;
+	}
+	const std::vector<uint32_t>& getIndexes() const override {
+		return index;
+	}
+	const std::vector<glm::vec3>& getFaceNormals() const override {
+		return normalFace;
+	}
+	const std::vector<MeshPatch>& getPatches() const override {
+		return patches;
+	}
+
+	// base face corners, three per face in Icosaedr index order
+	const std::vector<glm::vec3>& getCorners() const {
+		return corners;
+	}
+	float getRadius() const {
+		return radius;
+	}
+
+private:
+	uint32_t level;
+	float radius;
+	std::vector<glm::vec3> corners;
+	std::vector<glm::vec3> vertex;
+	std::vector<glm::vec3> normal;
+	std::vector<uint32_t> index;
+	std::vector<glm::vec3> normalFace;
+	std::vector<MeshPatch> patches;
+};
@@ -0,0 +1,168 @@
+#include "icosphere_patches.h"
+
+#include <algorithm>
+
+PatchedIcosphere::PatchedIcosphere(uint32_t _maxLevel, uint32_t level) :
+	maxLevel(_maxLevel),
+	patchInfo(FaceCount),
+	faces(FaceCount)
+{
+	IcosphereGrid base(0);
+	corners = base.getCorners();
+	radius = base.getRadius();
+
+	for (uint32_t face = 0; face < FaceCount; face++)
+	{
+		IcospherePatch& info = patchInfo[face];
+		info.level = std::min(level, maxLevel);
+
+		// the same cap and cone GpuIcosphereGenerator gives its face patches
+		const glm::vec3* corner = &corners[face * 3];
+		glm::vec3 axis = glm::normalize(corner[0] + corner[1] + corner[2]);
+		float cos_angle = glm::dot(axis, glm::normalize(corner[0]));
+		info.cap.center = axis * radius * cos_angle;
+		info.cap.radius = radius * glm::max(glm::sqrt(1.0f - cos_angle * cos_angle), 1.0f - cos_angle);
+		info.cone.axis = axis;
+		info.cone.cutoff = glm::sqrt(1.0f - cos_angle * cos_angle);
+
+		// a shared edge runs the other way round in the neighbour
+		for (uint32_t edge = 0; edge < 3; edge++)
+		{
+			const glm::vec3& from = corner[edge];
+			const glm::vec3& to = corner[(edge + 1) % 3];
+			for (uint32_t other = 0; other < FaceCount; other++)
+				for (uint32_t other_edge = 0; other_edge < 3 && other != face; other_edge++)
+					if (corners[other * 3 + other_edge] == to && corners[other * 3 + (other_edge + 1) % 3] == from)
+					{
+						info.neighbours[edge] = other;
+						info.neighbourEdges[edge] = other_edge;
+					}
+		}
+	}
+
+	for (uint32_t face = 0; face < FaceCount; face++)
+		buildFace(face);
+	for (uint32_t face = 0; face < FaceCount; face++)
+		lastChanged.push_back(face);
+	gather();
+}
+
+bool PatchedIcosphere::setLevel(uint32_t patch, uint32_t level) {
+	level = std::min(level, maxLevel);
+	IcospherePatch& info = patchInfo[patch];
+	if (info.level == level)
+		return false;
+	info.level = level;
+
+	auto mark = [this](uint32_t p) {
+		if (std::find(changed.begin(), changed.end(), p) == changed.end())
+			changed.push_back(p);
+	};
+	mark(patch);
+	for (uint32_t edge = 0; edge < 3; edge++)
+		mark(info.neighbours[edge]);
+	return true;
+}
+
+void PatchedIcosphere::rebuild(ThreadPool& pool) {
+	lastChanged.swap(changed);
+	changed.clear();
+	if (lastChanged.empty())
+		return;
+	std::sort(lastChanged.begin(), lastChanged.end());
+
+	pool.parallelFor(lastChanged.size(), 1, [this](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+			buildFace(lastChanged[i]);
+	});
+	gather();
+}
+
+void PatchedIcosphere::buildFace(uint32_t patch) {
+	const IcospherePatch& info = patchInfo[patch];
+	Face& face = faces[patch];
+	const uint32_t level = info.level;
+	const uint32_t n = IcosphereGrid::side(level);
+
+	// neighbours only change the indexes; vertices are regenerated for a new level
+	if (face.builtLevel != level)
+	{
+		face.vertex.clear();
+		face.normal.clear();
+		for (uint32_t row = 0; row <= n; row++)
+			for (uint32_t col = 0; col <= row; col++)
+			{
+				glm::vec3 p = IcosphereGrid::gridPosition(&corners[patch * 3], radius, level, row, col);
+				face.vertex.push_back(p);
+				face.normal.push_back(glm::normalize(p));
+			}
+		face.builtLevel = level;
+	}
+
+	// spacing of the vertices each edge shares with its neighbour
+	uint32_t step[3];
+	for (uint32_t edge = 0; edge < 3; edge++)
+	{
+		const uint32_t other = patchInfo[info.neighbours[edge]].level;
+		step[edge] = other < level ? 1u << (level - other) : 1u;
+	}
+
+	// edge 0 is col = 0 (t = row), edge 1 is row = n (t = col), edge 2 is row = col (t = n - row)
+	auto at = [&](uint32_t row, uint32_t col) {
+		if (col == 0 && step[0] > 1)
+			row = row / step[0] * step[0];
+		else if (row == n && step[1] > 1)
+			col = col / step[1] * step[1];
+		else if (row == col && step[2] > 1)
+			row = col = n - (n - row) / step[2] * step[2];
+		return row * (row + 1) / 2 + col;
+	};
+
+	face.index.clear();
+	auto push = [&](uint32_t a, uint32_t b, uint32_t c) {
+		if (a == b || b == c || c == a)
+			return;
+		face.index.push_back(a);
+		face.index.push_back(b);
+		face.index.push_back(c);
+	};
+	// same triangle order and winding as IcosphereGrid::triangle
+	for (uint32_t row = 0; row < n; row++)
+		for (uint32_t k = 0; k <= 2 * row; k++)
+		{
+			const uint32_t col = k / 2;
+			if (k % 2 == 0)
+				push(at(row, col), at(row + 1, col), at(row + 1, col + 1));
+			else
+				push(at(row, col), at(row + 1, col + 1), at(row, col + 1));
+		}
+}
+
+void PatchedIcosphere::gather() {
+	vertex.clear();
+	normal.clear();
+	index.clear();
+	normalFace.clear();
+	patches.clear();
+	for (uint32_t patch = 0; patch < FaceCount; patch++)
+	{
+		const Face& face = faces[patch];
+		IcospherePatch& info = patchInfo[patch];
+		info.firstVertex = static_cast<uint32_t>(vertex.size());
+		info.vertexCount = static_cast<uint32_t>(face.vertex.size());
+		info.range = { static_cast<uint32_t>(index.size()), static_cast<uint32_t>(face.index.size()) };
+		patches.push_back(info.range);
+
+		vertex.insert(vertex.end(), face.vertex.begin(), face.vertex.end());
+		normal.insert(normal.end(), face.normal.begin(), face.normal.end());
+		for (uint32_t i : face.index)
+			index.push_back(info.firstVertex + i);
+	}
+
+	for (uint32_t i = 0; i < index.size(); i += 3)
+	{
+		glm::vec3 vect1 = vertex[index[i + 2]] - vertex[index[i]];
+		glm::vec3 vect2 = vertex[index[i + 1]] - vertex[index[i]];
+		normalFace.push_back(-glm::normalize(glm::cross(vect1, vect2)));
+	}
+}
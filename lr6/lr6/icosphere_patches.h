@@ -0,0 +1,114 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include <glm.hpp>
+
+#include "figure.h"
+#include "culling.h"
+#include "icosphere_grid.h"
+#include "thread_pool.h"
+
+struct IcospherePatch {
+	MeshPatch range;          // in getIndexes()
+	uint32_t firstVertex = 0; // in getVertices()
+	uint32_t vertexCount = 0;
+	uint32_t level = 0;
+	BoundingSphere cap;       // holds the patch at any level
+	NormalCone cone;
+	uint32_t neighbours[3];     // patch across edge k, from corner k to corner k + 1
+	uint32_t neighbourEdges[3]; // the same edge as numbered in that patch
+};
+
+// The 20 base faces of IcosphereGrid as independent patches, each at its own level.
+// A patch owns a contiguous vertex and index range and is generated on its own, so
+// patches are rebuilt in parallel and only the changed ones need re-uploading.
+//
+// Where a neighbour is coarser, the border row of the finer patch is a stitching
+// strip: edge vertices snap down to the nearest vertex the coarse edge also has,
+// which turns the row into fans onto the coarse edge and leaves no T-junction cracks.
+// Triangles that collapse in the process are dropped.
+class PatchedIcosphere : public Mesh {
+public:
+	static const uint32_t FaceCount = IcosphereGrid::FaceCount;
+
+	PatchedIcosphere(uint32_t _maxLevel, uint32_t level = 0);
+
+	// marks the patch and its neighbours (their stitching depends on it); false if unchanged
+	bool setLevel(uint32_t patch, uint32_t level);
+	bool dirty() const {
+		return !changed.empty();
+	}
+	// regenerates what setLevel invalidated, one patch per task
+	void rebuild(ThreadPool& pool);
+
+	const std::vector<IcospherePatch>& getPatchInfo() const {
+		return patchInfo;
+	}
+	// per patch data, indexes relative to the patch's first vertex
+	const std::vector<glm::vec3>& patchVertices(uint32_t patch) const {
+		return faces[patch].vertex;
+	}
+	const std::vector<glm::vec3>& patchNormals(uint32_t patch) const {
+		return faces[patch].normal;
+	}
+	const std::vector<uint32_t>& patchIndexes(uint32_t patch) const {
+		return faces[patch].index;
+	}
+	// patches whose data changed in the last rebuild
+	const std::vector<uint32_t>& changedPatches() const {
+		return lastChanged;
+	}
+	uint32_t getMaxLevel() const {
+		return maxLevel;
+	}
+	// room for one patch at maxLevel, so a patch can change level in place
+	static uint32_t slotVertices(uint32_t maxLevel) {
+		return IcosphereGrid::faceVertexCount(maxLevel);
+	}
+	static uint32_t slotIndexes(uint32_t maxLevel) {
+		return IcosphereGrid::side(maxLevel) * IcosphereGrid::side(maxLevel) * 3;
+	}
+
+	const std::vector<glm::vec3>& getVertices() const override {
+		return vertex;
+	}
+	const std::vector<glm::vec3>& getNormals() const override {
+		return normal;
+	}
+	const std::vector<uint32_t>& getIndexes() const override {
+		return index;
+	}
+	const std::vector<glm::vec3>& getFaceNormals() const override {
+		return normalFace;
+	}
+	const std::vector<MeshPatch>& getPatches() const override {
+		return patches;
+	}
+
+private:
+	struct Face {
+		std::vector<glm::vec3> vertex;
+		std::vector<glm::vec3> normal;
+		std::vector<uint32_t> index;
+		uint32_t builtLevel = UINT32_MAX; // level the vertices were generated at
+	};
+
+	void buildFace(uint32_t patch);
+	void gather();
+
+	uint32_t maxLevel;
+	float radius;
+	std::vector<glm::vec3> corners;
+	std::vector<IcospherePatch> patchInfo;
+	std::vector<Face> faces;
+	std::vector<uint32_t> changed;
+	std::vector<uint32_t> lastChanged;
+
+	std::vector<glm::vec3> vertex;
+	std::vector<glm::vec3> normal;
+	std::vector<uint32_t> index;
+	std::vector<glm::vec3> normalFace;
+	std::vector<MeshPatch> patches;
+};
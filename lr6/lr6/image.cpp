@@ -0,0 +1,47 @@
+#include "image.h"
+
+#include <windows.h>
+#include <wincodec.h>
+#include <wrl/client.h>
+
+#include <exception>
+
+#pragma comment(lib, "windowscodecs.lib")
+
+using Microsoft::WRL::ComPtr;
+
+Image ImageDecoder::decode(const std::string& path) {
+	// RPC_E_CHANGED_MODE: the thread already runs COM in another mode, which is fine for WIC
+	const HRESULT com = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+	struct ComScope {
+		bool owned;
+		~ComScope() {
+			if (owned)
+				CoUninitialize();
+		}
+	} scope{ SUCCEEDED(com) };
+
+	std::wstring wide_path(MultiByteToWideChar(CP_ACP, 0, path.c_str(), -1, NULL, 0), L'\0');
+	MultiByteToWideChar(CP_ACP, 0, path.c_str(), -1, &wide_path[0], static_cast<int>(wide_path.size()));
+
+	ComPtr<IWICImagingFactory> factory;
+	ComPtr<IWICBitmapDecoder> decoder;
+	ComPtr<IWICBitmapFrameDecode> frame;
+	ComPtr<IWICFormatConverter> converter;
+	if (FAILED(CoCreateInstance(CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&factory))))
+		throw std::exception("ImageDecoder: WIC is not available");
+	if (FAILED(factory->CreateDecoderFromFilename(wide_path.c_str(), NULL, GENERIC_READ, WICDecodeMetadataCacheOnDemand, &decoder))
+		|| FAILED(decoder->GetFrame(0, &frame)))
+		throw std::exception(("ImageDecoder: cannot open " + path).c_str());
+
+	Image image;
+	if (FAILED(factory->CreateFormatConverter(&converter))
+		|| FAILED(converter->Initialize(frame.Get(), GUID_WICPixelFormat32bppRGBA, WICBitmapDitherTypeNone, NULL, 0.0, WICBitmapPaletteTypeCustom))
+		|| FAILED(converter->GetSize(&image.width, &image.height)))
+		throw std::exception(("ImageDecoder: cannot convert " + path).c_str());
+
+	image.pixels.resize(size_t(image.width) * image.height * 4);
+	if (FAILED(converter->CopyPixels(NULL, image.width * 4, static_cast<UINT>(image.pixels.size()), image.pixels.data())))
+		throw std::exception(("ImageDecoder: cannot decode " + path).c_str());
+	return image;
+}
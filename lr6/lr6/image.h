@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// 8-bit RGBA pixels, rows from the top of the image
+struct Image {
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<uint8_t> pixels;
+};
+
+// Decodes JPEG, PNG, BMP and the other formats the Windows Imaging Component knows.
+// Safe on any thread: COM is initialised for the calling thread if it is not yet.
+class ImageDecoder {
+public:
+	static Image decode(const std::string& path);
+};
@@ -0,0 +1,191 @@
+#include "light_clusters.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <immintrin.h>
+
+namespace {
+	inline __m128 select(__m128 mask, __m128 a, __m128 b) {
+		return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+	}
+	inline int32_t clampCell(float cell, uint32_t count) {
+		return static_cast<int32_t>(std::min(std::max(std::floor(cell), 0.0f), float(count - 1)));
+	}
+}
+
+void LightClusters::build(const std::vector<PointLight>& lights, const Projection& projection, ThreadPool& pool) {
+	depthScale = CountZ / glm::log(projection.farPlane / projection.nearPlane);
+	depthBias = -glm::log(projection.nearPlane) * depthScale;
+
+	gpuLights.resize(lights.size() * 2);
+	for (size_t i = 0; i < lights.size(); i++)
+	{
+		gpuLights[2 * i] = glm::vec4(lights[i].position, lights[i].radius);
+		gpuLights[2 * i + 1] = glm::vec4(lights[i].color, 1.0f);
+	}
+
+	lightRanges.resize(lights.size());
+	pool.parallelFor(lights.size(), 64, [&](size_t begin, size_t end) {
+		computeRanges(lights, projection, begin, end);
+	});
+
+	sliceIndexes.resize(CountZ);
+	ranges.resize(ClusterCount);
+	pool.parallelFor(CountZ, 1, [&](size_t begin, size_t end) {
+		for (size_t z = begin; z < end; z++)
+			fillSlice(static_cast<uint32_t>(z));
+	});
+
+	// slices are stitched in order, so their offsets only need the slice base added
+	lightIndexes.clear();
+	for (uint32_t z = 0; z < CountZ; z++)
+	{
+		const uint32_t base = static_cast<uint32_t>(lightIndexes.size());
+		for (uint32_t c = 0; c < CountX * CountY; c++)
+			ranges[z * CountX * CountY + c].x += base;
+		lightIndexes.insert(lightIndexes.end(), sliceIndexes[z].begin(), sliceIndexes[z].end());
+	}
+}
+
+// Screen extent of a view-space sphere, four lights at a time. For a fixed sign of x,
+// x / depth is monotonic in depth, so the extreme of (x +- r) / depth over the
+// sphere's depth interval is at its near or far end; picking the right end per lane
+// gives a conservative tile range without any per-light branching.
+void LightClusters::computeRanges(const std::vector<PointLight>& lights, const Projection& projection, size_t begin, size_t end) {
+	const float tan_y = glm::tan(projection.fovY / 2.0f);
+	const __m128 near_plane = _mm_set1_ps(projection.nearPlane);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 scale_x = _mm_set1_ps(0.5f / (tan_y * projection.aspect));
+	const __m128 scale_y = _mm_set1_ps(0.5f / tan_y);
+
+	for (size_t i = begin; i < end; i += 4)
+	{
+		const size_t lanes = std::min<size_t>(4, end - i);
+		alignas(16) float px[4] = {}, py[4] = {}, pz[4] = {}, pr[4] = {};
+		for (size_t j = 0; j < lanes; j++)
+		{
+			px[j] = lights[i + j].position.x;
+			py[j] = lights[i + j].position.y;
+			pz[j] = lights[i + j].position.z;
+			pr[j] = lights[i + j].radius;
+		}
+		const __m128 x = _mm_load_ps(px);
+		const __m128 y = _mm_load_ps(py);
+		const __m128 r = _mm_load_ps(pr);
+		const __m128 depth = _mm_sub_ps(zero, _mm_load_ps(pz));
+		const __m128 d_near = _mm_max_ps(_mm_sub_ps(depth, r), near_plane);
+		const __m128 d_far = _mm_max_ps(_mm_add_ps(depth, r), near_plane);
+
+		// (ndc * 0.5 + 0.5) of the four sphere edges
+		auto edge = [&](__m128 coord, bool upper, __m128 scale) {
+			__m128 value = upper ? _mm_add_ps(coord, r) : _mm_sub_ps(coord, r);
+			__m128 toward_near = upper ? _mm_cmpgt_ps(value, zero) : _mm_cmplt_ps(value, zero);
+			__m128 divisor = select(toward_near, d_near, d_far);
+			return _mm_add_ps(_mm_mul_ps(_mm_div_ps(value, divisor), scale), half);
+		};
+		alignas(16) float x0[4], x1[4], y0[4], y1[4];
+		_mm_store_ps(x0, edge(x, false, scale_x));
+		_mm_store_ps(x1, edge(x, true, scale_x));
+		_mm_store_ps(y0, edge(y, false, scale_y));
+		_mm_store_ps(y1, edge(y, true, scale_y));
+
+		for (size_t j = 0; j < lanes; j++)
+		{
+			const float light_depth = -pz[j];
+			LightRange& range = lightRanges[i + j];
+			if (light_depth + pr[j] <= projection.nearPlane || light_depth - pr[j] >= projection.farPlane
+				|| x1[j] < 0.0f || x0[j] > 1.0f || y1[j] < 0.0f || y0[j] > 1.0f)
+			{
+				range = { 1, 0, 1, 0, 1, 0 };
+				continue;
+			}
+			range.x0 = clampCell(x0[j] * CountX, CountX);
+			range.x1 = clampCell(x1[j] * CountX, CountX);
+			range.y0 = clampCell(y0[j] * CountY, CountY);
+			range.y1 = clampCell(y1[j] * CountY, CountY);
+			range.z0 = clampCell(sliceOf(std::max(light_depth - pr[j], projection.nearPlane)), CountZ);
+			range.z1 = clampCell(sliceOf(std::min(light_depth + pr[j], projection.farPlane)), CountZ);
+		}
+	}
+}
+
+void LightClusters::fillSlice(uint32_t z) {
+	const uint32_t slice_clusters = CountX * CountY;
+	glm::uvec2* slice_ranges = &ranges[z * slice_clusters];
+	for (uint32_t c = 0; c < slice_clusters; c++)
+		slice_ranges[c] = glm::uvec2(0, 0);
+
+	auto touches = [z](const LightRange& range) {
+		return range.x0 <= range.x1 && int32_t(z) >= range.z0 && int32_t(z) <= range.z1;
+	};
+
+	// count, prefix sum, fill: the slice's list comes out grouped by cluster
+	for (const auto& range : lightRanges)
+		if (touches(range))
+			for (int32_t y = range.y0; y <= range.y1; y++)
+				for (int32_t x = range.x0; x <= range.x1; x++)
+					slice_ranges[y * CountX + x].y++;
+
+	uint32_t total = 0;
+	for (uint32_t c = 0; c < slice_clusters; c++)
+	{
+		slice_ranges[c].x = total;
+		total += slice_ranges[c].y;
+	}
+
+	std::vector<uint32_t>& indexes = sliceIndexes[z];
+	indexes.resize(total);
+	std::vector<uint32_t> cursor(slice_clusters);
+	for (uint32_t c = 0; c < slice_clusters; c++)
+		cursor[c] = slice_ranges[c].x;
+	for (uint32_t light = 0; light < lightRanges.size(); light++)
+	{
+		const LightRange& range = lightRanges[light];
+		if (touches(range))
+			for (int32_t y = range.y0; y <= range.y1; y++)
+				for (int32_t x = range.x0; x <= range.x1; x++)
+					indexes[cursor[y * CountX + x]++] = light;
+	}
+}
+
+void LightClusters::upload() {
+	if (!lightsBuffer)
+	{
+		glGenBuffers(1, &lightsBuffer);
+		glGenBuffers(1, &gridBuffer);
+		glGenBuffers(1, &indexesBuffer);
+	}
+	// an SSBO may not be empty, so empty lists still upload one element
+	auto store = [](uint32_t buffer, const void* data, size_t size, size_t element) {
+		static const uint8_t padding[32] = {};
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, size ? size : element, size ? data : padding, GL_STREAM_DRAW);
+	};
+	store(lightsBuffer, gpuLights.data(), gpuLights.size() * sizeof(glm::vec4), 2 * sizeof(glm::vec4));
+	store(gridBuffer, ranges.data(), ranges.size() * sizeof(glm::uvec2), sizeof(glm::uvec2));
+	store(indexesBuffer, lightIndexes.data(), lightIndexes.size() * sizeof(uint32_t), sizeof(uint32_t));
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void LightClusters::bind() const {
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LightsBinding, lightsBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, GridBinding, gridBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, IndexesBinding, indexesBuffer);
+}
+
+void LightClusters::setUniforms(uint32_t program, float viewportWidth, float viewportHeight) const {
+	glUniform3ui(glGetUniformLocation(program, "clusterCount"), CountX, CountY, CountZ);
+	glUniform2f(glGetUniformLocation(program, "clusterTileSize"), viewportWidth / CountX, viewportHeight / CountY);
+	glUniform2f(glGetUniformLocation(program, "clusterDepth"), depthScale, depthBias);
+}
+
+void LightClusters::release() {
+	if (!lightsBuffer)
+		return;
+	glDeleteBuffers(1, &lightsBuffer);
+	glDeleteBuffers(1, &gridBuffer);
+	glDeleteBuffers(1, &indexesBuffer);
+	lightsBuffer = gridBuffer = indexesBuffer = 0;
+}
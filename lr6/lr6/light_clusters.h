@@ -0,0 +1,80 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <vector>
+#include <cstdint>
+
+#include <glm.hpp>
+
+#include "frame_state.h"
+#include "thread_pool.h"
+
+// Clustered forward shading: the view frustum is cut into CountX x CountY screen tiles
+// and CountZ exponentially spaced depth slices, and every cluster gets the list of
+// lights whose sphere of influence touches it. The fragment shader reads its cluster
+// from three SSBOs (lights, per-cluster offset/count, light indexes), so the shading
+// cost follows the local light density instead of the total light count.
+class LightClusters {
+public:
+	static const uint32_t CountX = 16;
+	static const uint32_t CountY = 9;
+	static const uint32_t CountZ = 24;
+	static const uint32_t ClusterCount = CountX * CountY * CountZ;
+
+	// SSBO bindings used by the fragment shader
+	static const uint32_t LightsBinding = 0;
+	static const uint32_t GridBinding = 1;
+	static const uint32_t IndexesBinding = 2;
+
+	struct Projection {
+		float fovY;
+		float aspect;
+		float nearPlane;
+		float farPlane;
+	};
+
+	// CPU; light positions are in view space
+	void build(const std::vector<PointLight>& lights, const Projection& projection, ThreadPool& pool);
+
+	// GL thread, after build
+	void upload();
+	void bind() const;
+	void setUniforms(uint32_t program, float viewportWidth, float viewportHeight) const;
+	void release();
+
+	const std::vector<uint32_t>& indexes() const {
+		return lightIndexes;
+	}
+	// offset into indexes() and light count of one cluster
+	const glm::uvec2& cluster(uint32_t x, uint32_t y, uint32_t z) const {
+		return ranges[(z * CountY + y) * CountX + x];
+	}
+
+	// depth slice of a view-space distance in front of the camera; the shader uses the same formula
+	float sliceOf(float depth) const {
+		return glm::log(depth) * depthScale + depthBias;
+	}
+
+private:
+	// inclusive cluster range touched by one light; empty if x0 > x1
+	struct LightRange {
+		int32_t x0, x1, y0, y1, z0, z1;
+	};
+
+	void computeRanges(const std::vector<PointLight>& lights, const Projection& projection, size_t begin, size_t end);
+	void fillSlice(uint32_t z);
+
+	float depthScale = 0.0f;
+	float depthBias = 0.0f;
+
+	std::vector<glm::vec4> gpuLights; // xyz position, w radius; then rgb colour
+	std::vector<LightRange> lightRanges;
+	std::vector<std::vector<uint32_t>> sliceIndexes;
+	std::vector<glm::uvec2> ranges;
+	std::vector<uint32_t> lightIndexes;
+
+	uint32_t lightsBuffer = 0;
+	uint32_t gridBuffer = 0;
+	uint32_t indexesBuffer = 0;
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include <glm.hpp>
+
+#include "figure.h"
+#include "mesh_optimizer.h"
+
+// Pre-generated Icosaedr levels 0..maxLevel, each level one more subdivision pass,
+// stored with their triangles reordered for the vertex cache.
+class IcosphereLodChain {
+public:
+	explicit IcosphereLodChain(uint32_t maxLevel)
+	{
+		Icosaedr current;
+		for (uint32_t level = 0; level <= maxLevel; level++)
+		{
+			if (level > 0)
+				current.increaseApproximation(1);
+			levels.push_back(std::make_shared<CacheOptimizedMesh>(current));
+			edgeLengths.push_back(averageEdgeLength(current));
+		}
+	}
+
+	size_t levelCount() const {
+		return levels.size();
+	}
+	const std::shared_ptr<CacheOptimizedMesh>& level(uint32_t lvl) const {
+		return levels[lvl];
+	}
+	float edgeLength(uint32_t lvl) const {
+		return edgeLengths[lvl];
+	}
+
+	static float averageEdgeLength(const Mesh& msh) {
+		const auto& vertices = msh.getVertices();
+		const auto& indexes = msh.getIndexes();
+		double sum = 0.0;
+		for (uint32_t i = 0; i < indexes.size(); i++)
+		{
+			uint32_t next = i - i % 3 + (i + 1) % 3;
+			sum += glm::distance(vertices[indexes[i]], vertices[indexes[next]]);
+		}
+		return indexes.empty() ? 0.0f : static_cast<float>(sum / indexes.size());
+	}
+
+private:
+	std::vector<std::shared_ptr<CacheOptimizedMesh>> levels;
+	std::vector<float> edgeLengths;
+};
+
+// Picks the coarsest level whose triangle edges stay under targetEdgePixels on screen.
+// A level is only left once the edge length leaves a band of +-hysteresis around the
+// target, so an object sitting at a switching distance does not pop every frame.
+class LodSelector {
+public:
+	float targetEdgePixels = 12.0f;
+	float hysteresis = 0.25f;
+
+	// pixelsPerUnit: screen pixels covered by one world unit at the object's distance
+	template<typename EdgeLengthFn>
+	uint32_t select(uint32_t current, uint32_t levelCount, float pixelsPerUnit, EdgeLengthFn edgeLength) const {
+		uint32_t level = glm::min(current, levelCount - 1);
+		const float upper = targetEdgePixels * (1.0f + hysteresis);
+		const float lower = targetEdgePixels * (1.0f - hysteresis);
+
+		while (level + 1 < levelCount && edgeLength(level) * pixelsPerUnit > upper)
+			level++;
+		while (level > 0 && edgeLength(level - 1) * pixelsPerUnit < lower)
+			level--;
+		return level;
+	}
+
+	// vertical pixels per world unit for a perspective camera at the given distance
+	static float pixelsPerUnit(float distance, float fovY, float viewportHeight) {
+		return viewportHeight / (2.0f * glm::tan(fovY / 2.0f) * glm::max(distance, 1e-4f));
+	}
+};
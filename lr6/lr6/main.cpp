@@ -1,22 +1,379 @@
 #include <iostream>
+#include <thread>
+#include <random>
+#include <string>
+#include <chrono>
+#include <cfloat>
 
 
 #include "figure.h"
+#include "mesh_optimizer.h"
+#include "terrain.h"
+#include "textured_sphere.h"
+#include "path_tracer.h"
+#include "icosphere_address.h"
+#include "adaptive_icosphere.h"
 #include "renderer.h"
 
-int main() {
+// ACMR/ATVR and vertex overfetch of every CPU level, in subdivision order and after the reorder
+void reportVertexCache(size_t maxLevel) {
+	Icosaedr sphere;
+	for (size_t level = 0; level <= maxLevel; level++)
+	{
+		if (level > 0)
+			sphere.increaseApproximation(1);
+		CacheOptimizedMesh optimized(sphere, VertexOrder::FirstUse, true);
+		std::cout << "level " << level << ": ACMR " << optimized.statsBefore().acmr << " -> " << optimized.statsAfter().acmr
+			<< ", ATVR " << optimized.statsBefore().atvr << " -> " << optimized.statsAfter().atvr
+			<< ", overfetch " << optimized.fetchStatsBefore().overfetch << " -> " << optimized.fetchStatsAfter().overfetch << std::endl;
+	}
+}
+
+// displaced and textured copies of the CPU levels as OBJ, with their UVs; the heightmap is decoded once
+void bakeDisplaced(const std::string& heightmapPath, size_t maxLevel) {
+	ThreadPool pool;
+	Icosaedr sphere;
+	for (size_t level = 0; level <= maxLevel; level++)
+	{
+		if (level > 0)
+			sphere.increaseApproximation(1);
+		TexturedSphere textured(sphere);
+		textured.displace(*Heightmap::load(heightmapPath), 0.05f, pool);
+		MeshExporter::toObj(textured, "displaced_" + std::to_string(level), &textured.getUVs());
+	}
+}
+
+// the demo: the streamed front sphere, a receding row and a few hundred small lights around
+// the original one; the renderer and the path tracer are given the same state
+SceneState demoScene(uint32_t width, uint32_t height) {
+	SceneState state;
+	state.viewMatrix = glm::lookAt(glm::vec3(0.f, 0.f, -5.f), glm::vec3(0.f, 0.f, 0.f), glm::vec3(0.f, 1.f, 0.f));
+	state.projectionMatrix = glm::perspective(glm::radians(45.0f), static_cast<float>(width) / height, 2.0f, 50.0f);
+	state.lights.push_back({ glm::vec3(10.f, 0.f, 10.f), glm::vec3(1.0f) });
+
+	// the front sphere keeps refining on a worker thread while the window runs
+	SceneObject front;
+	front.dynamic = true;
+	state.objects.push_back(front);
+	// receding row: the farther spheres drop to coarser levels
+	for (int i = 1; i < 6; i++)
+	{
+		SceneObject object;
+		object.modelMatrix = glm::translate(glm::vec3(-1.5f * i, 0.0f, 4.0f * i));
+		// every other sphere is a matte recoloured one, drawn by a different shader variant
+		if (i % 2 == 0)
+		{
+			object.specular = false;
+			object.customColor = true;
+			object.color = glm::vec3(0.3f, 0.6f, 1.0f);
+		}
+		state.objects.push_back(object);
+	}
+
+	// the coloured lights between the spheres take the clustered path
+	std::mt19937 random(7);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	for (int i = 0; i < 256; i++)
+	{
+		glm::vec3 position(unit(random) * 20.0f - 10.0f, unit(random) * 8.0f - 4.0f, -2.0f - unit(random) * 28.0f);
+		glm::vec3 color(unit(random), unit(random), unit(random));
+		state.lights.push_back({ position, 0.5f * color, 3.0f });
+	}
+	return state;
+}
+
+// CPU reference of the demo scene, every sphere at the given level, refined pass by pass;
+// written after every pass so an interrupted run still leaves the latest image
+void traceReference(const SceneState& state, uint32_t passes, size_t level) {
+	ThreadPool pool;
+	Icosaedr sphere;
+	sphere.increaseApproximation(level);
+	TraceSettings settings;
+	PathTracer tracer(sphere, pool, settings);
+	tracer.setScene(state);
+
+	for (uint32_t pass = 0; pass < passes; pass++)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		tracer.refine();
+		const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		std::cout << "pass " << tracer.sampleCount() << ": " << ms << " ms" << std::endl;
+		tracer.writePpm("reference.ppm");
+		tracer.writePfm("reference.pfm");
+	}
+}
+
+// IcosphereAddressing::locate against a scan of every triangle of Icosaedr, then the
+// throughput of the SSE batch lookup on one thread and on the pool
+void checkAddressing(size_t level, size_t samples, size_t batch) {
+	ThreadPool pool;
+	Icosaedr sphere;
+	sphere.increaseApproximation(level);
+	IcosphereAddressing addressing(static_cast<uint32_t>(level));
+	const auto& vertices = sphere.getVertices();
+	const auto& indexes = sphere.getIndexes();
+
+	std::mt19937 random(11);
+	std::normal_distribution<float> normal(0.0f, 1.0f);
+	auto directions = [&](size_t count) {
+		std::vector<glm::vec3> result(count);
+		for (auto& d : result)
+			do
+				d = glm::vec3(normal(random), normal(random), normal(random));
+			while (glm::dot(d, d) < 1e-12f);
+		return result;
+	};
+
+	// the smallest signed distance of d to the triangle's three bounding planes, in radians:
+	// positive inside, around zero on an edge
+	auto margin = [&](size_t triangle, const glm::vec3& d) {
+		const glm::vec3 v[3] = { vertices[indexes[triangle * 3]], vertices[indexes[triangle * 3 + 1]], vertices[indexes[triangle * 3 + 2]] };
+		const float winding = glm::dot(v[0], glm::cross(v[1], v[2])) > 0.0f ? 1.0f : -1.0f;
+		float result = FLT_MAX;
+		for (int j = 0; j < 3; j++)
+			result = glm::min(result, winding * glm::dot(glm::normalize(d), glm::normalize(glm::cross(v[j], v[(j + 1) % 3]))));
+		return result;
+	};
+
+	const std::vector<glm::vec3> checked = directions(samples);
+	std::vector<TriangleId> ids;
+	addressing.locate(checked, ids, pool);
+	std::vector<uint32_t> wrong(samples, 0), ties(samples, 0);
+	const size_t triangles = indexes.size() / 3;
+	pool.parallelFor(samples, 64, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			size_t best = 0;
+			float best_margin = -FLT_MAX;
+			for (size_t t = 0; t < triangles; t++)
+			{
+				const float m = margin(t, checked[i]);
+				if (m > best_margin)
+				{
+					best_margin = m;
+					best = t;
+				}
+			}
+			const uint64_t found = addressing.triangleIndex(ids[i]);
+			// a direction on an edge belongs to both sides
+			if (found != best)
+				(margin(found, checked[i]) > -1e-5f ? ties[i] : wrong[i]) = 1;
+		}
+	});
+	size_t wrong_count = 0, tie_count = 0;
+	for (size_t i = 0; i < samples; i++)
+	{
+		wrong_count += wrong[i];
+		tie_count += ties[i];
+	}
+	std::cout << "level " << level << ": " << samples << " directions against " << triangles << " triangles, "
+		<< wrong_count << " wrong, " << tie_count << " on an edge" << (wrong_count == 0 ? " [OK]" : " [MISMATCH]") << std::endl;
+
+	const std::vector<glm::vec3> timed = directions(batch);
+	ids.resize(batch);
+	auto start = std::chrono::steady_clock::now();
+	addressing.locate(timed.data(), ids.data(), timed.size());
+	const double serial_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	start = std::chrono::steady_clock::now();
+	addressing.locate(timed, ids, pool);
+	const double pooled_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	std::cout << batch << " lookups: " << serial_ms << " ms on one thread, " << pooled_ms << " ms on "
+		<< pool.size() + 1 << " threads (" << batch / pooled_ms / 1000.0 << " M/s)" << std::endl;
+}
+
+// an adaptive sphere under a wandering camera, displaced patch by patch as the renderer
+// does with --planet and mirrored the way AdaptiveUploader sends it, against a
+// DisplacedSphere rebuilt from scratch after every update
+void checkTerrain(uint32_t maxLevel, size_t steps) {
+	ThreadPool pool;
+	AdaptiveIcosphere sphere(maxLevel);
+	DisplacedSphere terrain;
+	std::vector<glm::vec3> vertices, normals;
+	std::vector<uint32_t> indexes;
+
+	std::mt19937 random(5);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	glm::vec3 camera(0.0f, 0.0f, -3.0f);
+	float position_error = 0.0f, normal_error = 0.0f;
+	size_t updates = 0, wrong_indexes = 0;
+	double incremental_ms = 0.0, full_ms = 0.0;
+	for (size_t step = 0; step <= steps; step++)
+	{
+		// a jump now and then, small steps around it otherwise
+		if (step % 100 == 0)
+			camera = glm::normalize(glm::vec3(unit(random), unit(random), unit(random))) * (3.2f + 2.0f * unit(random));
+		else
+		{
+			camera += glm::vec3(unit(random), unit(random), unit(random)) * 0.03f;
+			if (glm::length(camera) < 1.3f)
+				camera = glm::normalize(camera) * 1.3f;
+		}
+		AdaptiveIcosphere::View view;
+		view.camera = camera;
+		view.pixelsPerUnit = 1400.0f;
+		view.thresholdPixels = 0.5f;
+		if (!sphere.update(view) && step > 0)
+			continue;
+		updates++;
+
+		auto start = std::chrono::steady_clock::now();
+		terrain.update(sphere, pool, sphere.changedVertices(), sphere.changedFaces());
+		incremental_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		if (step == 0 || sphere.layoutChanged() || terrain.rebuilt())
+		{
+			vertices = terrain.getVertices();
+			normals = terrain.getNormals();
+			indexes = terrain.getIndexes();
+		}
+		else
+		{
+			vertices.resize(terrain.getVertices().size());
+			normals.resize(vertices.size());
+			for (uint32_t v : terrain.changedVertices())
+			{
+				vertices[v] = terrain.getVertices()[v];
+				normals[v] = terrain.getNormals()[v];
+			}
+			for (uint32_t face : sphere.changedFaces())
+			{
+				const MeshPatch& slot = terrain.getPatches()[face];
+				std::copy(terrain.getIndexes().begin() + slot.firstIndex, terrain.getIndexes().begin() + slot.firstIndex + slot.countIndexes, indexes.begin() + slot.firstIndex);
+			}
+		}
+
+		start = std::chrono::steady_clock::now();
+		DisplacedSphere full;
+		full.update(sphere, pool, 0, sphere.getVertices().size());
+		full_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		// only what the used slot ranges reference is drawn
+		for (const MeshPatch& slot : full.getPatches())
+			for (uint32_t i = slot.firstIndex; i < slot.firstIndex + slot.countIndexes; i++)
+			{
+				const uint32_t v = full.getIndexes()[i];
+				if (indexes[i] != v)
+				{
+					wrong_indexes++;
+					continue;
+				}
+				position_error = glm::max(position_error, glm::length(vertices[v] - full.getVertices()[v]));
+				normal_error = glm::max(normal_error, glm::length(normals[v] - full.getNormals()[v]));
+			}
+	}
+	const bool same = wrong_indexes == 0 && position_error == 0.0f && normal_error < 1e-4f;
+	std::cout << updates << " updates, " << sphere.getIndexes().size() / 3 << " triangles at the end: " << wrong_indexes << " wrong indexes, max position error "
+		<< position_error << ", max normal error " << normal_error << (same ? " [OK]" : " [MISMATCH]") << std::endl;
+	std::cout << "patch by patch " << incremental_ms << " ms, from scratch " << full_ms << " ms" << std::endl;
+}
+
+int main(int argc, char** argv) {
 
-	std::shared_ptr<Icosaedr> model = std::make_shared<Icosaedr>();
-	
 	size_t approximation = 4;
 	//std::cin >> approximation;
-	model->increaseApproximation(approximation);
-	//MeshExporter::toStl(test, "test");
+	//MeshExporter::toStl(*IcosphereLodChain(approximation).level(approximation), "test");
 
 	try {
-		Renderer scene(800, 600, model);
+		const uint32_t width = 800, height = 600;
+		SceneState demo = demoScene(width, height);
+
+		// the CPU-only tools need no window or GL context: they run before the renderer
+		// exists and the program ends after them
+		bool offline = false;
+		for (int i = 1; i < argc; i++)
+		{
+			std::string arg = argv[i];
+			if (arg == "--vertex-cache-report")
+			{
+				reportVertexCache(approximation);
+				offline = true;
+			}
+			else if (arg == "--check-addressing")
+			{
+				checkAddressing(approximation, 20000, size_t(1) << 22);
+				offline = true;
+			}
+			else if (arg == "--check-terrain")
+			{
+				checkTerrain(12, 400);
+				offline = true;
+			}
+			else if (arg == "--bake-displaced")
+			{
+				// an optional image path may follow
+				std::string path = "../../lr4/bump.jpg";
+				if (i + 1 < argc && std::string(argv[i + 1]).rfind("--", 0) != 0)
+					path = argv[++i];
+				bakeDisplaced(path, approximation + 2);
+				offline = true;
+			}
+			else if (arg == "--trace")
+			{
+				// an optional pass count may follow
+				uint32_t passes = 16;
+				if (i + 1 < argc && std::string(argv[i + 1]).rfind("--", 0) != 0)
+					passes = static_cast<uint32_t>(std::stoul(argv[++i]));
+				traceReference(demo, passes, approximation + 2);
+				offline = true;
+			}
+		}
+		if (offline)
+			return 0;
+
+		// the window opens on the base icosahedron; finer levels stream in behind it
+		Renderer scene(width, height, static_cast<uint32_t>(approximation));
+		bool planet = false;
+		for (int i = 1; i < argc; i++)
+		{
+			std::string arg = argv[i];
+			if (arg == "--validate-gpu-mesh")
+				scene.validateGpuMeshes = true;
+			else if (arg == "--cpu-mesh")
+				scene.gpuGeneration = false;
+			else if (arg == "--planet")
+				planet = scene.adaptiveTerrain = true;
+		}
+		scene.profiler.setOutput("frame_times.csv", 600);
+		// the texture is the renderer's alone; the tracer shades the sphere untextured
+		demo.objects[1].texture = scene.loadTexture("../../lr4/seamless.jpg");
+		scene.setScene(demo);
+
+		// the light circles the scene; animated on the update thread, not in the draw loop
+		scene.onUpdate = [](SceneState& state, float dt) {
+			state.lights[0].position = glm::vec3(glm::rotate(dt * glm::radians(20.0f), glm::vec3(0.0f, 1.0f, 0.0f)) * glm::vec4(state.lights[0].position, 1.0f));
+		};
+
+		// with --planet every level of the front sphere is displaced by noise, only on its new
+		// vertices, and so are the F7 adaptive spheres, patch by patch
+		const size_t dynamic_level = approximation + 2;
+		const size_t max_vertices = 2 * (10 * (size_t(1) << (2 * dynamic_level)) + 2);
+		const size_t max_indexes = 60 * (size_t(1) << (2 * dynamic_level));
+		auto dynamic = scene.createDynamicMesh(max_vertices, max_indexes);
+
+		std::thread tessellator([&]() {
+			Icosaedr sphere;
+			DisplacedSphere terrain;
+			ThreadPool pool(planet ? ThreadPool::defaultThreadCount() : 0);
+			for (size_t level = 0; level <= dynamic_level; level++)
+			{
+				if (level > 0)
+					sphere.increaseApproximation(1);
+				if (planet)
+					terrain.update(sphere, pool);
+				if (!dynamic->write(planet ? static_cast<const Mesh&>(terrain) : sphere))
+					break;
+			}
+		});
 
-		scene.run();
+		try {
+			scene.run();
+		}
+		catch (...) {
+			dynamic->close();
+			tessellator.join();
+			throw;
+		}
+		dynamic->close();
+		tessellator.join();
 	}
 	catch (std::exception ex) {
 		std::cout << "\t\t[EXCEPTION] " << ex.what() << std::endl;
@@ -0,0 +1,137 @@
+#include "mesh_arena.h"
+
+#include <algorithm>
+#include <vector>
+
+void MeshArena::init() {
+	glGenVertexArrays(1, &VAO);
+	glGenBuffers(1, &VBO);
+	glGenBuffers(1, &EBO);
+	glGenBuffers(1, &drawIndexBuffer);
+	grow(VBO, vertexCapacity, 0, 1 << 20);
+	grow(EBO, indexCapacity, 0, 1 << 20);
+	reserveDraws(256);
+}
+
+void MeshArena::release() {
+	glDeleteVertexArrays(1, &VAO);
+	glDeleteBuffers(1, &VBO);
+	glDeleteBuffers(1, &EBO);
+	glDeleteBuffers(1, &drawIndexBuffer);
+	VAO = VBO = EBO = drawIndexBuffer = 0;
+	vertexBytes = vertexCapacity = indexBytes = indexCapacity = 0;
+	drawCapacity = 0;
+}
+
+void MeshArena::grow(uint32_t& buffer, size_t& capacity, size_t used, size_t required) {
+	if (required <= capacity)
+		return;
+	size_t new_capacity = std::max(required, capacity * 2);
+
+	// the old contents move over on the GPU; the handle changes, so the VAO is rebuilt
+	uint32_t grown = 0;
+	glGenBuffers(1, &grown);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+	glBufferData(GL_COPY_WRITE_BUFFER, new_capacity, NULL, GL_STATIC_DRAW);
+	if (used > 0)
+	{
+		glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, used);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	glDeleteBuffers(1, &buffer);
+	buffer = grown;
+	capacity = new_capacity;
+	bindVertexArray();
+}
+
+void MeshArena::reserveDraws(uint32_t count) {
+	if (count <= drawCapacity)
+		return;
+	drawCapacity = std::max(count, drawCapacity * 2);
+	std::vector<uint32_t> ids(drawCapacity);
+	for (uint32_t i = 0; i < drawCapacity; i++)
+		ids[i] = i;
+	glBindBuffer(GL_ARRAY_BUFFER, drawIndexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, ids.size() * sizeof(uint32_t), ids.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	bindVertexArray();
+}
+
+void MeshArena::bindVertexArray() {
+	if (!VAO)
+		return;
+	const VertexFormat layout = format();
+	glBindVertexArray(VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, layout.stride(), (void*)0);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, layout.stride(), (void*)(uintptr_t)layout.positionSize());
+	glEnableVertexAttribArray(1);
+
+	// with a divisor of 1 the attribute reads element baseInstance + gl_InstanceID
+	glBindBuffer(GL_ARRAY_BUFFER, drawIndexBuffer);
+	glVertexAttribIPointer(DrawIndexAttribute, 1, GL_UNSIGNED_INT, sizeof(uint32_t), (void*)0);
+	glVertexAttribDivisor(DrawIndexAttribute, 1);
+	glEnableVertexAttribArray(DrawIndexAttribute);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+ArenaRange MeshArena::add(const GpuMesh& lod) {
+	const uint32_t stride = format().stride();
+	size_t vertex_size = 0;
+	size_t index_size = 0;
+	std::vector<uint8_t> vertices;
+	if (lod.mesh)
+	{
+		vertices = VertexPacker::packVertices(format(), *lod.mesh);
+		vertex_size = vertices.size();
+		index_size = lod.mesh->getIndexes().size() * sizeof(uint32_t);
+	}
+	else
+	{
+		// GPU-generated levels already use the arena layout
+		GLint size = 0;
+		glBindBuffer(GL_COPY_READ_BUFFER, lod.handles.VBO_vertex);
+		glGetBufferParameteriv(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &size);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		vertex_size = static_cast<size_t>(size);
+		index_size = lod.handles.countElements * sizeof(uint32_t);
+	}
+
+	grow(VBO, vertexCapacity, vertexBytes, vertexBytes + vertex_size);
+	grow(EBO, indexCapacity, indexBytes, indexBytes + index_size);
+
+	ArenaRange range;
+	range.firstIndex = static_cast<uint32_t>(indexBytes / sizeof(uint32_t));
+	range.indexCount = static_cast<uint32_t>(index_size / sizeof(uint32_t));
+	range.baseVertex = static_cast<int32_t>(vertexBytes / stride);
+
+	if (lod.mesh)
+	{
+		glBindBuffer(GL_COPY_WRITE_BUFFER, VBO);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, vertexBytes, vertex_size, vertices.data());
+		glBindBuffer(GL_COPY_WRITE_BUFFER, EBO);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, indexBytes, index_size, lod.mesh->getIndexes().data());
+	}
+	else
+	{
+		glBindBuffer(GL_COPY_READ_BUFFER, lod.handles.VBO_vertex);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, VBO);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, vertexBytes, vertex_size);
+		glBindBuffer(GL_COPY_READ_BUFFER, lod.handles.EBO);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, EBO);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, indexBytes, index_size);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	vertexBytes += vertex_size;
+	indexBytes += index_size;
+	return range;
+}
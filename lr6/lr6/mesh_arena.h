@@ -0,0 +1,55 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstdint>
+
+#include "gpu_mesh.h"
+
+// where one mesh lives in the arena
+struct ArenaRange {
+	uint32_t firstIndex = 0;
+	uint32_t indexCount = 0;
+	int32_t baseVertex = 0;
+};
+
+// Every resident mesh in one vertex buffer (interleaved float positions and normals,
+// the layout GpuIcosphereGenerator writes) and one index buffer (32-bit, relative to
+// the mesh), so draws of different meshes go out in a single glMultiDrawElementsIndirect.
+// The VAO also feeds a per-instance draw index: a command's baseInstance selects its
+// entry in the per-draw SSBO.
+class MeshArena {
+public:
+	static const uint32_t DrawIndexAttribute = 2;
+
+	// GL thread
+	void init();
+	void release();
+
+	// copies the mesh in: from its CPU data or, for GPU-generated levels, buffer to buffer
+	ArenaRange add(const GpuMesh& lod);
+	// the draw index attribute covers baseInstance values below count
+	void reserveDraws(uint32_t count);
+
+	uint32_t getVAO() const {
+		return VAO;
+	}
+
+	static VertexFormat format() {
+		VertexFormat format;
+		format.interleaved = true;
+		return format;
+	}
+
+private:
+	void grow(uint32_t& buffer, size_t& capacity, size_t used, size_t required);
+	void bindVertexArray();
+
+	uint32_t VAO = 0;
+	uint32_t VBO = 0;
+	uint32_t EBO = 0;
+	uint32_t drawIndexBuffer = 0;
+	size_t vertexBytes = 0, vertexCapacity = 0;
+	size_t indexBytes = 0, indexCapacity = 0;
+	uint32_t drawCapacity = 0;
+};
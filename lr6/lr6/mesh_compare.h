@@ -0,0 +1,166 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cmath>
+
+#include <glm.hpp>
+
+#include "figure.h"
+
+struct MeshDifference {
+	size_t vertices = 0;          // distinct positions in the tested mesh
+	size_t referenceVertices = 0; // distinct positions in the reference
+	size_t unmatchedVertices = 0; // tested positions with no reference vertex within tolerance
+	size_t missingTriangles = 0;  // reference triangles absent from the tested mesh
+	size_t extraTriangles = 0;    // tested triangles absent from the reference
+	float maxPositionError = 0.0f;
+	float maxNormalAngle = 0.0f;  // degrees, between normalised normals
+
+	bool identical() const {
+		return unmatchedVertices == 0 && missingTriangles == 0 && extraTriangles == 0;
+	}
+};
+
+// Compares two meshes as geometry, independent of vertex order and duplication:
+// positions are welded within a tolerance and triangles are compared as sets of
+// welded corner triples with their winding.
+class MeshComparer {
+public:
+	static MeshDifference compare(const std::vector<glm::vec3>& vertices, const std::vector<glm::vec3>& normals,
+		const std::vector<uint32_t>& indexes, const Mesh& reference, float tolerance = 1e-5f)
+	{
+		MeshDifference diff;
+		PointSet points(tolerance);
+
+		const auto& ref_vertices = reference.getVertices();
+		const auto& ref_normals = reference.getNormals();
+		std::vector<uint32_t> ref_ids(ref_vertices.size());
+		std::vector<glm::vec3> id_normals;
+		for (uint32_t i = 0; i < ref_vertices.size(); i++)
+		{
+			float error;
+			uint32_t id = points.find(ref_vertices[i], error);
+			if (id == NotFound)
+			{
+				id = points.add(ref_vertices[i]);
+				id_normals.push_back(glm::normalize(ref_normals[i]));
+			}
+			ref_ids[i] = id;
+		}
+		diff.referenceVertices = points.size();
+
+		std::vector<uint32_t> ids(vertices.size());
+		std::vector<uint8_t> seen(points.size(), 0);
+		size_t unmatched_distinct = 0;
+		for (uint32_t i = 0; i < vertices.size(); i++)
+		{
+			float error = 0.0f;
+			uint32_t id = points.find(vertices[i], error);
+			if (id == NotFound || id >= diff.referenceVertices)
+			{
+				if (id == NotFound)
+				{
+					id = points.add(vertices[i]);
+					unmatched_distinct++;
+				}
+				diff.unmatchedVertices++;
+			}
+			else
+			{
+				seen[id] = 1;
+				diff.maxPositionError = std::max(diff.maxPositionError, error);
+				if (!normals.empty())
+				{
+					float cosine = glm::clamp(glm::dot(glm::normalize(normals[i]), id_normals[id]), -1.0f, 1.0f);
+					diff.maxNormalAngle = std::max(diff.maxNormalAngle, glm::degrees(std::acos(cosine)));
+				}
+			}
+			ids[i] = id;
+		}
+		diff.vertices = std::count(seen.begin(), seen.end(), 1) + unmatched_distinct;
+
+		std::vector<Triangle> tested = triangles(indexes, ids);
+		std::vector<Triangle> expected = triangles(reference.getIndexes(), ref_ids);
+		std::vector<Triangle> only;
+		std::set_difference(expected.begin(), expected.end(), tested.begin(), tested.end(), std::back_inserter(only));
+		diff.missingTriangles = only.size();
+		only.clear();
+		std::set_difference(tested.begin(), tested.end(), expected.begin(), expected.end(), std::back_inserter(only));
+		diff.extraTriangles = only.size();
+		return diff;
+	}
+
+private:
+	static const uint32_t NotFound = UINT32_MAX;
+	typedef std::array<uint32_t, 3> Triangle;
+
+	// rotated so the smallest id comes first, which keeps the winding
+	static std::vector<Triangle> triangles(const std::vector<uint32_t>& indexes, const std::vector<uint32_t>& ids) {
+		std::vector<Triangle> result;
+		result.reserve(indexes.size() / 3);
+		for (size_t i = 0; i + 2 < indexes.size(); i += 3)
+		{
+			Triangle t = { ids[indexes[i]], ids[indexes[i + 1]], ids[indexes[i + 2]] };
+			std::rotate(t.begin(), std::min_element(t.begin(), t.end()), t.end());
+			result.push_back(t);
+		}
+		std::sort(result.begin(), result.end());
+		return result;
+	}
+
+	// uniform hash grid with cells as large as the tolerance, so a match is always
+	// in one of the 27 cells around the query
+	class PointSet {
+	public:
+		explicit PointSet(float _tolerance) : tolerance(_tolerance) {}
+
+		uint32_t add(const glm::vec3& p) {
+			uint32_t id = static_cast<uint32_t>(points.size());
+			points.push_back(p);
+			cells[key(cell(p))].push_back(id);
+			return id;
+		}
+		uint32_t find(const glm::vec3& p, float& error) const {
+			const glm::ivec3 c = cell(p);
+			uint32_t best = NotFound;
+			error = tolerance;
+			for (int dz = -1; dz <= 1; dz++)
+				for (int dy = -1; dy <= 1; dy++)
+					for (int dx = -1; dx <= 1; dx++)
+					{
+						auto found = cells.find(key(c + glm::ivec3(dx, dy, dz)));
+						if (found == cells.end())
+							continue;
+						for (uint32_t id : found->second)
+						{
+							float d = glm::distance(points[id], p);
+							if (d <= error)
+							{
+								error = d;
+								best = id;
+							}
+						}
+					}
+			return best;
+		}
+		size_t size() const {
+			return points.size();
+		}
+
+	private:
+		glm::ivec3 cell(const glm::vec3& p) const {
+			return glm::ivec3(static_cast<int>(std::floor(p.x / tolerance)), static_cast<int>(std::floor(p.y / tolerance)), static_cast<int>(std::floor(p.z / tolerance)));
+		}
+		static uint64_t key(const glm::ivec3& c) {
+			return (uint64_t(uint32_t(c.x) & 0x1FFFFF) << 42) | (uint64_t(uint32_t(c.y) & 0x1FFFFF) << 21) | uint64_t(uint32_t(c.z) & 0x1FFFFF);
+		}
+
+		float tolerance;
+		std::vector<glm::vec3> points;
+		std::unordered_map<uint64_t, std::vector<uint32_t>> cells;
+	};
+};
@@ -0,0 +1,307 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+	const int32_t CacheSize = 32;
+	const float CacheDecayPower = 1.5f;
+	const float LastTriangleScore = 0.75f;
+	const float ValenceBoostScale = 2.0f;
+	const float ValenceBoostPower = 0.5f;
+
+	float vertexScore(int32_t cachePosition, uint32_t remainingTriangles) {
+		if (remainingTriangles == 0)
+			return -1.0f;
+
+		float score = 0.0f;
+		if (cachePosition >= 0)
+		{
+			// the three vertices of the last triangle get a fixed score, so the next
+			// triangle does not simply reuse the same edge
+			if (cachePosition < 3)
+				score = LastTriangleScore;
+			else
+				score = std::pow(1.0f - float(cachePosition - 3) / (CacheSize - 3), CacheDecayPower);
+		}
+		return score + ValenceBoostScale * std::pow(float(remainingTriangles), -ValenceBoostPower);
+	}
+}
+
+std::vector<uint32_t> MeshOptimizer::vertexCacheOrder(const std::vector<uint32_t>& indexes, size_t vertexCount,
+	const std::vector<MeshPatch>& patches)
+{
+	std::vector<uint32_t> order(indexes.size() / 3);
+	if (patches.empty())
+	{
+		orderRange(indexes.data(), 0, order.size(), vertexCount, order.data());
+		return order;
+	}
+
+	// triangles outside every patch keep their place
+	for (uint32_t t = 0; t < order.size(); t++)
+		order[t] = t;
+	for (const auto& patch : patches)
+		orderRange(indexes.data(), patch.firstIndex / 3, patch.countIndexes / 3, vertexCount, order.data() + patch.firstIndex / 3);
+	return order;
+}
+
+std::vector<uint32_t> MeshOptimizer::optimizeVertexCache(const std::vector<uint32_t>& indexes, size_t vertexCount,
+	const std::vector<MeshPatch>& patches)
+{
+	const auto order = vertexCacheOrder(indexes, vertexCount, patches);
+	std::vector<uint32_t> result(order.size() * 3);
+	for (size_t i = 0; i < order.size(); i++)
+		for (int k = 0; k < 3; k++)
+			result[i * 3 + k] = indexes[order[i] * 3 + k];
+	return result;
+}
+
+void MeshOptimizer::orderRange(const uint32_t* indexes, uint32_t firstTriangle, size_t triangleCount, size_t vertexCount, uint32_t* order) {
+	if (triangleCount == 0)
+		return;
+	indexes += firstTriangle * 3;
+
+	// vertex -> triangles, compressed
+	std::vector<uint32_t> offsets(vertexCount + 1, 0);
+	for (size_t i = 0; i < triangleCount * 3; i++)
+		offsets[indexes[i] + 1]++;
+	for (size_t v = 0; v < vertexCount; v++)
+		offsets[v + 1] += offsets[v];
+	std::vector<uint32_t> adjacency(triangleCount * 3);
+	std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+	for (size_t i = 0; i < triangleCount * 3; i++)
+		adjacency[cursor[indexes[i]]++] = static_cast<uint32_t>(i / 3);
+
+	std::vector<uint32_t> remaining(vertexCount);
+	std::vector<int32_t> cache_position(vertexCount, -1);
+	std::vector<float> score(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		remaining[v] = offsets[v + 1] - offsets[v];
+		score[v] = vertexScore(-1, remaining[v]);
+	}
+
+	std::vector<uint8_t> emitted(triangleCount, 0);
+
+	std::vector<uint32_t> cache, next_cache;
+	cache.reserve(CacheSize + 3);
+	next_cache.reserve(CacheSize + 3);
+
+	int64_t best = -1;
+	size_t scan = 0;
+	for (size_t written = 0; written < triangleCount; written++)
+	{
+		if (best < 0)
+		{
+			// nothing in the cache has triangles left: continue with the next unused one
+			while (emitted[scan])
+				scan++;
+			best = static_cast<int64_t>(scan);
+		}
+
+		const uint32_t* triangle = indexes + best * 3;
+		order[written] = firstTriangle + static_cast<uint32_t>(best);
+		emitted[best] = 1;
+
+		// the emitted triangle moves to the front of the LRU cache
+		next_cache.assign(triangle, triangle + 3);
+		for (uint32_t v : cache)
+			if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+				next_cache.push_back(v);
+
+		for (int k = 0; k < 3; k++)
+		{
+			const uint32_t v = triangle[k];
+			uint32_t* begin = &adjacency[offsets[v]];
+			uint32_t* end = begin + remaining[v];
+			*std::find(begin, end, static_cast<uint32_t>(best)) = *(end - 1);
+			remaining[v]--;
+		}
+
+		for (size_t i = 0; i < next_cache.size(); i++)
+		{
+			const uint32_t v = next_cache[i];
+			cache_position[v] = i < size_t(CacheSize) ? static_cast<int32_t>(i) : -1;
+			score[v] = vertexScore(cache_position[v], remaining[v]);
+		}
+		if (next_cache.size() > size_t(CacheSize))
+			next_cache.resize(CacheSize);
+		std::swap(cache, next_cache);
+
+		// only triangles around cached vertices changed score
+		best = -1;
+		float best_score = -1.0f;
+		for (uint32_t v : cache)
+			for (uint32_t i = offsets[v]; i < offsets[v] + remaining[v]; i++)
+			{
+				const uint32_t t = adjacency[i];
+				const float s = score[indexes[t * 3]] + score[indexes[t * 3 + 1]] + score[indexes[t * 3 + 2]];
+				if (s > best_score)
+				{
+					best_score = s;
+					best = t;
+				}
+			}
+	}
+}
+
+VertexCacheStats MeshOptimizer::analyzeVertexCache(const std::vector<uint32_t>& indexes, size_t vertexCount, uint32_t cacheSize) {
+	VertexCacheStats stats;
+	if (indexes.empty())
+		return stats;
+
+	std::vector<uint8_t> used(vertexCount, 0);
+	std::vector<uint64_t> inserted(vertexCount, 0); // load stamp, 0 when never loaded
+	uint64_t stamp = 0;
+	size_t misses = 0, unique = 0;
+	for (uint32_t v : indexes)
+	{
+		if (!used[v])
+		{
+			used[v] = 1;
+			unique++;
+		}
+		// resident while fewer than cacheSize vertices were loaded after it
+		if (inserted[v] == 0 || stamp - inserted[v] >= cacheSize)
+		{
+			misses++;
+			inserted[v] = ++stamp;
+		}
+	}
+	stats.acmr = float(misses) / (indexes.size() / 3);
+	stats.atvr = float(misses) / unique;
+	return stats;
+}
+
+std::vector<MeshPatch> MeshOptimizer::buildMeshlets(const std::vector<uint32_t>& indexes, size_t vertexCount,
+	const std::vector<MeshPatch>& patches, uint32_t maxVertices, uint32_t maxTriangles)
+{
+	std::vector<MeshPatch> ranges = patches;
+	if (ranges.empty())
+		ranges.push_back({ 0, static_cast<uint32_t>(indexes.size()) });
+
+	std::vector<MeshPatch> meshlets;
+	std::vector<uint32_t> seen(vertexCount, UINT32_MAX); // meshlet that last used the vertex
+	for (const auto& range : ranges)
+	{
+		uint32_t first = range.firstIndex;
+		uint32_t vertices = 0;
+		for (uint32_t i = range.firstIndex; i + 2 < range.firstIndex + range.countIndexes; i += 3)
+		{
+			const uint32_t id = static_cast<uint32_t>(meshlets.size());
+			uint32_t added = 0;
+			for (int k = 0; k < 3; k++)
+				added += seen[indexes[i + k]] != id;
+			if (i > first && (vertices + added > maxVertices || (i - first) / 3 >= maxTriangles))
+			{
+				meshlets.push_back({ first, i - first });
+				first = i;
+				vertices = 0;
+				i -= 3; // the triangle opens the next meshlet
+				continue;
+			}
+			for (int k = 0; k < 3; k++)
+				if (seen[indexes[i + k]] != id)
+				{
+					seen[indexes[i + k]] = id;
+					vertices++;
+				}
+		}
+		if (first < range.firstIndex + range.countIndexes)
+			meshlets.push_back({ first, range.firstIndex + range.countIndexes - first });
+	}
+	return meshlets;
+}
+
+std::vector<uint32_t> MeshOptimizer::vertexFetchRemap(const std::vector<uint32_t>& indexes, size_t vertexCount) {
+	std::vector<uint32_t> remap(vertexCount, UINT32_MAX);
+	uint32_t next = 0;
+	for (uint32_t v : indexes)
+		if (remap[v] == UINT32_MAX)
+			remap[v] = next++;
+	for (auto& v : remap)
+		if (v == UINT32_MAX)
+			v = next++;
+	return remap;
+}
+
+std::vector<uint32_t> MeshOptimizer::spatialSortRemap(const std::vector<glm::vec3>& vertices) {
+	if (vertices.empty())
+		return std::vector<uint32_t>();
+
+	glm::vec3 low = vertices[0], high = vertices[0];
+	for (const auto& v : vertices)
+	{
+		low = glm::min(low, v);
+		high = glm::max(high, v);
+	}
+	const glm::vec3 extent = glm::max(high - low, glm::vec3(1e-20f));
+
+	// 10 bits per axis, interleaved into a 30-bit key
+	auto spread = [](uint32_t x) {
+		x &= 0x3FF;
+		x = (x | (x << 16)) & 0x030000FF;
+		x = (x | (x << 8)) & 0x0300F00F;
+		x = (x | (x << 4)) & 0x030C30C3;
+		x = (x | (x << 2)) & 0x09249249;
+		return x;
+	};
+	std::vector<uint32_t> keys(vertices.size());
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		const glm::vec3 cell = (vertices[i] - low) / extent * 1023.0f;
+		keys[i] = spread(uint32_t(cell.x)) | (spread(uint32_t(cell.y)) << 1) | (spread(uint32_t(cell.z)) << 2);
+	}
+
+	std::vector<uint32_t> order(vertices.size());
+	for (uint32_t i = 0; i < order.size(); i++)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+
+	std::vector<uint32_t> remap(vertices.size());
+	for (uint32_t i = 0; i < order.size(); i++)
+		remap[order[i]] = i;
+	return remap;
+}
+
+void MeshOptimizer::remapIndexes(std::vector<uint32_t>& indexes, const std::vector<uint32_t>& remap) {
+	for (auto& v : indexes)
+		v = remap[v];
+}
+
+VertexFetchStats MeshOptimizer::analyzeVertexFetch(const std::vector<uint32_t>& indexes, size_t vertexCount, size_t vertexSize,
+	uint32_t lineSize, uint32_t cacheLines)
+{
+	VertexFetchStats stats;
+	if (indexes.empty())
+		return stats;
+
+	std::vector<uint8_t> used(vertexCount, 0);
+	std::vector<size_t> lru; // most recent line first
+	lru.reserve(cacheLines + 1);
+	size_t unique = 0;
+	for (uint32_t v : indexes)
+	{
+		if (!used[v])
+		{
+			used[v] = 1;
+			unique++;
+		}
+		const size_t first = v * vertexSize / lineSize;
+		const size_t last = (v * vertexSize + vertexSize - 1) / lineSize;
+		for (size_t line = first; line <= last; line++)
+		{
+			auto found = std::find(lru.begin(), lru.end(), line);
+			if (found != lru.end())
+				lru.erase(found);
+			else
+				stats.bytesFetched += lineSize;
+			lru.insert(lru.begin(), line);
+			if (lru.size() > cacheLines)
+				lru.pop_back();
+		}
+	}
+	stats.overfetch = float(stats.bytesFetched) / (unique * vertexSize);
+	return stats;
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "figure.h"
+#include "vertex_format.h"
+
+struct VertexCacheStats {
+	float acmr = 0.0f; // average cache miss ratio: transformed vertices per triangle (0.5 is ideal on a closed mesh)
+	float atvr = 0.0f; // average transform to vertex ratio: transformed vertices per unique vertex (1.0 is ideal)
+};
+
+struct VertexFetchStats {
+	size_t bytesFetched = 0;
+	float overfetch = 0.0f; // bytes fetched per byte of referenced vertex data (1.0 is ideal)
+};
+
+enum class VertexOrder {
+	Unchanged,
+	FirstUse, // in the order the index buffer first references them
+	Morton    // along a Z-order curve over the positions
+};
+
+// Index reordering for the post-transform vertex cache and vertex reordering for fetch locality.
+class MeshOptimizer {
+public:
+	// Forsyth's linear-speed greedy ordering: triangles are emitted by a score that
+	// favours vertices still in a simulated LRU cache and vertices with few remaining
+	// triangles. Only the triangle order changes; each patch is reordered on its own
+	// so patch ranges stay valid.
+	static std::vector<uint32_t> optimizeVertexCache(const std::vector<uint32_t>& indexes, size_t vertexCount,
+		const std::vector<MeshPatch>& patches = std::vector<MeshPatch>());
+	// the same ordering as a triangle permutation: entry i is the source triangle emitted i-th
+	static std::vector<uint32_t> vertexCacheOrder(const std::vector<uint32_t>& indexes, size_t vertexCount,
+		const std::vector<MeshPatch>& patches = std::vector<MeshPatch>());
+
+	// FIFO cache simulation, the usual model for hardware post-transform caches
+	static VertexCacheStats analyzeVertexCache(const std::vector<uint32_t>& indexes, size_t vertexCount, uint32_t cacheSize = 16);
+
+	// Splits every patch (or the whole buffer) into runs of consecutive triangles that
+	// use at most maxVertices distinct vertices and maxTriangles triangles. After
+	// optimizeVertexCache consecutive triangles are neighbours, so the runs are compact
+	// clusters that can be culled on their own.
+	static std::vector<MeshPatch> buildMeshlets(const std::vector<uint32_t>& indexes, size_t vertexCount,
+		const std::vector<MeshPatch>& patches = std::vector<MeshPatch>(), uint32_t maxVertices = 64, uint32_t maxTriangles = 124);
+
+	// old vertex -> new vertex; unreferenced vertices go to the end in their old order
+	static std::vector<uint32_t> vertexFetchRemap(const std::vector<uint32_t>& indexes, size_t vertexCount);
+	static std::vector<uint32_t> spatialSortRemap(const std::vector<glm::vec3>& vertices);
+
+	// applies a remap to the indexes or to one attribute stream
+	static void remapIndexes(std::vector<uint32_t>& indexes, const std::vector<uint32_t>& remap);
+	template<typename T>
+	static std::vector<T> remapVertices(const std::vector<T>& attribute, const std::vector<uint32_t>& remap) {
+		std::vector<T> result(attribute.size());
+		for (size_t v = 0; v < attribute.size(); v++)
+			result[remap[v]] = attribute[v];
+		return result;
+	}
+
+	// vertex fetch through an LRU cache of cacheLines lines, vertexSize bytes per vertex
+	static VertexFetchStats analyzeVertexFetch(const std::vector<uint32_t>& indexes, size_t vertexCount, size_t vertexSize,
+		uint32_t lineSize = 64, uint32_t cacheLines = 128);
+
+private:
+	static void orderRange(const uint32_t* indexes, uint32_t firstTriangle, size_t triangleCount, size_t vertexCount, uint32_t* order);
+};
+
+// Copy of a mesh with its triangles in cache-friendly order and its vertices remapped
+// for fetch locality, split into meshlets that replace the source patches. Face normals
+// follow their triangles, vertex normals their vertices. The cache and fetch statistics
+// cost several simulation passes, so they are only computed when measure is set.
+class CacheOptimizedMesh : public Mesh {
+public:
+	explicit CacheOptimizedMesh(const Mesh& source, VertexOrder vertexOrder = VertexOrder::FirstUse, bool measure = false) :
+		vertices(source.getVertices()),
+		normals(source.getNormals()),
+		patches(source.getPatches())
+	{
+		const auto& source_indexes = source.getIndexes();
+		const auto& source_faces = source.getFaceNormals();
+		const auto order = MeshOptimizer::vertexCacheOrder(source_indexes, vertices.size(), patches);
+
+		indexes.resize(order.size() * 3);
+		for (size_t i = 0; i < order.size(); i++)
+			for (int k = 0; k < 3; k++)
+				indexes[i * 3 + k] = source_indexes[order[i] * 3 + k];
+		if (source_faces.size() == order.size())
+		{
+			faceNormals.resize(order.size());
+			for (size_t i = 0; i < order.size(); i++)
+				faceNormals[i] = source_faces[order[i]];
+		}
+
+		// fetched with the stride the mesh is uploaded with; the remap does not change the choice
+		const size_t vertex_size = measure ? VertexFormat::choose(source).stride() : 0;
+		if (measure)
+		{
+			before = MeshOptimizer::analyzeVertexCache(source_indexes, vertices.size());
+			after = MeshOptimizer::analyzeVertexCache(indexes, vertices.size());
+			// the transform cache only sees indexes, so the vertex remap leaves it unchanged
+			fetchBefore = MeshOptimizer::analyzeVertexFetch(indexes, vertices.size(), vertex_size);
+		}
+		patches = MeshOptimizer::buildMeshlets(indexes, vertices.size(), patches);
+
+		if (vertexOrder != VertexOrder::Unchanged)
+		{
+			const auto remap = vertexOrder == VertexOrder::Morton
+				? MeshOptimizer::spatialSortRemap(vertices)
+				: MeshOptimizer::vertexFetchRemap(indexes, vertices.size());
+			MeshOptimizer::remapIndexes(indexes, remap);
+			vertices = MeshOptimizer::remapVertices(vertices, remap);
+			if (normals.size() == remap.size())
+				normals = MeshOptimizer::remapVertices(normals, remap);
+		}
+		if (measure)
+			fetchAfter = MeshOptimizer::analyzeVertexFetch(indexes, vertices.size(), vertex_size);
+	}
+
+	const std::vector<glm::vec3>& getVertices() const override {
+		return vertices;
+	}
+	const std::vector<glm::vec3>& getNormals() const override {
+		return normals;
+	}
+	const std::vector<uint32_t>& getIndexes() const override {
+		return indexes;
+	}
+	const std::vector<glm::vec3>& getFaceNormals() const override {
+		return faceNormals;
+	}
+	const std::vector<MeshPatch>& getPatches() const override {
+		return patches;
+	}
+
+	// zero unless constructed with measure
+	const VertexCacheStats& statsBefore() const {
+		return before;
+	}
+	const VertexCacheStats& statsAfter() const {
+		return after;
+	}
+	const VertexFetchStats& fetchStatsBefore() const {
+		return fetchBefore;
+	}
+	const VertexFetchStats& fetchStatsAfter() const {
+		return fetchAfter;
+	}
+
+private:
+	std::vector<glm::vec3> vertices;
+	std::vector<glm::vec3> normals;
+	std::vector<uint32_t> indexes;
+	std::vector<glm::vec3> faceNormals;
+	std::vector<MeshPatch> patches;
+	VertexCacheStats before;
+	VertexCacheStats after;
+	VertexFetchStats fetchBefore;
+	VertexFetchStats fetchAfter;
+};
@@ -0,0 +1,156 @@
+#include "mip_chain.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <immintrin.h>
+
+namespace {
+
+const int KaiserTaps = 8;
+
+// weights for source pixels 2x - 3 .. 2x + 4 around output pixel x
+struct KaiserKernel {
+	float weights[KaiserTaps];
+
+	KaiserKernel() {
+		const double beta = 4.0;
+		// zeroth order modified Bessel function of the first kind, by its series
+		auto bessel_i0 = [](double x) {
+			double sum = 1.0, term = 1.0;
+			for (int k = 1; k < 20; k++)
+			{
+				term *= (x / (2.0 * k)) * (x / (2.0 * k));
+				sum += term;
+			}
+			return sum;
+		};
+		const double pi = 3.14159265358979323846;
+		double total = 0.0;
+		double raw[KaiserTaps];
+		for (int k = 0; k < KaiserTaps; k++)
+		{
+			const double distance = k - 3.5;          // in source pixels
+			const double t = distance / 2.0;          // in target pixels
+			const double sinc = std::sin(pi * t) / (pi * t);
+			const double ratio = distance / 4.0;
+			raw[k] = sinc * bessel_i0(beta * std::sqrt(1.0 - ratio * ratio)) / bessel_i0(beta);
+			total += raw[k];
+		}
+		for (int k = 0; k < KaiserTaps; k++)
+			weights[k] = static_cast<float>(raw[k] / total);
+	}
+};
+
+inline __m128 loadPixel(const uint8_t* rgba) {
+	int32_t packed;
+	std::memcpy(&packed, rgba, 4);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i wide = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+	return _mm_cvtepi32_ps(wide);
+}
+
+inline void storePixel(uint8_t* rgba, __m128 value) {
+	// saturating packs clamp the negative lobes' overshoot to 0..255
+	__m128i rounded = _mm_cvtps_epi32(value);
+	__m128i bytes = _mm_packus_epi16(_mm_packs_epi32(rounded, rounded), rounded);
+	int32_t packed = _mm_cvtsi128_si32(bytes);
+	std::memcpy(rgba, &packed, 4);
+}
+
+}
+
+std::vector<Image> MipChain::build(Image base, MipFilter filter) {
+	std::vector<Image> levels;
+	levels.push_back(std::move(base));
+	while (levels.back().width > 1 || levels.back().height > 1)
+	{
+		Image next;
+		if (filter == MipFilter::Kaiser)
+			downsampleKaiser(levels.back(), next);
+		else
+			downsampleBox(levels.back(), next);
+		levels.push_back(std::move(next));
+	}
+	return levels;
+}
+
+void MipChain::downsampleBox(const Image& source, Image& target) {
+	target.width = std::max<uint32_t>(1, source.width / 2);
+	target.height = std::max<uint32_t>(1, source.height / 2);
+	target.pixels.resize(size_t(target.width) * target.height * 4);
+
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i rounding = _mm_set1_epi16(2);
+	for (uint32_t y = 0; y < target.height; y++)
+	{
+		const uint8_t* row0 = &source.pixels[size_t(std::min(2 * y, source.height - 1)) * source.width * 4];
+		const uint8_t* row1 = &source.pixels[size_t(std::min(2 * y + 1, source.height - 1)) * source.width * 4];
+		uint8_t* out = &target.pixels[size_t(y) * target.width * 4];
+
+		// two output pixels from four source pixels of each row
+		uint32_t x = 0;
+		for (; 2 * x + 4 <= source.width && x + 2 <= target.width; x += 2)
+		{
+			__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + x * 8));
+			__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + x * 8));
+			__m128i low = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+			__m128i high = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+			low = _mm_add_epi16(low, _mm_srli_si128(low, 8));
+			high = _mm_add_epi16(high, _mm_srli_si128(high, 8));
+			__m128i sum = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(low, high), rounding), 2);
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(out + x * 4), _mm_packus_epi16(sum, zero));
+		}
+		for (; x < target.width; x++)
+		{
+			const uint32_t x0 = std::min(2 * x, source.width - 1), x1 = std::min(2 * x + 1, source.width - 1);
+			for (uint32_t c = 0; c < 4; c++)
+				out[x * 4 + c] = static_cast<uint8_t>((row0[x0 * 4 + c] + row0[x1 * 4 + c] + row1[x0 * 4 + c] + row1[x1 * 4 + c] + 2) / 4);
+		}
+	}
+}
+
+void MipChain::downsampleKaiser(const Image& source, Image& target) {
+	static const KaiserKernel kernel;
+	target.width = std::max<uint32_t>(1, source.width / 2);
+	target.height = std::max<uint32_t>(1, source.height / 2);
+	target.pixels.resize(size_t(target.width) * target.height * 4);
+
+	__m128 weights[KaiserTaps];
+	for (int k = 0; k < KaiserTaps; k++)
+		weights[k] = _mm_set1_ps(kernel.weights[k]);
+	auto clamp = [](int64_t i, uint32_t size) {
+		return static_cast<uint32_t>(std::min<int64_t>(std::max<int64_t>(i, 0), size - 1));
+	};
+
+	// horizontal pass into float RGBA, four floats per pixel; a vector of __m128 would
+	// drop the type's alignment attribute, so the rows are loaded unaligned instead
+	std::vector<float> horizontal(size_t(target.width) * source.height * 4);
+	for (uint32_t y = 0; y < source.height; y++)
+	{
+		const uint8_t* row = &source.pixels[size_t(y) * source.width * 4];
+		for (uint32_t x = 0; x < target.width; x++)
+		{
+			__m128 sum = _mm_setzero_ps();
+			for (int k = 0; k < KaiserTaps; k++)
+				sum = _mm_add_ps(sum, _mm_mul_ps(loadPixel(row + size_t(clamp(int64_t(2 * x) - 3 + k, source.width)) * 4), weights[k]));
+			_mm_storeu_ps(&horizontal[(size_t(y) * target.width + x) * 4], sum);
+		}
+	}
+
+	for (uint32_t y = 0; y < target.height; y++)
+	{
+		const float* rows[KaiserTaps];
+		for (int k = 0; k < KaiserTaps; k++)
+			rows[k] = &horizontal[size_t(clamp(int64_t(2 * y) - 3 + k, source.height)) * target.width * 4];
+		uint8_t* out = &target.pixels[size_t(y) * target.width * 4];
+		for (uint32_t x = 0; x < target.width; x++)
+		{
+			__m128 sum = _mm_setzero_ps();
+			for (int k = 0; k < KaiserTaps; k++)
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(rows[k] + size_t(x) * 4), weights[k]));
+			storePixel(out + x * 4, sum);
+		}
+	}
+}
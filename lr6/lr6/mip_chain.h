@@ -0,0 +1,22 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "image.h"
+
+enum class MipFilter {
+	Box,    // 2x2 average
+	Kaiser, // 8-tap Kaiser-windowed sinc: sharper than the box, with less aliasing
+};
+
+// Mip levels of an RGBA8 image down to 1x1, finest first. Odd sizes round down and
+// edges are clamped. Both filters run on SSE2: the box on 16-bit lanes, the Kaiser
+// filter on one pixel per float register, separably.
+class MipChain {
+public:
+	static std::vector<Image> build(Image base, MipFilter filter);
+
+	static void downsampleBox(const Image& source, Image& target);
+	static void downsampleKaiser(const Image& source, Image& target);
+};
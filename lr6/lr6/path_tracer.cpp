@@ -0,0 +1,356 @@
+#include "path_tracer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+#include "shader.hpp"
+
+namespace {
+
+const float Pi = 3.14159265f;
+// self-intersection guard for rays leaving a surface, in view-space units
+const float SurfaceOffset = 1e-3f;
+
+uint32_t hash(uint32_t x) {
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+// PCG, seeded from the pixel and the sample index
+struct Random {
+	uint32_t state;
+
+	Random(uint32_t pixel, uint32_t sample) : state(hash(pixel ^ hash(sample * 0x9e3779b9u + 1u))) {}
+
+	float next() {
+		state = state * 747796405u + 2891336453u;
+		uint32_t word = ((state >> ((state >> 28) + 4)) ^ state) * 277803737u;
+		word = (word >> 22) ^ word;
+		return (word >> 8) * (1.0f / 16777216.0f);
+	}
+};
+
+// cosine-weighted around normal, so the Lambert term cancels against the pdf
+glm::vec3 cosineSample(const glm::vec3& normal, float a, float b) {
+	const float radius = std::sqrt(a);
+	const float angle = 2.0f * Pi * b;
+	const glm::vec3 helper = std::fabs(normal.x) > 0.9f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+	const glm::vec3 tangent = glm::normalize(glm::cross(helper, normal));
+	const glm::vec3 bitangent = glm::cross(normal, tangent);
+	return tangent * (radius * std::cos(angle)) + bitangent * (radius * std::sin(angle)) + normal * std::sqrt(std::max(0.0f, 1.0f - a));
+}
+
+Ray toObject(const Ray& ray, const glm::mat4& matrix) {
+	Ray result = ray;
+	result.origin = glm::vec3(matrix * glm::vec4(ray.origin, 1.0f));
+	// not renormalised, so t stays in view-space units for every object
+	result.direction = glm::mat3(matrix) * ray.direction;
+	return result;
+}
+
+}
+
+PathTracer::PathTracer(const Mesh& mesh, ThreadPool& _pool, const TraceSettings& _settings) :
+	pool(_pool),
+	settings(_settings),
+	bvh(mesh, _pool),
+	normals(mesh.getNormals()),
+	indexes(mesh.getIndexes())
+{
+	settings.tileSize = std::max<uint32_t>(settings.tileSize, 2);
+	tilesX = (settings.width + settings.tileSize - 1) / settings.tileSize;
+	tilesY = (settings.height + settings.tileSize - 1) / settings.tileSize;
+	accumulation.assign(size_t(settings.width) * settings.height, glm::vec3(0.0f));
+	queueCount = pool.size() + 1;
+	queues.reset(new TileQueue[queueCount]);
+}
+
+void PathTracer::setScene(const SceneState& scene) {
+	objects.clear();
+	for (const auto& object : scene.objects)
+	{
+		const glm::mat4 VM = scene.viewMatrix * object.modelMatrix;
+		Object traced;
+		traced.toObject = glm::inverse(VM);
+		traced.normalMatrix = glm::mat3(glm::transpose(traced.toObject));
+		traced.color = object.customColor ? object.color
+			: glm::vec3(shaders_source::material.color[0], shaders_source::material.color[1], shaders_source::material.color[2]);
+		traced.specular = object.specular;
+		objects.push_back(traced);
+	}
+	lights = scene.lights;
+	lightFalloff = lights.size() > shaders_source::MaxLights;
+	unproject = glm::inverse(scene.projectionMatrix);
+
+	std::fill(accumulation.begin(), accumulation.end(), glm::vec3(0.0f));
+	samples = 0;
+}
+
+PathTracer::Surface PathTracer::surfaceAt(const Ray& ray, const RayHit& hit, uint32_t object) const {
+	Surface surface;
+	surface.object = object;
+	surface.position = ray.origin + ray.direction * hit.t;
+	const uint32_t* corners = &indexes[size_t(hit.triangle) * 3];
+	const glm::vec3 normal = normals[corners[0]] * (1.0f - hit.u - hit.v) + normals[corners[1]] * hit.u + normals[corners[2]] * hit.v;
+	surface.normal = glm::normalize(objects[object].normalMatrix * normal);
+	return surface;
+}
+
+bool PathTracer::intersect(const Ray& ray, Surface& surface) const {
+	// a handful of objects: each is tested in its own space, the nearest hit wins
+	float nearest = ray.tMax;
+	uint32_t found = RayHit::None;
+	RayHit best;
+	for (uint32_t i = 0; i < objects.size(); i++)
+	{
+		Ray local = toObject(ray, objects[i].toObject);
+		local.tMax = nearest;
+		const RayHit hit = bvh.closestHit(local);
+		if (!hit.hit())
+			continue;
+		nearest = hit.t;
+		best = hit;
+		found = i;
+	}
+	if (found == RayHit::None)
+		return false;
+	surface = surfaceAt(ray, best, found);
+	return true;
+}
+
+void PathTracer::intersect4(const Ray* rays, Surface* surfaces, bool* hits) const {
+	RayHit best[4];
+	uint32_t found[4] = { RayHit::None, RayHit::None, RayHit::None, RayHit::None };
+	for (uint32_t i = 0; i < objects.size(); i++)
+	{
+		Ray local[4];
+		RayHit hit[4];
+		for (int lane = 0; lane < 4; lane++)
+		{
+			local[lane] = toObject(rays[lane], objects[i].toObject);
+			local[lane].tMax = found[lane] == RayHit::None ? rays[lane].tMax : best[lane].t;
+		}
+		bvh.closestHit4(local, hit);
+		for (int lane = 0; lane < 4; lane++)
+			if (hit[lane].hit())
+			{
+				best[lane] = hit[lane];
+				found[lane] = i;
+			}
+	}
+	for (int lane = 0; lane < 4; lane++)
+	{
+		hits[lane] = found[lane] != RayHit::None;
+		if (hits[lane])
+			surfaces[lane] = surfaceAt(rays[lane], best[lane], found[lane]);
+	}
+}
+
+bool PathTracer::occluded(const glm::vec3& position, const glm::vec3& direction, float distance) const {
+	Ray ray;
+	ray.origin = position;
+	ray.direction = direction;
+	ray.tMin = SurfaceOffset;
+	ray.tMax = distance;
+	for (const auto& object : objects)
+		if (bvh.anyHit(toObject(ray, object.toObject)))
+			return true;
+	return false;
+}
+
+// fragment_shader's Phong terms, light by light
+glm::vec3 PathTracer::shade(const Surface& surface, const glm::vec3& viewDirection) const {
+	const Object& object = objects[surface.object];
+	glm::vec3 light(0.0f);
+	for (const auto& source : lights)
+	{
+		glm::vec3 to_light = source.position - surface.position;
+		const float distance = glm::length(to_light);
+		to_light /= distance;
+		float falloff = 1.0f;
+		if (lightFalloff)
+		{
+			const float ratio = distance / source.radius;
+			falloff = std::min(std::max(1.0f - ratio * ratio, 0.0f), 1.0f);
+			falloff *= falloff;
+			if (falloff == 0.0f)
+				continue;
+		}
+
+		glm::vec3 result = shaders_source::material.ambientStrength * source.color;
+		if (!settings.shadows || !occluded(surface.position, to_light, distance))
+		{
+			const float diff = std::max(glm::dot(surface.normal, to_light), 0.0f);
+			result += diff * source.color;
+			if (object.specular)
+			{
+				const glm::vec3 reflected = glm::reflect(-to_light, surface.normal);
+				const float spec = std::pow(std::max(glm::dot(viewDirection, reflected), 0.0f), shaders_source::material.shininess);
+				result += shaders_source::material.specularStrength * spec * source.color;
+			}
+		}
+		light += falloff * result;
+	}
+	return light * object.color;
+}
+
+// the camera hit is found beforehand (in packets); bounces continue from it one ray at a time
+glm::vec3 PathTracer::trace(const Ray& camera, bool cameraHit, const Surface& first, uint32_t pixel) const {
+	if (!cameraHit)
+		return settings.background;
+	Random random(pixel, samples * 2 + 1);
+	glm::vec3 radiance(0.0f);
+	glm::vec3 throughput(1.0f);
+	Surface surface = first;
+	glm::vec3 direction = camera.direction;
+	for (uint32_t bounce = 0;; bounce++)
+	{
+		radiance += throughput * shade(surface, -direction);
+		if (bounce == settings.maxBounces)
+			break;
+		// Lambertian with the material colour as albedo
+		throughput = throughput * objects[surface.object].color;
+		Ray ray;
+		ray.origin = surface.position;
+		ray.direction = cosineSample(surface.normal, random.next(), random.next());
+		ray.tMin = SurfaceOffset;
+		direction = ray.direction;
+		if (!intersect(ray, surface))
+			break;
+	}
+	return radiance;
+}
+
+Ray PathTracer::cameraRay(uint32_t x, uint32_t y, uint32_t pixel) const {
+	Random random(pixel, samples * 2);
+	const float ndc_x = 2.0f * (x + random.next()) / settings.width - 1.0f;
+	const float ndc_y = 1.0f - 2.0f * (y + random.next()) / settings.height;
+	glm::vec4 near_point = unproject * glm::vec4(ndc_x, ndc_y, -1.0f, 1.0f);
+	glm::vec4 far_point = unproject * glm::vec4(ndc_x, ndc_y, 1.0f, 1.0f);
+	near_point /= near_point.w;
+	far_point /= far_point.w;
+	Ray ray;
+	ray.origin = glm::vec3(near_point);
+	const glm::vec3 segment = glm::vec3(far_point - near_point);
+	ray.tMax = glm::length(segment);
+	ray.direction = segment / ray.tMax;
+	return ray;
+}
+
+void PathTracer::traceTile(uint32_t tile) {
+	const uint32_t x0 = (tile % tilesX) * settings.tileSize;
+	const uint32_t y0 = (tile / tilesX) * settings.tileSize;
+	const uint32_t x1 = std::min(x0 + settings.tileSize, settings.width);
+	const uint32_t y1 = std::min(y0 + settings.tileSize, settings.height);
+	// 2x2 pixel quads: neighbouring camera rays are coherent enough to traverse together
+	for (uint32_t y = y0; y < y1; y += 2)
+		for (uint32_t x = x0; x < x1; x += 2)
+		{
+			uint32_t pixels[4];
+			Ray rays[4];
+			for (int lane = 0; lane < 4; lane++)
+			{
+				// quads past the image edge repeat their last pixel; the copies are not stored
+				const uint32_t px = std::min(x + (lane & 1), x1 - 1);
+				const uint32_t py = std::min(y + (lane >> 1), y1 - 1);
+				pixels[lane] = py * settings.width + px;
+				rays[lane] = cameraRay(px, py, pixels[lane]);
+			}
+			Surface surfaces[4];
+			bool hits[4];
+			intersect4(rays, surfaces, hits);
+			for (int lane = 0; lane < 4; lane++)
+			{
+				if (((lane & 1) && x + 1 >= x1) || ((lane >> 1) && y + 1 >= y1))
+					continue;
+				accumulation[pixels[lane]] += trace(rays[lane], hits[lane], surfaces[lane], pixels[lane]);
+			}
+		}
+}
+
+bool PathTracer::takeTile(uint32_t worker, uint32_t& tile) {
+	// own tiles from the front, stolen ones from the back of someone else's queue
+	{
+		std::lock_guard<std::mutex> guard(queues[worker].lock);
+		if (!queues[worker].tiles.empty())
+		{
+			tile = queues[worker].tiles.front();
+			queues[worker].tiles.pop_front();
+			return true;
+		}
+	}
+	for (uint32_t i = 1; i < queueCount; i++)
+	{
+		TileQueue& victim = queues[(worker + i) % queueCount];
+		std::lock_guard<std::mutex> guard(victim.lock);
+		if (!victim.tiles.empty())
+		{
+			tile = victim.tiles.back();
+			victim.tiles.pop_back();
+			return true;
+		}
+	}
+	return false;
+}
+
+void PathTracer::refine() {
+	const uint32_t tile_count = tilesX * tilesY;
+	for (uint32_t worker = 0; worker < queueCount; worker++)
+	{
+		queues[worker].tiles.clear();
+		for (uint32_t tile = worker * tile_count / queueCount; tile < (worker + 1) * tile_count / queueCount; tile++)
+			queues[worker].tiles.push_back(tile);
+	}
+	// one chunk per queue; a chunk the pool starts late simply finds its tiles stolen
+	pool.parallelFor(queueCount, 1, [&](size_t begin, size_t end) {
+		for (size_t worker = begin; worker < end; worker++)
+		{
+			uint32_t tile;
+			while (takeTile(static_cast<uint32_t>(worker), tile))
+				traceTile(tile);
+		}
+	});
+	samples++;
+}
+
+std::vector<glm::vec3> PathTracer::resolve() const {
+	std::vector<glm::vec3> image(accumulation.size(), glm::vec3(0.0f));
+	if (samples == 0)
+		return image;
+	const float scale = 1.0f / samples;
+	for (size_t i = 0; i < image.size(); i++)
+		image[i] = accumulation[i] * scale;
+	return image;
+}
+
+void PathTracer::writePpm(const std::string& path) const {
+	std::ofstream fout(path, std::ios::binary);
+	if (!fout)
+		throw std::exception("Failed to open the PPM file");
+	const std::vector<glm::vec3> image = resolve();
+	fout << "P6\n" << settings.width << " " << settings.height << "\n255\n";
+	std::vector<uint8_t> row(size_t(settings.width) * 3);
+	for (uint32_t y = 0; y < settings.height; y++)
+	{
+		for (uint32_t x = 0; x < settings.width; x++)
+			for (int c = 0; c < 3; c++)
+				row[x * 3 + c] = static_cast<uint8_t>(std::min(std::max(image[size_t(y) * settings.width + x][c], 0.0f), 1.0f) * 255.0f + 0.5f);
+		fout.write(reinterpret_cast<const char*>(row.data()), row.size());
+	}
+}
+
+void PathTracer::writePfm(const std::string& path) const {
+	std::ofstream fout(path, std::ios::binary);
+	if (!fout)
+		throw std::exception("Failed to open the PFM file");
+	const std::vector<glm::vec3> image = resolve();
+	// a negative scale marks little-endian floats
+	fout << "PF\n" << settings.width << " " << settings.height << "\n-1.0\n";
+	for (uint32_t y = settings.height; y-- > 0;)
+		fout.write(reinterpret_cast<const char*>(&image[size_t(y) * settings.width]), size_t(settings.width) * sizeof(glm::vec3));
+}
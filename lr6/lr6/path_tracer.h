@@ -0,0 +1,101 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <glm.hpp>
+
+#include "figure.h"
+#include "bvh.h"
+#include "frame_state.h"
+#include "thread_pool.h"
+
+struct TraceSettings {
+	uint32_t width = 800;
+	uint32_t height = 600;
+	uint32_t tileSize = 16;
+	uint32_t maxBounces = 1;    // diffuse bounces after the first hit
+	bool shadows = true;
+	glm::vec3 background = glm::vec3(0.2f); // the rasteriser's clear colour; bounce rays that escape get black
+};
+
+// Offline reference image of what Renderer rasterises: the same view, projection,
+// lights and objects, shaded with shaders_source::material, traced on the CPU. With
+// maxBounces = 0 and shadows off it reproduces the rasteriser's per-pixel lighting
+// (textures aside); shadow rays and diffuse interreflection are added on top.
+//
+// Every refine() adds one jittered sample per pixel to a float accumulation buffer,
+// so the image sharpens progressively. Pixels are traced in tiles: every worker starts
+// on its own contiguous share and steals tiles from the others once it runs dry, which
+// keeps all cores busy when the expensive tiles are bunched together. Random numbers
+// come from the pixel and the sample index alone, so the result does not depend on
+// which thread traced which tile.
+class PathTracer {
+public:
+	// every object of the scene draws mesh, as in Renderer
+	PathTracer(const Mesh& mesh, ThreadPool& pool, const TraceSettings& _settings = TraceSettings());
+
+	// lights in view space, as Renderer takes them; restarts the accumulation
+	void setScene(const SceneState& scene);
+	// one more sample per pixel
+	void refine();
+	uint32_t sampleCount() const {
+		return samples;
+	}
+
+	// the mean of the samples so far, top row first
+	std::vector<glm::vec3> resolve() const;
+	// binary PPM, clamped to [0, 1] like the window's framebuffer
+	void writePpm(const std::string& path) const;
+	// PFM: the same float values unclamped, bottom row first as the format wants
+	void writePfm(const std::string& path) const;
+
+private:
+	struct Object {
+		glm::mat4 toObject;      // inverse of view * model
+		glm::mat3 normalMatrix;
+		glm::vec3 color;
+		bool specular;
+	};
+	struct Surface {
+		glm::vec3 position; // view space
+		glm::vec3 normal;
+		uint32_t object;
+	};
+	struct alignas(64) TileQueue {
+		std::mutex lock;
+		std::deque<uint32_t> tiles;
+	};
+
+	bool intersect(const Ray& ray, Surface& surface) const;
+	void intersect4(const Ray* rays, Surface* surfaces, bool* hits) const;
+	bool occluded(const glm::vec3& position, const glm::vec3& direction, float distance) const;
+	Surface surfaceAt(const Ray& ray, const RayHit& hit, uint32_t object) const;
+	glm::vec3 shade(const Surface& surface, const glm::vec3& viewDirection) const;
+	glm::vec3 trace(const Ray& camera, bool cameraHit, const Surface& first, uint32_t pixel) const;
+	Ray cameraRay(uint32_t x, uint32_t y, uint32_t pixel) const;
+	void traceTile(uint32_t tile);
+	bool takeTile(uint32_t worker, uint32_t& tile);
+
+	ThreadPool& pool;
+	TraceSettings settings;
+	MeshBvh bvh;
+	std::vector<glm::vec3> normals;
+	std::vector<uint32_t> indexes;
+
+	std::vector<Object> objects;
+	std::vector<PointLight> lights;
+	bool lightFalloff = false; // past MaxLights lights Renderer shades clustered, with a radius falloff
+	glm::mat4 unproject;       // clip space to view space
+
+	std::vector<glm::vec3> accumulation;
+	uint32_t samples = 0;
+	uint32_t tilesX = 0;
+	uint32_t tilesY = 0;
+	std::unique_ptr<TileQueue[]> queues;
+	uint32_t queueCount = 0;
+};
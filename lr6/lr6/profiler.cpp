@@ -0,0 +1,264 @@
+#include "profiler.h"
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+
+FrameProfiler::~FrameProfiler() {
+	if (writer.joinable())
+		writer.join();
+}
+
+void FrameProfiler::init() {
+	for (auto& slot : slots)
+		glGenQueries(1, &slot.frameQuery);
+	initialized = true;
+}
+
+void FrameProfiler::release() {
+	if (!initialized)
+		return;
+	// the last Latency frames are still pending: wait for their results, oldest first,
+	// so they reach the ring and no query is deleted while the GPU may still write it
+	endFrame();
+	for (uint64_t frame = frameCounter > Latency ? frameCounter - Latency : 0; frame < frameCounter; frame++)
+		if (slots[frame % Latency].used)
+			collect(slots[frame % Latency], true);
+	flush(true);
+	for (auto& slot : slots)
+	{
+		glDeleteQueries(1, &slot.frameQuery);
+		if (!slot.queries.empty())
+			glDeleteQueries(slot.queries.size(), slot.queries.data());
+		slot = PendingFrame();
+	}
+	initialized = false;
+}
+
+uint32_t FrameProfiler::takeQuery(PendingFrame& slot) {
+	if (slot.nextQuery == slot.queries.size())
+	{
+		uint32_t query;
+		glGenQueries(1, &query);
+		slot.queries.push_back(query);
+	}
+	return slot.queries[slot.nextQuery++];
+}
+
+void FrameProfiler::beginFrame() {
+	if (!enabled || !initialized)
+		return;
+
+	PendingFrame& slot = slots[frameCounter % Latency];
+	if (slot.used)
+		collect(slot, false);
+
+	slot.used = true;
+	slot.frame = frameCounter;
+	slot.stages.clear();
+	slot.nextQuery = 0;
+	slot.cpuBegin = Clock::now();
+	openStages.clear();
+	glBeginQuery(GL_TIME_ELAPSED, slot.frameQuery);
+	inFrame = true;
+}
+
+void FrameProfiler::endFrame() {
+	if (!inFrame)
+		return;
+
+	PendingFrame& slot = slots[frameCounter % Latency];
+	while (!openStages.empty())
+		endStage();
+	glEndQuery(GL_TIME_ELAPSED);
+	slot.cpuMs = std::chrono::duration<double, std::milli>(Clock::now() - slot.cpuBegin).count();
+
+	inFrame = false;
+	frameCounter++;
+}
+
+void FrameProfiler::beginStage(const char* name) {
+	if (!inFrame)
+		return;
+
+	PendingFrame& slot = slots[frameCounter % Latency];
+	PendingStage stage;
+	stage.name = name;
+	stage.queryBegin = takeQuery(slot);
+	stage.queryEnd = takeQuery(slot);
+	glQueryCounter(stage.queryBegin, GL_TIMESTAMP);
+	stage.cpuBegin = Clock::now();
+	stage.cpuMs = 0.0;
+
+	openStages.push_back(slot.stages.size());
+	slot.stages.push_back(stage);
+}
+
+void FrameProfiler::endStage() {
+	if (!inFrame || openStages.empty())
+		return;
+
+	PendingStage& stage = slots[frameCounter % Latency].stages[openStages.back()];
+	openStages.pop_back();
+	stage.cpuMs = std::chrono::duration<double, std::milli>(Clock::now() - stage.cpuBegin).count();
+	glQueryCounter(stage.queryEnd, GL_TIMESTAMP);
+}
+
+void FrameProfiler::collect(PendingFrame& slot, bool wait) {
+	auto available = [wait](uint32_t query) {
+		if (wait)
+			return true; // GL_QUERY_RESULT blocks until the result is there
+		GLint ready = 0;
+		glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &ready);
+		return ready != 0;
+	};
+
+	FrameSample sample;
+	sample.frame = slot.frame;
+	sample.cpuMs = slot.cpuMs;
+	if (available(slot.frameQuery))
+	{
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(slot.frameQuery, GL_QUERY_RESULT, &elapsed);
+		sample.gpuMs = elapsed / 1e6;
+	}
+
+	for (const auto& stage : slot.stages)
+	{
+		StageSample stage_sample;
+		stage_sample.name = stage.name;
+		stage_sample.cpuMs = stage.cpuMs;
+		if (available(stage.queryBegin) && available(stage.queryEnd))
+		{
+			GLuint64 begin = 0, end = 0;
+			glGetQueryObjectui64v(stage.queryBegin, GL_QUERY_RESULT, &begin);
+			glGetQueryObjectui64v(stage.queryEnd, GL_QUERY_RESULT, &end);
+			stage_sample.gpuMs = (end - begin) / 1e6;
+		}
+		sample.stages.push_back(stage_sample);
+	}
+	slot.used = false;
+
+	ring.push_back(std::move(sample));
+	while (ring.size() > ringCapacity)
+		ring.pop_front();
+
+	if (!outputPath.empty() && ++framesSinceFlush >= ringCapacity)
+		flush(false);
+}
+
+void FrameProfiler::setOutput(const std::string& path, size_t ringFrames) {
+	outputPath = path;
+	ringCapacity = ringFrames > 0 ? ringFrames : 1;
+	while (ring.size() > ringCapacity)
+		ring.pop_front();
+}
+
+void FrameProfiler::flush(bool wait) {
+	framesSinceFlush = 0;
+	if (outputPath.empty())
+		return;
+	if (writer.joinable())
+		writer.join();
+
+	// the file is rewritten with the current ring, off the render thread
+	std::vector<FrameSample> frames(ring.begin(), ring.end());
+	std::string path = outputPath;
+	writer = std::thread([path, frames]() { writeFile(path, frames); });
+	if (wait)
+		writer.join();
+}
+
+void FrameProfiler::writeFile(const std::string& path, const std::vector<FrameSample>& frames) {
+	std::ofstream fout(path);
+	fout << std::fixed << std::setprecision(4);
+
+	const bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+	if (json)
+	{
+		fout << "[\n";
+		for (size_t i = 0; i < frames.size(); i++)
+		{
+			const auto& frame = frames[i];
+			fout << "\t{\"frame\": " << frame.frame << ", \"cpu_ms\": " << frame.cpuMs << ", \"gpu_ms\": " << frame.gpuMs << ", \"stages\": [";
+			for (size_t j = 0; j < frame.stages.size(); j++)
+			{
+				const auto& stage = frame.stages[j];
+				fout << (j ? ", " : "") << "{\"name\": \"" << stage.name << "\", \"cpu_ms\": " << stage.cpuMs << ", \"gpu_ms\": " << stage.gpuMs << "}";
+			}
+			fout << "]}" << (i + 1 < frames.size() ? "," : "") << "\n";
+		}
+		fout << "]\n";
+	}
+	else
+	{
+		fout << "frame,stage,cpu_ms,gpu_ms\n";
+		for (const auto& frame : frames)
+		{
+			fout << frame.frame << ",frame," << frame.cpuMs << "," << frame.gpuMs << "\n";
+			for (const auto& stage : frame.stages)
+				fout << frame.frame << "," << stage.name << "," << stage.cpuMs << "," << stage.gpuMs << "\n";
+		}
+	}
+}
+
+std::string FrameProfiler::summary(size_t frames) const {
+	struct Total {
+		std::string name;
+		double cpu = 0.0;
+		double gpu = 0.0;
+		size_t gpuCount = 0;
+	};
+	std::vector<Total> totals;
+	Total frame_total;
+	size_t count = 0;
+
+	for (auto it = ring.rbegin(); it != ring.rend() && count < frames; ++it, count++)
+	{
+		frame_total.cpu += it->cpuMs;
+		if (it->gpuMs >= 0.0)
+		{
+			frame_total.gpu += it->gpuMs;
+			frame_total.gpuCount++;
+		}
+		for (const auto& stage : it->stages)
+		{
+			auto total = totals.begin();
+			while (total != totals.end() && total->name != stage.name)
+				++total;
+			if (total == totals.end())
+			{
+				totals.push_back(Total());
+				totals.back().name = stage.name;
+				total = totals.end() - 1;
+			}
+			total->cpu += stage.cpuMs;
+			if (stage.gpuMs >= 0.0)
+			{
+				total->gpu += stage.gpuMs;
+				total->gpuCount++;
+			}
+		}
+	}
+	if (count == 0)
+		return std::string();
+
+	std::ostringstream out;
+	out << std::fixed << std::setprecision(2);
+	auto print = [&](const Total& total) {
+		out << total.name << " " << total.cpu / count << "/";
+		if (total.gpuCount)
+			out << total.gpu / total.gpuCount;
+		else
+			out << "-";
+	};
+	frame_total.name = "frame";
+	print(frame_total);
+	for (const auto& total : totals)
+	{
+		out << " | ";
+		print(total);
+	}
+	out << " ms (cpu/gpu)";
+	return out.str();
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <chrono>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+struct StageSample {
+	std::string name;
+	double cpuMs = 0.0;
+	double gpuMs = -1.0; // < 0 when the GPU result was not ready in time
+};
+
+struct FrameSample {
+	uint64_t frame = 0;
+	double cpuMs = 0.0;
+	double gpuMs = -1.0;
+	std::vector<StageSample> stages;
+};
+
+// Named CPU scopes plus GL_TIMESTAMP query pairs per stage and a GL_TIME_ELAPSED
+// query per frame. Queries are read back Latency frames later and only if they are
+// already available, so profiling never waits on the GPU.
+class FrameProfiler {
+public:
+	static const uint32_t Latency = 4;
+
+	class Scope {
+	public:
+		Scope(FrameProfiler& _profiler, const char* name) : profiler(_profiler) {
+			profiler.beginStage(name);
+		}
+		~Scope() {
+			profiler.endStage();
+		}
+	private:
+		FrameProfiler& profiler;
+	};
+
+	~FrameProfiler();
+
+	// GL thread, after the context is current / before it is destroyed
+	void init();
+	void release();
+
+	void beginFrame();
+	void endFrame();
+	void beginStage(const char* name);
+	void endStage();
+
+	// keeps the last ringFrames frames on disk; ".json" selects JSON, anything else CSV
+	void setOutput(const std::string& path, size_t ringFrames);
+
+	const std::deque<FrameSample>& history() const {
+		return ring;
+	}
+	// averages over the last frames, one line for the window-title overlay
+	std::string summary(size_t frames = 60) const;
+
+	bool enabled = true;
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct PendingStage {
+		const char* name;
+		Clock::time_point cpuBegin;
+		double cpuMs;
+		uint32_t queryBegin;
+		uint32_t queryEnd;
+	};
+	struct PendingFrame {
+		bool used = false;
+		uint64_t frame = 0;
+		Clock::time_point cpuBegin;
+		double cpuMs = 0.0;
+		uint32_t frameQuery = 0;
+		std::vector<PendingStage> stages;
+		std::vector<uint32_t> queries;
+		size_t nextQuery = 0;
+	};
+
+	uint32_t takeQuery(PendingFrame& slot);
+	// wait: block on results that are not available yet instead of dropping them
+	void collect(PendingFrame& slot, bool wait);
+	void flush(bool wait);
+	static void writeFile(const std::string& path, const std::vector<FrameSample>& frames);
+
+	bool initialized = false;
+	bool inFrame = false;
+	uint64_t frameCounter = 0;
+	PendingFrame slots[Latency];
+	std::vector<size_t> openStages;
+
+	std::deque<FrameSample> ring;
+	size_t ringCapacity = 600;
+	size_t framesSinceFlush = 0;
+	std::string outputPath;
+	std::thread writer;
+};
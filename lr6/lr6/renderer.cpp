@@ -1,17 +1,59 @@
 #include "renderer.h"
 
+#include <chrono>
+#include <thread>
+#include <utility>
+
 Renderer::Renderer(size_t w, size_t h, const std::shared_ptr<Mesh>& _model) :
-	model(_model),
 	width_w(w),
 	height_w(h)
 {
+	// imported meshes arrive in whatever order they were written; reorder a copy for the vertex cache
+	GpuMesh lod;
+	lod.mesh = std::make_shared<CacheOptimizedMesh>(*_model);
+	lod.edgeLength = IcosphereLodChain::averageEdgeLength(*_model);
+	lods.push_back(lod);
+
+	initWindow();
+}
+
+Renderer::Renderer(size_t w, size_t h, const std::shared_ptr<IcosphereLodChain>& lodChain) :
+	width_w(w),
+	height_w(h)
+{
+	for (uint32_t level = 0; level < lodChain->levelCount(); level++)
+	{
+		GpuMesh lod;
+		lod.mesh = lodChain->level(level);
+		lod.edgeLength = lodChain->edgeLength(level);
+		lods.push_back(lod);
+	}
+
+	initWindow();
+}
+
+Renderer::Renderer(size_t w, size_t h, uint32_t maxLevel) :
+	width_w(w),
+	height_w(h),
+	loadLevels(maxLevel)
+{
+	// the placeholder: 12 vertices, generated instantly
+	GpuMesh lod;
+	lod.mesh = std::make_shared<Icosaedr>();
+	lod.edgeLength = IcosphereLodChain::averageEdgeLength(*lod.mesh);
+	lods.push_back(lod);
+
+	initWindow();
+}
+
+void Renderer::initWindow() {
 	glfwInit();
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 	glfwWindowHint(GLFW_SAMPLES, 4);
 
-	window = glfwCreateWindow(w, h, "LR 6", NULL, NULL);
+	window = glfwCreateWindow(width_w, height_w, "LR 6", NULL, NULL);
 	if (window == NULL)
 	{
 		glfwTerminate();
@@ -19,6 +61,10 @@ Renderer::Renderer(size_t w, size_t h, const std::shared_ptr<Mesh>& _model) :
 	}
 	glfwMakeContextCurrent(window);
 	glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+	glfwSetWindowUserPointer(window, this);
+	glfwSetKeyCallback(window, key_callback);
+	glfwSetMouseButtonCallback(window, mouse_button_callback);
+	glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
 
 	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
 		throw std::exception("Failed to initialize GLAD");
@@ -26,67 +72,673 @@ Renderer::Renderer(size_t w, size_t h, const std::shared_ptr<Mesh>& _model) :
 
 }
 
-void Renderer::prerender() {
-	glGenVertexArrays(1, &handles.VAO);
-	glGenBuffers(1, &handles.EBO);
-	glGenBuffers(1, &handles.VBO_normals);
-	glGenBuffers(1, &handles.VBO_vertex);
+namespace {
+	template<uint32_t Features>
+	ShaderProgramSource makeVariant() {
+		typedef shaders_source::ShaderVariant<Features> Variant;
+		ShaderProgramSource source;
+		source.vertex = shaders_source::vertex_shader;
+		source.fragment = shaders_source::fragment_shader;
+		if (Features & shaders_source::FeatureBufferless)
+			source.vertex = shaders_source::withGridFunctions(shaders_source::bufferless_vertex_shader);
+		else if (Features & shaders_source::FeatureTessellation)
+		{
+			source.vertex = shaders_source::tess_vertex_shader;
+			source.tessControl = shaders_source::tess_control_shader;
+			source.tessEvaluation = shaders_source::tess_evaluation_shader;
+		}
+		source.defines.assign(Variant::defines.text, Variant::defines.length);
+		return source;
+	}
 
-	glBindVertexArray(handles.VAO);
+	template<uint32_t... Features>
+	std::vector<ShaderProgramSource> makeVariants(std::integer_sequence<uint32_t, Features...>) {
+		return { makeVariant<Features>()... };
+	}
+}
 
-	glBindBuffer(GL_ARRAY_BUFFER, handles.VBO_vertex);
+// index in the result == feature mask
+std::vector<ShaderProgramSource> Renderer::shaderVariants() {
+	return makeVariants(std::make_integer_sequence<uint32_t, shaders_source::VariantCount>());
+}
 
-	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * model->getVertices().size(), model->getVertices().data(), GL_STATIC_DRAW);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
+void Renderer::setLightUniforms(const FrameState& frame, uint32_t program, uint32_t variant) const {
+	const auto& lights = frame.lights;
+	if (variant & shaders_source::FeatureClustered)
+		lightClusters.setUniforms(program, static_cast<float>(framebufferWidth), static_cast<float>(framebufferHeight));
+	else if (variant & shaders_source::FeatureMultiLight)
+	{
+		const size_t count = std::min<size_t>(lights.size(), shaders_source::MaxLights);
+		std::vector<glm::vec3> positions, colors;
+		for (size_t i = 0; i < count; i++)
+		{
+			positions.push_back(lights[i].position);
+			colors.push_back(lights[i].color);
+		}
+		glUniform1i(glGetUniformLocation(program, "lightCount"), static_cast<int32_t>(count));
+		glUniform3fv(glGetUniformLocation(program, "lightPositions"), count, glm::value_ptr(positions[0]));
+		glUniform3fv(glGetUniformLocation(program, "lightColors"), count, glm::value_ptr(colors[0]));
+	}
+	else
+	{
+		glUniform3fv(glGetUniformLocation(program, "lightPos"), 1, glm::value_ptr(lights[0].position));
+		glUniform3fv(glGetUniformLocation(program, "lightColor"), 1, glm::value_ptr(lights[0].color));
+	}
+}
 
-	glBindBuffer(GL_ARRAY_BUFFER, handles.VBO_normals);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * model->getNormals().size(), model->getNormals().data(), GL_STATIC_DRAW);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(1);
+void Renderer::setGeometryUniforms(uint32_t program, uint32_t variant) const {
+	if (variant & shaders_source::FeatureTessellation)
+	{
+		glUniform1f(glGetUniformLocation(program, "pixelsPerUnit"), LodSelector::pixelsPerUnit(1.0f, fieldOfView, static_cast<float>(height_w)));
+		glUniform1f(glGetUniformLocation(program, "targetEdgePixels"), lodSelector.targetEdgePixels);
+		glUniform1f(glGetUniformLocation(program, "maxTessLevel"), maxTessLevel);
+		glUniform1f(glGetUniformLocation(program, "nearPlane"), nearPlane);
+	}
+	if (variant & (shaders_source::FeatureTessellation | shaders_source::FeatureBufferless))
+		glUniform1f(glGetUniformLocation(program, "sphereRadius"), sphereRadius);
+}
 
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+namespace {
+	// positions and indexes read back from the GPU, all a MeshBvh needs
+	class PickGeometry : public Mesh {
+	public:
+		std::vector<glm::vec3> vertex;
+		std::vector<uint32_t> index;
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, handles.EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(size_t) * model->getIndexes().size(), model->getIndexes().data(), GL_STATIC_DRAW);
-	countElements = model->getIndexes().size();
+		const std::vector<glm::vec3>& getVertices() const override {
+			return vertex;
+		}
+		const std::vector<glm::vec3>& getNormals() const override {
+			return none;
+		}
+		const std::vector<uint32_t>& getIndexes() const override {
+			return index;
+		}
+		const std::vector<glm::vec3>& getFaceNormals() const override {
+			return none;
+		}
 
-	glBindVertexArray(0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	private:
+		std::vector<glm::vec3> none;
+	};
+}
 
-	modelMatrix = glm::mat4(1.0f);
-	viewMatrix = glm::lookAt(glm::vec3(0.f, 0.f, -5.f), glm::vec3(0.f, 0.f, 0.f), glm::vec3(0.f, 1.f, 0.f));
-	projectionMatrix = glm::perspective(glm::radians(45.0f), static_cast<float>(width_w)/ height_w, 2.0f, 50.0f);
-	
+const IcosphereGrid& Renderer::pickGrid(uint32_t level) {
+	auto& grid = pickGrids[level];
+	if (!grid)
+		grid = std::make_unique<IcosphereGrid>(level);
+	return *grid;
+}
 
-	uint32_t VertexShader = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(VertexShader, 1, &shaders_source::vertex_shader, NULL);
-	glCompileShader(VertexShader);
+const MeshBvh& Renderer::pickBvh(const Mesh& mesh) {
+	auto& bvh = pickBvhs[&mesh];
+	if (!bvh)
+		bvh = std::make_unique<MeshBvh>(mesh, threadPool);
+	return *bvh;
+}
 
-	if (getShaderErrors(VertexShader))
-		throw std::exception("shader compile error");
+RayHit Renderer::pickObject(const FrameState& frame, uint32_t object, const Ray& ray, std::unique_ptr<MeshBvh>& dynamicBvh) {
+	const uint32_t slot = drawSlot(frame, object);
+	if (slot == DynamicSlot)
+	{
+		// read back once per pick, whichever object needs it first
+		if (!dynamicBvh)
+		{
+			PickGeometry streamed;
+			dynamicMesh->readBack(streamed.vertex, streamed.index);
+			dynamicBvh = std::make_unique<MeshBvh>(streamed, threadPool);
+		}
+		return dynamicBvh->closestHit(ray);
+	}
+	if (slot == TessSlot)
+	{
+		// the evaluation shader puts every vertex on the sphere; the tessellator's triangles
+		// have no ids, so the patch (base face) under the hit stands for them
+		RayHit hit;
+		const float a = glm::dot(ray.direction, ray.direction);
+		const float b = glm::dot(ray.origin, ray.direction);
+		const float c = glm::dot(ray.origin, ray.origin) - sphereRadius * sphereRadius;
+		const float discriminant = b * b - a * c;
+		if (discriminant < 0.0f)
+			return hit;
+		float t = (-b - glm::sqrt(discriminant)) / a;
+		if (t < ray.tMin)
+			t = (-b + glm::sqrt(discriminant)) / a;
+		if (t < ray.tMin || t > ray.tMax)
+			return hit;
+		Ray from_center;
+		from_center.direction = ray.origin + ray.direction * t;
+		hit.triangle = pickBvh(pickGrid(0)).closestHit(from_center).triangle;
+		hit.t = t;
+		return hit;
+	}
+	// patched and adaptive spheres change every frame, so their trees are not kept
+	if (slot == PatchSlot)
+		return object < patchedSpheres.size() && patchedSpheres[object]
+			? MeshBvh(patchedSpheres[object]->mesh, threadPool).closestHit(ray) : RayHit();
+	if (slot == AdaptiveSlot)
+		return object < adaptiveSpheres.size() && adaptiveSpheres[object]
+			? MeshBvh(adaptiveSpheres[object]->drawn(), threadPool).closestHit(ray) : RayHit();
+	// the bufferless shader and the compute-generated levels share IcosphereGrid's layout
+	if (slot == BufferlessSlot)
+		return pickBvh(pickGrid(lodLevels[object])).closestHit(ray);
+	const GpuMesh& lod = lods[slot];
+	const Mesh& mesh = lod.mesh ? *lod.mesh : static_cast<const Mesh&>(pickGrid(slot));
+	return pickBvh(mesh).closestHit(ray);
+}
 
-	uint32_t FragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(FragmentShader, 1, &shaders_source::fragment_shader, NULL);
-	glCompileShader(FragmentShader);
+Renderer::Pick Renderer::pick(double x, double y) {
+	Pick result;
+	const FrameState& frame = frames.front();
+	// lodLevels is sized by the render pass that drew the frame
+	if (frame.objects.empty() || lodLevels.size() < frame.objects.size())
+		return result;
 
-	if (getShaderErrors(FragmentShader))
-		throw std::exception("shader compile error");
+	// the segment from the near to the far plane through the pixel
+	int width, height;
+	glfwGetWindowSize(window, &width, &height);
+	const float ndc_x = 2.0f * static_cast<float>(x) / width - 1.0f;
+	const float ndc_y = 1.0f - 2.0f * static_cast<float>(y) / height;
+	const glm::mat4 unproject = glm::inverse(frame.projectionMatrix * frame.viewMatrix);
+	glm::vec4 near_point = unproject * glm::vec4(ndc_x, ndc_y, -1.0f, 1.0f);
+	glm::vec4 far_point = unproject * glm::vec4(ndc_x, ndc_y, 1.0f, 1.0f);
+	near_point /= near_point.w;
+	far_point /= far_point.w;
 
-	handles.ShaderProgram = glCreateProgram();
-	glAttachShader(handles.ShaderProgram, VertexShader);
-	glAttachShader(handles.ShaderProgram, FragmentShader);
-	glLinkProgram(handles.ShaderProgram);
+	// the direction is not normalized, so t runs from 0 to 1 along the segment in every
+	// object's space and the nearest hit can be kept across objects
+	std::unique_ptr<MeshBvh> dynamic_bvh;
+	float nearest = 1.0f;
+	for (uint32_t i = 0; i < frame.objects.size(); i++)
+	{
+		const glm::mat4 to_object = glm::inverse(frame.objects[i].modelMatrix);
+		Ray ray;
+		ray.origin = glm::vec3(to_object * near_point);
+		ray.direction = glm::vec3(to_object * (far_point - near_point));
+		ray.tMax = nearest;
+		const RayHit hit = pickObject(frame, i, ray, dynamic_bvh);
+		if (!hit.hit())
+			continue;
+		nearest = hit.t;
+		result.object = i;
+		result.triangle = hit.triangle;
+	}
+	result.position = glm::vec3(near_point + (far_point - near_point) * nearest);
+	return result;
+}
 
-	if (getShaderProgramLinkError(handles.ShaderProgram))
-		throw std::exception("shader program link error");
+void Renderer::prerender() {
+	for (auto& lod : lods)
+	{
+		MeshUploader::upload(*lod.mesh, lod.handles, VertexFormat::choose(*lod.mesh));
+		lod.patches = lod.mesh->getPatches();
+		lod.bounds = BoundsBuilder::compute(*lod.mesh);
+	}
+	// the loader is started first so generation overlaps shader compilation
+	if (loadLevels >= lods.size())
+	{
+		if (gpuGeneration && GLAD_GL_VERSION_4_3)
+			generateLevelsOnGpu();
+		else
+			loader = std::make_unique<AsyncLodLoader>(window, static_cast<uint32_t>(lods.size()), loadLevels);
+	}
 
-	glDeleteShader(VertexShader);
-	glDeleteShader(FragmentShader);
+	if (scene.objects.empty())
+		addObject(glm::mat4(1.0f));
+	scene.viewMatrix = glm::lookAt(glm::vec3(0.f, 0.f, -5.f), glm::vec3(0.f, 0.f, 0.f), glm::vec3(0.f, 1.f, 0.f));
+	scene.projectionMatrix = glm::perspective(fieldOfView, static_cast<float>(width_w)/ height_w, nearPlane, farPlane);
+	
+
+	// every variant is compiled (or loaded from the binary cache) up front on worker contexts;
+	// the ones needing SSBOs or tessellation are left out on older contexts
+	clusteredShading = GLAD_GL_VERSION_4_3 != 0;
+	tessellationSupported = GLAD_GL_VERSION_4_0 != 0;
+	multiDrawIndirect = GLAD_GL_VERSION_4_3 != 0;
+	// the arena variants read their matrices from an SSBO in the vertex stage, which GL 4.3 does not require
+	GLint vertex_storage_blocks = 0;
+	if (multiDrawIndirect)
+		glGetIntegerv(GL_MAX_VERTEX_SHADER_STORAGE_BLOCKS, &vertex_storage_blocks);
+	arenaSupported = vertex_storage_blocks > 0;
+	std::vector<ShaderProgramSource> variants = shaderVariants();
+	std::vector<ShaderProgramSource> supported;
+	for (uint32_t variant = 0; variant < variants.size(); variant++)
+		if (variantSupported(variant))
+			supported.push_back(variants[variant]);
+	shaderCache.precompile(window, supported, std::thread::hardware_concurrency());
+	for (uint32_t variant = 0; variant < variants.size(); variant++)
+		if (variantSupported(variant))
+			programs[variant] = shaderCache.getProgram(variants[variant]);
+
+	IcosphereGrid base(0);
+	sphereBounds = BoundsBuilder::compute(base);
+	sphereBounds.patches.clear();
+	sphereRadius = base.getRadius();
+	faceCaps = BoundsBuilder::sphereCaps(base.getCorners(), sphereRadius);
+	terrainCaps = BoundsBuilder::sphereCaps(base.getCorners(), sphereRadius * (1.0f + TerrainSettings().amplitude));
+	baseEdgeLength = IcosphereLodChain::averageEdgeLength(base);
+
+	std::vector<glm::vec4> face_corners;
+	for (const auto& corner : base.getCorners())
+		face_corners.push_back(glm::vec4(corner, 1.0f));
+	glGenBuffers(1, &baseFacesUBO);
+	glBindBuffer(GL_UNIFORM_BUFFER, baseFacesUBO);
+	glBufferData(GL_UNIFORM_BUFFER, face_corners.size() * sizeof(glm::vec4), face_corners.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, 0, baseFacesUBO);
+	glGenVertexArrays(1, &emptyVAO);
+
+	const uint32_t white = 0xffffffff;
+	glGenTextures(1, &whiteTexture);
+	glBindTexture(GL_TEXTURE_2D, whiteTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, &white);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	if (multiDrawIndirect)
+		glGenBuffers(1, &indirectBuffer);
+	if (arenaSupported)
+	{
+		arena.init();
+		glGenBuffers(1, &arenaDrawBuffer);
+		glGenBuffers(1, &arenaCommandBuffer);
+	}
+
+	if (tessellationSupported)
+	{
+		MeshUploader::upload(base, tessMesh, VertexFormat::separate());
+		GLint max_level = 64;
+		glGetIntegerv(GL_MAX_TESS_GEN_LEVEL, &max_level);
+		maxTessLevel = static_cast<float>(max_level);
+		glPatchParameteri(GL_PATCH_VERTICES, 3);
+	}
 
-	glUseProgram(handles.ShaderProgram);
 	glEnable(GL_DEPTH_TEST);
 	glEnable(GL_CULL_FACE);
-	glUseProgram(0);
+}
+
+void Renderer::pollLoader() {
+	// new levels only extend the vector, so the lodLevel of every object stays valid
+	loader->poll(lods);
+	if (loader->finished())
+	{
+		loader->release();
+		loader.reset();
+	}
+}
+
+void Renderer::generateLevelsOnGpu() {
+	ShaderProgramSource source;
+	source.compute = shaders_source::withGridFunctions(shaders_source::icosphere_compute_shader);
+	GpuIcosphereGenerator generator(shaderCache.getProgram(source));
+
+	for (uint32_t level = static_cast<uint32_t>(lods.size()); level <= loadLevels; level++)
+	{
+		GpuMesh lod = generator.generate(level);
+		if (validateGpuMeshes)
+		{
+			Icosaedr reference;
+			reference.increaseApproximation(level);
+			MeshDifference diff = GpuIcosphereGenerator::validate(lod.handles, reference);
+			std::cout << "GPU level " << level << ": " << diff.vertices << "/" << diff.referenceVertices << " vertices, "
+				<< diff.unmatchedVertices << " unmatched, " << diff.missingTriangles << " missing / "
+				<< diff.extraTriangles << " extra triangles, max error " << diff.maxPositionError
+				<< ", max normal angle " << diff.maxNormalAngle << (diff.identical() ? " [OK]" : " [MISMATCH]") << std::endl;
+		}
+		lods.push_back(lod);
+	}
+}
+
+void Renderer::selectLods(const FrameState& frame) {
+	const auto& bounds = lods[0].bounds.sphere;
+	lodLevels.resize(frame.objects.size(), 0);
+
+	for (uint32_t i = 0; i < frame.objects.size(); i++)
+	{
+		BoundingSphere world = bounds.transformed(frame.objects[i].modelMatrix);
+		float scale = world.radius / glm::max(bounds.radius, 1e-6f);
+
+		// nearest point of the object decides how large its triangles get on screen
+		float distance = glm::max(glm::distance(frame.cameraPosition, world.center) - world.radius, nearPlane);
+		float pixels_per_unit = LodSelector::pixelsPerUnit(distance, fieldOfView, static_cast<float>(height_w));
+
+		// bufferless levels need no resident mesh, each one halves the base edge
+		if (bufferless && !frame.objects[i].dynamic)
+			lodLevels[i] = lodSelector.select(lodLevels[i], MaxBufferlessLevel + 1, pixels_per_unit,
+				[&](uint32_t level) { return baseEdgeLength / float(1u << level) * scale; });
+		else
+			lodLevels[i] = lodSelector.select(lodLevels[i], lods.size(), pixels_per_unit,
+				[&](uint32_t level) { return lods[level].edgeLength * scale; });
+	}
+}
 
-}
\ No newline at end of file
+void Renderer::cullObjects(const FrameState& frame, const Frustum& frustum) {
+	cullBatch.clear();
+	for (uint32_t i = 0; i < frame.objects.size(); i++)
+	{
+		const uint32_t slot = drawSlot(frame, i);
+		const MeshBounds& bounds = slot == DynamicSlot ? dynamicMesh->getBounds() : (slot == AdaptiveSlot && adaptiveTerrain) ? terrainCaps
+			: (slot == TessSlot || slot == BufferlessSlot || slot == PatchSlot || slot == AdaptiveSlot) ? sphereBounds : lods[lodLevels[i]].bounds;
+		cullBatch.push(bounds.sphere.transformed(frame.objects[i].modelMatrix));
+	}
+	frustum.testSpheres(cullBatch, cullVisible);
+
+	visibleObjects.clear();
+	for (uint32_t i = 0; i < cullVisible.size(); i++)
+		if (cullVisible[i])
+			visibleObjects.push_back(i);
+
+	// batch by shader variant, then by level so each program and VAO is bound once
+	auto batch_key = [&](uint32_t i) {
+		return (uint64_t(drawVariant(frame, i)) << 32) | drawSlot(frame, i);
+	};
+	std::stable_sort(visibleObjects.begin(), visibleObjects.end(), [&](uint32_t a, uint32_t b) {
+		return batch_key(a) < batch_key(b);
+	});
+}
+
+void Renderer::appendPatchCommands(const ObjectState& object, const GpuMesh& lod, const Frustum& frustum, const glm::vec3& cameraPosition) {
+	const auto& patches = lod.patches;
+	if (patches.empty())
+	{
+		indirectCommands.push_back({ static_cast<uint32_t>(lod.handles.countElements), 1, 0, 0, 0 });
+		return;
+	}
+
+	cullBatch.clear();
+	for (const auto& patch_sphere : lod.bounds.patches)
+		cullBatch.push(patch_sphere.transformed(object.modelMatrix));
+	frustum.testSpheres(cullBatch, cullVisible);
+
+	const auto& cones = lod.bounds.cones;
+	if (coneCulling && cones.size() == patches.size())
+	{
+		// cones and patch spheres are in mesh space, so the camera is brought there
+		const glm::vec3 camera = glm::vec3(glm::inverse(object.modelMatrix) * glm::vec4(cameraPosition, 1.0f));
+		for (uint32_t i = 0; i < patches.size(); i++)
+			if (cullVisible[i] && cones[i].backfacing(lod.bounds.patches[i], camera))
+				cullVisible[i] = 0;
+	}
+
+	// neighbouring visible patches are merged into one command
+	for (uint32_t i = 0; i < patches.size(); )
+	{
+		if (!cullVisible[i])
+		{
+			i++;
+			continue;
+		}
+		uint32_t first = patches[i].firstIndex;
+		uint32_t count = 0;
+		for (; i < patches.size() && cullVisible[i] && patches[i].firstIndex == first + count; i++)
+			count += patches[i].countIndexes;
+		indirectCommands.push_back({ count, 1, first, 0, 0 });
+	}
+}
+
+void Renderer::drawObject(const ObjectState& object, const GpuMesh& lod, const Frustum& frustum, const glm::vec3& cameraPosition) {
+	const MeshDeviceHandles& handles = lod.handles;
+	indirectCommands.clear();
+	appendPatchCommands(object, lod, frustum, cameraPosition);
+	if (indirectCommands.empty())
+		return;
+
+	if (multiDrawIndirect && indirectCommands.size() > 1)
+	{
+		submitIndirect(handles.indexType);
+		return;
+	}
+	const uint32_t index_size = handles.format.indexSize();
+	for (const auto& command : indirectCommands)
+		glDrawElements(GL_TRIANGLES, command.count, handles.indexType, (void*)(uintptr_t)(command.firstIndex * index_size));
+}
+
+void Renderer::prepareArenaDraws(const FrameState& frame, const Frustum& frustum) {
+	// levels that arrived since the last frame are copied in first
+	while (arenaRanges.size() < lods.size())
+		arenaRanges.push_back(arena.add(lods[arenaRanges.size()]));
+
+	indirectCommands.clear();
+	arenaDraws.clear();
+	arenaBatches.clear();
+	for (uint32_t object_index : visibleObjects)
+	{
+		const uint32_t variant = drawVariant(frame, object_index);
+		if (!(variant & shaders_source::FeatureIndirect))
+			continue;
+		const uint32_t slot = drawSlot(frame, object_index);
+		const ObjectState& object = frame.objects[object_index];
+		const ArenaRange& range = arenaRanges[slot];
+
+		const size_t first = indirectCommands.size();
+		appendPatchCommands(object, lods[slot], frustum, frame.cameraPosition);
+		if (indirectCommands.size() == first)
+			continue;
+
+		const uint32_t draw = static_cast<uint32_t>(arenaDraws.size());
+		arenaDraws.push_back({ object.PVM, object.VM, glm::mat4(object.normalMatrix), glm::vec4(object.color, 1.0f) });
+		for (size_t i = first; i < indirectCommands.size(); i++)
+		{
+			indirectCommands[i].firstIndex += range.firstIndex;
+			indirectCommands[i].baseVertex = range.baseVertex;
+			indirectCommands[i].baseInstance = draw;
+		}
+
+		// visibleObjects is sorted by variant, so every variant is one contiguous batch
+		if (arenaBatches.empty() || arenaBatches.back().variant != variant)
+			arenaBatches.push_back({ variant, first, 0 });
+		arenaBatches.back().count += indirectCommands.size() - first;
+	}
+	if (arenaDraws.empty())
+		return;
+
+	arena.reserveDraws(static_cast<uint32_t>(arenaDraws.size()));
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, arenaDrawBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, arenaDraws.size() * sizeof(ArenaDraw), arenaDraws.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, arenaDrawBuffer);
+
+	// a buffer of its own: the per-object stream may orphan its buffer before these are drawn
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, arenaCommandBuffer);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, indirectCommands.size() * sizeof(DrawElementsIndirectCommand), indirectCommands.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void Renderer::drawArenaBatch(uint32_t variant) {
+	for (const auto& batch : arenaBatches)
+		if (batch.variant == variant)
+		{
+			glBindVertexArray(arena.getVAO());
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, arenaCommandBuffer);
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(uintptr_t)(batch.first * sizeof(DrawElementsIndirectCommand)),
+				static_cast<GLsizei>(batch.count), 0);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+			return;
+		}
+}
+
+void Renderer::drawPatched(uint32_t objectIndex, const ObjectState& object, const Frustum& frustum, const glm::vec3& cameraPosition) {
+	if (patchedSpheres.size() <= objectIndex)
+		patchedSpheres.resize(objectIndex + 1);
+	auto& sphere = patchedSpheres[objectIndex];
+	if (!sphere)
+	{
+		sphere = std::make_unique<PatchedSphere>(MaxPatchLevel);
+		PatchUploader::createSlots(sphere->mesh, sphere->handles);
+	}
+	PatchedIcosphere& mesh = sphere->mesh;
+	const auto& patches = mesh.getPatchInfo();
+
+	// every patch picks its level from its own cap, the way selectLods does for whole objects
+	const float scale = glm::length(glm::vec3(object.modelMatrix[0]));
+	const glm::vec3 camera = glm::vec3(glm::inverse(object.modelMatrix) * glm::vec4(cameraPosition, 1.0f));
+	cullBatch.clear();
+	for (uint32_t patch = 0; patch < patches.size(); patch++)
+	{
+		BoundingSphere world = patches[patch].cap.transformed(object.modelMatrix);
+		cullBatch.push(world);
+		float distance = glm::max(glm::distance(cameraPosition, world.center) - world.radius, nearPlane);
+		float pixels_per_unit = LodSelector::pixelsPerUnit(distance, fieldOfView, static_cast<float>(height_w));
+		mesh.setLevel(patch, lodSelector.select(patches[patch].level, MaxPatchLevel + 1, pixels_per_unit,
+			[&](uint32_t level) { return baseEdgeLength / float(1u << level) * scale; }));
+	}
+	if (mesh.dirty())
+	{
+		mesh.rebuild(threadPool);
+		PatchUploader::uploadChanged(mesh, sphere->handles);
+	}
+	frustum.testSpheres(cullBatch, cullVisible);
+
+	indirectCommands.clear();
+	for (uint32_t patch = 0; patch < patches.size(); patch++)
+	{
+		if (!cullVisible[patch] || (coneCulling && patches[patch].cone.backfacing(patches[patch].cap, camera)))
+			continue;
+		indirectCommands.push_back({ static_cast<uint32_t>(mesh.patchIndexes(patch).size()), 1,
+			patch * PatchedIcosphere::slotIndexes(MaxPatchLevel),
+			static_cast<int32_t>(patch * PatchedIcosphere::slotVertices(MaxPatchLevel)), 0 });
+	}
+	if (indirectCommands.empty())
+		return;
+
+	glBindVertexArray(sphere->handles.VAO);
+	if (multiDrawIndirect)
+		submitIndirect(GL_UNSIGNED_INT);
+	else
+		for (const auto& command : indirectCommands)
+			glDrawElementsBaseVertex(GL_TRIANGLES, command.count, GL_UNSIGNED_INT,
+				(void*)(uintptr_t)(command.firstIndex * sizeof(uint32_t)), command.baseVertex);
+	glBindVertexArray(emptyVAO);
+}
+
+void Renderer::drawAdaptive(uint32_t objectIndex, const ObjectState& object, const Frustum& frustum, const glm::vec3& cameraPosition) {
+	if (adaptiveSpheres.size() <= objectIndex)
+		adaptiveSpheres.resize(objectIndex + 1);
+	auto& sphere = adaptiveSpheres[objectIndex];
+	const bool created = !sphere;
+	if (created)
+	{
+		sphere = std::make_unique<AdaptiveSphere>(MaxAdaptiveLevel);
+		sphere->lod.bounds = faceCaps;
+		if (adaptiveTerrain)
+		{
+			sphere->terrain = std::make_unique<DisplacedSphere>();
+			sphere->lod.bounds = terrainCaps;
+		}
+	}
+	AdaptiveIcosphere& mesh = sphere->mesh;
+
+	// the error is a ratio of lengths, so it can be measured in mesh space
+	const Frustum mesh_frustum(object.PVM);
+	AdaptiveIcosphere::View view;
+	view.camera = glm::vec3(glm::inverse(object.modelMatrix) * glm::vec4(cameraPosition, 1.0f));
+	view.pixelsPerUnit = LodSelector::pixelsPerUnit(1.0f, fieldOfView, static_cast<float>(height_w));
+	view.thresholdPixels = adaptiveErrorPixels;
+	view.frustum = &mesh_frustum;
+	const bool changed = mesh.update(view);
+	if (sphere->terrain)
+	{
+		// the terrain keeps the mesh's slots and vertex ids, so it is mirrored the same way
+		DisplacedSphere& terrain = *sphere->terrain;
+		if (created || changed)
+			terrain.update(mesh, threadPool, mesh.changedVertices(), mesh.changedFaces());
+		if (created || (changed && (mesh.layoutChanged() || terrain.rebuilt())))
+			AdaptiveUploader::upload(terrain, mesh.vertexCapacity(), sphere->lod.handles);
+		else if (changed)
+			AdaptiveUploader::uploadChanged(terrain, terrain.changedVertices(), mesh.changedFaces(), sphere->lod.handles);
+	}
+	else if (created)
+		AdaptiveUploader::upload(mesh, sphere->lod.handles);
+	else if (changed)
+		AdaptiveUploader::uploadChanged(mesh, sphere->lod.handles);
+	if (created || changed)
+		sphere->lod.patches = mesh.getPatches();
+
+	// one command per face slot, culled by the face's cap like a CPU level's patches
+	glBindVertexArray(sphere->lod.handles.VAO);
+	drawObject(object, sphere->lod, frustum, cameraPosition);
+	glBindVertexArray(emptyVAO);
+}
+
+void Renderer::submitIndirect(uint32_t indexType) {
+	const size_t bytes = indirectCommands.size() * sizeof(DrawElementsIndirectCommand);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+	if (indirectOffset + bytes > indirectCapacity)
+	{
+		indirectCapacity = std::max<size_t>(indirectCapacity, std::max<size_t>(bytes, 64 * 1024));
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, indirectCapacity, NULL, GL_STREAM_DRAW);
+		indirectOffset = 0;
+	}
+	glBufferSubData(GL_DRAW_INDIRECT_BUFFER, indirectOffset, bytes, indirectCommands.data());
+	glMultiDrawElementsIndirect(GL_TRIANGLES, indexType, (void*)(uintptr_t)indirectOffset, static_cast<GLsizei>(indirectCommands.size()), 0);
+	indirectOffset += bytes;
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void Renderer::buildFrameState(const SceneState& scene, uint64_t frameIndex, FrameState& frame) const {
+	frame.frame = frameIndex;
+	frame.viewMatrix = scene.viewMatrix;
+	frame.projectionMatrix = scene.projectionMatrix;
+	frame.cameraPosition = glm::vec3(glm::inverse(scene.viewMatrix)[3]);
+	frame.lights = scene.lights;
+
+	frame.objects.resize(scene.objects.size());
+	for (uint32_t i = 0; i < scene.objects.size(); i++)
+	{
+		const SceneObject& source = scene.objects[i];
+		ObjectState& object = frame.objects[i];
+		object.modelMatrix = source.modelMatrix;
+		object.VM = scene.viewMatrix * source.modelMatrix;
+		object.PVM = scene.projectionMatrix * object.VM;
+		object.normalMatrix = glm::mat3(glm::transpose(glm::inverse(object.VM)));
+		object.color = source.color;
+		object.shaderVariant = shaderVariant(scene, source);
+		object.texture = source.texture;
+		object.dynamic = source.dynamic;
+	}
+}
+
+void Renderer::startUpdates() {
+	// the first frame must not wait for the update thread
+	buildFrameState(scene, updateFrame++, frames.back());
+	frames.publish();
+
+	stopUpdate = false;
+	updater = std::thread(&Renderer::updateLoop, this);
+}
+
+void Renderer::stopUpdates() {
+	stopUpdate = true;
+	if (updater.joinable())
+		updater.join();
+}
+
+void Renderer::updateLoop() {
+	typedef std::chrono::steady_clock Clock;
+	const auto period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / updateRate));
+	auto previous = Clock::now();
+	auto next = previous;
+
+	try {
+		while (!stopUpdate)
+		{
+			auto now = Clock::now();
+			float dt = std::chrono::duration<float>(now - previous).count();
+			previous = now;
+
+			if (onUpdate)
+				onUpdate(scene, dt);
+			if (scene.lights.empty())
+				throw std::exception("the scene needs at least one light");
+			buildFrameState(scene, updateFrame++, frames.back());
+			frames.publish();
+
+			// fixed rate; after a long stall it continues from now instead of catching up
+			next = std::max(next + period, now);
+			std::this_thread::sleep_until(next);
+		}
+	}
+	catch (std::exception& ex) {
+		std::cout << "\t\t[UPDATE] " << ex.what() << std::endl;
+		glfwSetWindowShouldClose(window, true);
+	}
+}
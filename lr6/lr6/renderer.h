@@ -10,45 +10,167 @@
 #include "shader.hpp"
 
 #include <exception>
+#include <map>
 #include <memory>
 #include <vector>
 #include <string>
 #include <iostream>
+#include <algorithm>
+#include <cstdint>
+#include <atomic>
+#include <functional>
+#include <thread>
 
 #include "figure.h"
-struct MeshDeviceHandles {
-	uint32_t VAO;
-	uint32_t EBO;
-	uint32_t VBO_vertex;
-	uint32_t VBO_normals;
-
-	uint32_t ShaderProgram;
-};
+#include "vertex_format.h"
+#include "culling.h"
+#include "lod.h"
+#include "streaming.h"
+#include "profiler.h"
+#include "shader_cache.h"
+#include "gpu_mesh.h"
+#include "async_loader.h"
+#include "gpu_icosphere.h"
+#include "frame_state.h"
+#include "thread_pool.h"
+#include "light_clusters.h"
+#include "mesh_arena.h"
+#include "adaptive_icosphere.h"
+#include "terrain.h"
+#include "texture_streamer.h"
+#include "bvh.h"
 class Renderer {
 public:
 	Renderer(size_t w, size_t h, const std::shared_ptr<Mesh>& _model);
+	Renderer(size_t w, size_t h, const std::shared_ptr<IcosphereLodChain>& lodChain);
+	// opens with the level-0 icosahedron; levels 1..maxLevel are built and uploaded
+	// in the background and become selectable as they arrive
+	Renderer(size_t w, size_t h, uint32_t maxLevel);
 
 	void prerender();
 
-	void render() {
-		static float angle = 45;
-		//light_pos = glm::rotate(glm::radians(0.01f), glm::vec3(0.0f, 1.0f, 0.0f)) * glm::vec4(light_pos, 1.0f);
-		//projectionMatrix = glm::perspective(glm::radians(angle-=0.01), static_cast<float>(width_w) / height_w, 2.0f, 50.0f);
-		if (angle < 10)
-			angle = 90;
-		glUseProgram(handles.ShaderProgram);
-
-		glm::mat4 VM = viewMatrix * modelMatrix;
-		glm::mat4 PVM = projectionMatrix * VM;
-		glm::mat3 NormalMatrix = glm::mat3(transpose(inverse(viewMatrix * modelMatrix)));
-		glUniformMatrix4fv(glGetUniformLocation(handles.ShaderProgram, "PVM"), 1, GL_FALSE, glm::value_ptr(PVM));
-		glUniformMatrix4fv(glGetUniformLocation(handles.ShaderProgram, "VM"), 1, GL_FALSE, glm::value_ptr(VM));
-		glUniformMatrix3fv(glGetUniformLocation(handles.ShaderProgram, "NormalMatrix"), 1, GL_FALSE, glm::value_ptr(NormalMatrix));
-
-		glUniform3fv(glGetUniformLocation(handles.ShaderProgram, "lightPos"), 1, glm::value_ptr(light_pos));
-
-		glBindVertexArray(handles.VAO);
-		glDrawElements(GL_TRIANGLES, countElements, GL_UNSIGNED_INT, static_cast<void*>(0));
+	// every object draws the renderer's model with its own transform;
+	// objects and lights are added before run(), afterwards only onUpdate touches them
+	SceneObject& addObject(const glm::mat4& modelMatrix, bool dynamic = false) {
+		SceneObject object;
+		object.modelMatrix = modelMatrix;
+		object.dynamic = dynamic;
+		scene.objects.push_back(object);
+		return scene.objects.back();
+	}
+
+	// positions are in view space, like the original single light; beyond MaxLights
+	// lights the scene switches to clustered shading, where radius limits each light
+	void addLight(const glm::vec3& position, const glm::vec3& color, float radius = 100.0f) {
+		scene.lights.push_back({ position, color, radius });
+	}
+
+	// objects and lights of a prepared scene, e.g. one shared with the path tracer, replace
+	// the current ones; view and projection stay the renderer's, set for the window in prerender
+	void setScene(const SceneState& state) {
+		scene.objects = state.objects;
+		scene.lights = state.lights;
+	}
+
+	// any thread; decoded and uploaded in the background, objects using it are drawn
+	// untextured until its first level arrives
+	uint32_t loadTexture(const std::string& path, MipFilter filter = MipFilter::Kaiser) {
+		return textures.request(path, filter);
+	}
+
+	// geometry that worker threads may replace at runtime through StreamingMesh::write
+	std::shared_ptr<StreamingMesh> createDynamicMesh(size_t maxVertices, size_t maxIndexes) {
+		dynamicMesh = std::make_shared<StreamingMesh>(maxVertices, maxIndexes);
+		return dynamicMesh;
+	}
+
+	void render(const FrameState& frame) {
+		profiler.beginStage("cull");
+		Frustum frustum(frame.projectionMatrix * frame.viewMatrix);
+		selectLods(frame);
+		cullObjects(frame, frustum);
+		profiler.endStage();
+
+		if (usesClusters(frame))
+		{
+			FrameProfiler::Scope scope(profiler, "lights");
+			LightClusters::Projection projection = { fieldOfView, static_cast<float>(width_w) / height_w, nearPlane, farPlane };
+			lightClusters.build(frame.lights, projection, threadPool);
+			lightClusters.upload();
+			lightClusters.bind();
+		}
+
+		{
+			// what the draw loop needs per object, worked out before any call is issued;
+			// the arena objects' matrices go to their SSBO here
+			FrameProfiler::Scope scope(profiler, "uniforms");
+			if (arenaSupported && arenaSubmission)
+				prepareArenaDraws(frame, frustum);
+			objectDraws.clear();
+			for (uint32_t object_index : visibleObjects)
+				objectDraws.push_back({ object_index, drawVariant(frame, object_index), drawSlot(frame, object_index) });
+		}
+
+		FrameProfiler::Scope draw_scope(profiler, "draw");
+		uint32_t bound_slot = UINT32_MAX;
+		uint32_t bound_variant = UINT32_MAX;
+		uint32_t shaderProgram = 0;
+		for (const ObjectDraw& draw : objectDraws)
+		{
+			const uint32_t object_index = draw.object;
+			const ObjectState& object = frame.objects[object_index];
+			const uint32_t variant = draw.variant;
+			if (variant != bound_variant)
+			{
+				bound_variant = variant;
+				shaderProgram = programs[variant];
+				glUseProgram(shaderProgram);
+				setLightUniforms(frame, shaderProgram, variant);
+				setGeometryUniforms(shaderProgram, variant);
+				// the whole batch goes out with one call, whatever the number of objects
+				if (variant & shaders_source::FeatureIndirect)
+				{
+					drawArenaBatch(variant);
+					bound_slot = UINT32_MAX;
+				}
+			}
+			if (variant & shaders_source::FeatureIndirect)
+				continue;
+			if (variant & shaders_source::FeatureInstanceColor)
+				glUniform3fv(glGetUniformLocation(shaderProgram, "objectColor"), 1, glm::value_ptr(object.color));
+			if (variant & shaders_source::FeatureTexture)
+			{
+				const uint32_t texture = textures.texture(object.texture);
+				glBindTexture(GL_TEXTURE_2D, texture ? texture : whiteTexture);
+			}
+
+			const uint32_t slot = draw.slot;
+			if (slot != bound_slot)
+			{
+				bound_slot = slot;
+				glBindVertexArray(slotVAO(slot));
+			}
+			glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "PVM"), 1, GL_FALSE, glm::value_ptr(object.PVM));
+			glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "VM"), 1, GL_FALSE, glm::value_ptr(object.VM));
+			glUniformMatrix3fv(glGetUniformLocation(shaderProgram, "NormalMatrix"), 1, GL_FALSE, glm::value_ptr(object.normalMatrix));
+
+			if (slot == DynamicSlot)
+				dynamicMesh->draw();
+			else if (slot == TessSlot)
+				glDrawElements(GL_PATCHES, tessMesh.countElements, tessMesh.indexType, static_cast<void*>(0));
+			else if (slot == BufferlessSlot)
+			{
+				const uint32_t level = lodLevels[object_index];
+				glUniform1ui(glGetUniformLocation(shaderProgram, "level"), level);
+				glDrawArraysInstanced(GL_TRIANGLES, 0, 3 << (2 * level), IcosphereGrid::FaceCount);
+			}
+			else if (slot == PatchSlot)
+				drawPatched(object_index, object, frustum, frame.cameraPosition);
+			else if (slot == AdaptiveSlot)
+				drawAdaptive(object_index, object, frustum, frame.cameraPosition);
+			else
+				drawObject(object, lods[slot], frustum, frame.cameraPosition);
+		}
 		glBindVertexArray(0);
 		glUseProgram(0);
 	}
@@ -56,78 +178,391 @@ public:
 
 	void run() {
 		prerender();
+		profiler.init();
+		startUpdates();
 		while (!glfwWindowShouldClose(window))
 		{
-			processInput(window);
+			profiler.beginFrame();
+			{
+				FrameProfiler::Scope scope(profiler, "input");
+				processInput(window);
+				glfwPollEvents();
+			}
+
+			if (dynamicMesh)
+			{
+				FrameProfiler::Scope scope(profiler, "stream");
+				dynamicMesh->update();
+			}
+			if (loader)
+			{
+				FrameProfiler::Scope scope(profiler, "load");
+				pollLoader();
+			}
+			if (!textures.idle())
+			{
+				FrameProfiler::Scope scope(profiler, "textures");
+				textures.poll(textureUploadBudget);
+			}
 
 			glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
 			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-			render();
-			glfwSwapBuffers(window);
-			glfwPollEvents();
+			// the newest snapshot, or the previous one again if the update thread is behind
+			frames.acquire();
+			render(frames.front());
+			{
+				FrameProfiler::Scope scope(profiler, "swap");
+				glfwSwapBuffers(window);
+			}
+			profiler.endFrame();
+			updateOverlay();
 		}
+		stopUpdates();
+		profiler.release();
 	}
 	~Renderer() {
+		stopUpdates();
+		if (loader)
+			loader->release();
+		for (auto& lod : lods)
+			MeshUploader::destroy(lod.handles);
+		if (dynamicMesh)
+			dynamicMesh->release();
+		lightClusters.release();
+		MeshUploader::destroy(tessMesh);
+		for (auto& sphere : patchedSpheres)
+			if (sphere)
+				MeshUploader::destroy(sphere->handles);
+		for (auto& sphere : adaptiveSpheres)
+			if (sphere)
+				MeshUploader::destroy(sphere->lod.handles);
+		glDeleteVertexArrays(1, &emptyVAO);
+		glDeleteBuffers(1, &baseFacesUBO);
+		glDeleteBuffers(1, &indirectBuffer);
+		arena.release();
+		glDeleteBuffers(1, &arenaDrawBuffer);
+		glDeleteBuffers(1, &arenaCommandBuffer);
+		textures.release();
+		glDeleteTextures(1, &whiteTexture);
+		shaderCache.release();
 		glfwTerminate();
-		glDeleteVertexArrays(1, &handles.VAO);
-		glDeleteBuffers(1,&handles.EBO);
-		glDeleteBuffers(1, &handles.VBO_normals);
-		glDeleteBuffers(1, &handles.VBO_vertex);
 	}
+
+	LodSelector lodSelector;
+	FrameProfiler profiler;
+	bool showProfilerOverlay = false; // toggled with F1
+	// toggled with F2: static objects are drawn from the 20-face base mesh and refined by
+	// tessellation shaders instead of the CPU-built levels; ignored without GL 4.0
+	bool tessellation = false;
+	// toggled with F3, takes precedence over tessellation: static objects are rebuilt in
+	// the vertex shader from gl_VertexID at any level, without vertex or index buffers
+	bool bufferless = false;
+	static const uint32_t MaxBufferlessLevel = 10;
+	// toggled with F5, after bufferless in precedence: static objects are drawn as 20
+	// face patches that pick their levels independently, stitched where levels differ
+	bool patchLod = false;
+	static const uint32_t MaxPatchLevel = 6;
+	// toggled with F7, after patches in precedence: static objects are refined triangle by
+	// triangle until the gap to the true sphere projects under adaptiveErrorPixels
+	bool adaptiveSubdivision = false;
+	float adaptiveErrorPixels = 0.5f;
+	static const uint32_t MaxAdaptiveLevel = 12;
+	// the adaptive spheres are displaced by DisplacedSphere, which follows each update
+	// patch by patch; the error is still judged on the round sphere. Read when a sphere
+	// is first drawn
+	bool adaptiveTerrain = false;
+	// toggled with F4: patches (meshlets on the CPU-built levels) whose normal cone faces
+	// away from the camera are dropped before submission
+	bool coneCulling = true;
+	// toggled with F6: LOD objects are drawn from the mesh arena, one
+	// glMultiDrawElementsIndirect per shader variant; needs GL 4.3 and vertex-stage SSBOs
+	bool arenaSubmission = true;
+	// texel bytes copied to the GPU per frame while textures stream in
+	size_t textureUploadBudget = 4 * 1024 * 1024;
+	// levels requested through Renderer(w, h, maxLevel) come from a compute shader when
+	// GL 4.3 is available, otherwise from the loader thread
+	bool gpuGeneration = true;
+	// reads every GPU-built level back and diffs it against Icosaedr on stdout
+	bool validateGpuMeshes = false;
+
+	// the nearest object under a window position (pixels, origin top left) in the last drawn
+	// frame, tested against the geometry each object was drawn with; a left click shows it
+	// in the window title. GPU-built geometry is mirrored on the CPU (IcosphereGrid, or the
+	// streamed mesh read back), so the triangle is the one the draw call numbered.
+	struct Pick {
+		uint32_t object = RayHit::None;
+		uint32_t triangle = RayHit::None;     // the base face for tessellated objects
+		glm::vec3 position = glm::vec3(0.0f); // world space
+	};
+	Pick pick(double x, double y);
+
+	// runs on the update thread before every snapshot; dt in seconds
+	std::function<void(SceneState& scene, float dt)> onUpdate;
+	float updateRate = 120.0f; // snapshots per second
 private:
+	static const uint32_t DynamicSlot = UINT32_MAX - 1;
+	static const uint32_t TessSlot = UINT32_MAX - 2;
+	static const uint32_t BufferlessSlot = UINT32_MAX - 3;
+	static const uint32_t PatchSlot = UINT32_MAX - 4;
+	static const uint32_t AdaptiveSlot = UINT32_MAX - 5;
+	uint32_t drawSlot(const FrameState& frame, uint32_t object) const {
+		if (frame.objects[object].dynamic && dynamicMesh && dynamicMesh->hasContent())
+			return DynamicSlot;
+		if (bufferless && !frame.objects[object].dynamic)
+			return BufferlessSlot;
+		if (patchLod && !frame.objects[object].dynamic)
+			return PatchSlot;
+		if (adaptiveSubdivision && !frame.objects[object].dynamic)
+			return AdaptiveSlot;
+		if (tessellation && tessellationSupported && !frame.objects[object].dynamic)
+			return TessSlot;
+		return lodLevels[object];
+	}
+	uint32_t slotVAO(uint32_t slot) const {
+		if (slot == DynamicSlot)
+			return dynamicMesh->getVAO();
+		if (slot == TessSlot)
+			return tessMesh.VAO;
+		if (slot == BufferlessSlot || slot == PatchSlot || slot == AdaptiveSlot)
+			return emptyVAO; // every patched or adaptive sphere binds its own
+		return lods[slot].handles.VAO;
+	}
+	uint32_t drawVariant(const FrameState& frame, uint32_t object) const {
+		uint32_t variant = frame.objects[object].shaderVariant;
+		const uint32_t slot = drawSlot(frame, object);
+		if (slot == TessSlot)
+			variant |= shaders_source::FeatureTessellation;
+		else if (slot == BufferlessSlot)
+			variant |= shaders_source::FeatureBufferless;
+		// the arena batches one variant into one call, which leaves no room for per-object textures
+		else if (slot != DynamicSlot && slot != PatchSlot && slot != AdaptiveSlot && !(variant & shaders_source::FeatureTexture)
+			&& arenaSupported && arenaSubmission)
+			variant |= shaders_source::FeatureIndirect;
+		return variant;
+	}
+	// only combinations drawSlot/shaderVariant can produce are compiled
+	bool variantSupported(uint32_t variant) const {
+		using namespace shaders_source;
+		if ((variant & FeatureClustered) && (variant & FeatureMultiLight))
+			return false;
+		if ((variant & FeatureTessellation) && (variant & FeatureBufferless))
+			return false;
+		if ((variant & FeatureIndirect) && (variant & (FeatureTessellation | FeatureBufferless | FeatureTexture)))
+			return false;
+		return (clusteredShading || !(variant & FeatureClustered))
+			&& (arenaSupported || !(variant & FeatureIndirect))
+			&& (tessellationSupported || !(variant & FeatureTessellation));
+	}
+	void setGeometryUniforms(uint32_t program, uint32_t variant) const;
+
+	// smallest shader permutation that can draw the object
+	uint32_t shaderVariant(const SceneState& scene, const SceneObject& object) const {
+		uint32_t features = 0;
+		if (object.specular)
+			features |= shaders_source::FeatureSpecular;
+		if (object.customColor)
+			features |= shaders_source::FeatureInstanceColor;
+		if (object.texture)
+			features |= shaders_source::FeatureTexture;
+		// without SSBOs the multi-light path shades the first MaxLights lights
+		if (scene.lights.size() > shaders_source::MaxLights && clusteredShading)
+			features |= shaders_source::FeatureClustered;
+		else if (scene.lights.size() > 1)
+			features |= shaders_source::FeatureMultiLight;
+		return features;
+	}
+	bool usesClusters(const FrameState& frame) const {
+		return frame.lights.size() > shaders_source::MaxLights && clusteredShading;
+	}
+	void setLightUniforms(const FrameState& frame, uint32_t program, uint32_t variant) const;
+
+	// update thread
+	void startUpdates();
+	void stopUpdates();
+	void updateLoop();
+	void buildFrameState(const SceneState& scene, uint64_t frameIndex, FrameState& frame) const;
+
+	void initWindow();
+	void pollLoader();
+	void generateLevelsOnGpu();
+	const IcosphereGrid& pickGrid(uint32_t level);
+	const MeshBvh& pickBvh(const Mesh& mesh);
+	// ray in the object's space; dynamicBvh is filled by the first streamed object
+	RayHit pickObject(const FrameState& frame, uint32_t object, const Ray& ray, std::unique_ptr<MeshBvh>& dynamicBvh);
+	static std::vector<ShaderProgramSource> shaderVariants();
+	void selectLods(const FrameState& frame);
+	void cullObjects(const FrameState& frame, const Frustum& frustum);
+	void appendPatchCommands(const ObjectState& object, const GpuMesh& lod, const Frustum& frustum, const glm::vec3& cameraPosition);
+	void drawObject(const ObjectState& object, const GpuMesh& lod, const Frustum& frustum, const glm::vec3& cameraPosition);
+	void prepareArenaDraws(const FrameState& frame, const Frustum& frustum);
+	void drawArenaBatch(uint32_t variant);
+	void submitIndirect(uint32_t indexType);
+	void drawPatched(uint32_t objectIndex, const ObjectState& object, const Frustum& frustum, const glm::vec3& cameraPosition);
+	void drawAdaptive(uint32_t objectIndex, const ObjectState& object, const Frustum& frustum, const glm::vec3& cameraPosition);
+
 	static void processInput(GLFWwindow* window)
 	{
 		if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
 			glfwSetWindowShouldClose(window, true);
 	}
-	static void framebuffer_size_callback(GLFWwindow* window, int width, int height)
+	static void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
 	{
-		glViewport(0, 0, width, height);
+		Renderer* renderer = static_cast<Renderer*>(glfwGetWindowUserPointer(window));
+		if (key == GLFW_KEY_F1 && action == GLFW_PRESS)
+		{
+			renderer->showProfilerOverlay = !renderer->showProfilerOverlay;
+			if (!renderer->showProfilerOverlay)
+				glfwSetWindowTitle(window, renderer->overlayTitle().c_str());
+		}
+		if (key == GLFW_KEY_F2 && action == GLFW_PRESS)
+			renderer->tessellation = !renderer->tessellation;
+		if (key == GLFW_KEY_F3 && action == GLFW_PRESS)
+			renderer->bufferless = !renderer->bufferless;
+		if (key == GLFW_KEY_F4 && action == GLFW_PRESS)
+			renderer->coneCulling = !renderer->coneCulling;
+		if (key == GLFW_KEY_F5 && action == GLFW_PRESS)
+			renderer->patchLod = !renderer->patchLod;
+		if (key == GLFW_KEY_F6 && action == GLFW_PRESS)
+			renderer->arenaSubmission = !renderer->arenaSubmission;
+		if (key == GLFW_KEY_F7 && action == GLFW_PRESS)
+			renderer->adaptiveSubdivision = !renderer->adaptiveSubdivision;
 	}
-
-	bool getShaderErrors(uint32_t shaderHandler) {
-		int32_t success;
-		std::vector<char> infoLog(1024);
-		glGetShaderiv(shaderHandler, GL_COMPILE_STATUS, &success);
-		if (!success)
+	static void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
+	{
+		if (button != GLFW_MOUSE_BUTTON_LEFT || action != GLFW_PRESS)
+			return;
+		Renderer* renderer = static_cast<Renderer*>(glfwGetWindowUserPointer(window));
+		double x, y;
+		glfwGetCursorPos(window, &x, &y);
+		renderer->lastPick = renderer->pick(x, y);
+		glfwSetWindowTitle(window, renderer->overlayTitle().c_str());
+	}
+	// there is no text rendering, so the overlay is the window title
+	void updateOverlay() {
+		if (showProfilerOverlay && ++overlayFrames >= 30)
 		{
-			int32_t writed = 0;
-			glGetShaderInfoLog(shaderHandler, 1023, &writed, infoLog.data());
-			infoLog[writed] = '/0';
-			std::cout << "ERROR::VERTEXSHADER::COMPILATION_FAILED\n" << infoLog.data() << std::endl;
-			return true;
+			overlayFrames = 0;
+			glfwSetWindowTitle(window, overlayTitle().c_str());
 		}
-		return false;
 	}
-
-	bool getShaderProgramLinkError(uint32_t shaderHandlerProgram) {
-		int32_t success;
-		std::vector<char> infoLog(1024);
-		glGetProgramiv(shaderHandlerProgram, GL_LINK_STATUS, &success);
-		if (!success)
+	std::string overlayTitle() const {
+		std::string title = "LR 6";
+		if (showProfilerOverlay)
+			title += " | " + profiler.summary();
+		if (lastPick.object != RayHit::None)
+			title += " | object " + std::to_string(lastPick.object) + ", triangle " + std::to_string(lastPick.triangle);
+		return title;
+	}
+	static void framebuffer_size_callback(GLFWwindow* window, int width, int height)
+	{
+		glViewport(0, 0, width, height);
+		// zero while minimised; the old size is kept so the cluster tiles stay valid
+		Renderer* renderer = static_cast<Renderer*>(glfwGetWindowUserPointer(window));
+		if (renderer && width > 0 && height > 0)
 		{
-			int32_t writed = 0;
-			glGetProgramInfoLog(shaderHandlerProgram, 1023, &writed, infoLog.data());
-			infoLog[writed] = '/0';
-			std::cout << "ERROR::SHADERPROGRAM::LINKING_FAILED\n" << infoLog.data() << std::endl;
-			return true;
+			renderer->framebufferWidth = width;
+			renderer->framebufferHeight = height;
 		}
-		return false;
 	}
 
-	glm::mat4 modelMatrix;
-	glm::mat4 viewMatrix;
-	glm::mat4 projectionMatrix;
+	float fieldOfView = glm::radians(45.0f);
+	float nearPlane = 2.0f;
+	float farPlane = 50.0f;
 
-	glm::vec3 light_pos = glm::vec3(10.f, 0.f, 10.f);
 
 	GLFWwindow* window;
 	size_t width_w;
 	size_t height_w;
-	size_t countElements;
-	const std::shared_ptr<Mesh>& model;
+	// gl_FragCoord units; differs from the window size on HiDPI displays
+	int framebufferWidth = 1;
+	int framebufferHeight = 1;
+
+	std::vector<GpuMesh> lods; // a single entry unless built from an IcosphereLodChain or loaded
+	uint32_t loadLevels = 0;   // last level the background loader should produce
+	std::unique_ptr<AsyncLodLoader> loader;
+	uint32_t programs[shaders_source::VariantCount] = {};
+	ShaderCache shaderCache;
+	std::shared_ptr<StreamingMesh> dynamicMesh;
+	uint32_t overlayFrames = 0;
+
+	// owned by the update thread once run() started
+	SceneState scene = { glm::mat4(1.0f), glm::mat4(1.0f), { { glm::vec3(10.f, 0.f, 10.f), glm::vec3(1.0f) } }, {} };
+	uint64_t updateFrame = 0;
+	std::thread updater;
+	std::atomic<bool> stopUpdate{ false };
+	TripleBuffer<FrameState> frames;
+
+	// render thread
+	std::vector<uint32_t> lodLevels; // per object, kept between snapshots for the hysteresis
+	std::vector<uint32_t> visibleObjects;
+	struct ObjectDraw {
+		uint32_t object;
+		uint32_t variant;
+		uint32_t slot;
+	};
+	std::vector<ObjectDraw> objectDraws; // visibleObjects in draw order, resolved
+	bool clusteredShading = false; // GL 4.3; fixed before the update thread starts
+	bool tessellationSupported = false;
+	MeshDeviceHandles tessMesh; // the base icosahedron, float positions
+	uint32_t emptyVAO = 0;      // bufferless draws still need a VAO in the core profile
+	TextureStreamer textures;
+	uint32_t whiteTexture = 0;  // bound in place of a texture that has not arrived yet
+	uint32_t baseFacesUBO = 0;  // IcosphereGrid corners, 60 x vec4
+	MeshBounds sphereBounds;    // shared by the tessellated and bufferless spheres
+	MeshBounds faceCaps;        // per base face of any subdivided sphere, for the adaptive ones
+	MeshBounds terrainCaps;     // the same, widened by DisplacedSphere's lift
+	float sphereRadius = 1.0f;
+	float baseEdgeLength = 1.0f;
+	float maxTessLevel = 64.0f;
+	LightClusters lightClusters;
+	ThreadPool threadPool;
+	// kept between picks for geometry that does not change: CPU levels and grid mirrors
+	std::map<uint32_t, std::unique_ptr<IcosphereGrid>> pickGrids; // by level
+	std::map<const Mesh*, std::unique_ptr<MeshBvh>> pickBvhs;
+	Pick lastPick;
+	SphereBatch cullBatch;
+	std::vector<uint8_t> cullVisible;
+	struct PatchedSphere {
+		explicit PatchedSphere(uint32_t maxLevel) : mesh(maxLevel) {}
+		PatchedIcosphere mesh;
+		MeshDeviceHandles handles; // PatchUploader slots
+	};
+	std::vector<std::unique_ptr<PatchedSphere>> patchedSpheres; // per object, created on first use
+	struct AdaptiveSphere {
+		explicit AdaptiveSphere(uint32_t maxLevel) : mesh(maxLevel) {}
+		AdaptiveIcosphere mesh;
+		std::unique_ptr<DisplacedSphere> terrain; // with adaptiveTerrain; drawn instead of mesh
+		GpuMesh lod; // AdaptiveUploader buffers; patches are the face slots, bounds the face caps
+		const Mesh& drawn() const {
+			return terrain ? static_cast<const Mesh&>(*terrain) : mesh;
+		}
+	};
+	std::vector<std::unique_ptr<AdaptiveSphere>> adaptiveSpheres; // per object, created on first use
+	bool multiDrawIndirect = false; // GL 4.3
+	uint32_t indirectBuffer = 0;    // streamed: commands are appended until it is full, then it is orphaned
+	size_t indirectCapacity = 0;
+	size_t indirectOffset = 0;
+	std::vector<DrawElementsIndirectCommand> indirectCommands;
 
-	MeshDeviceHandles handles;
+	// std430 layout of DrawData in the indirect vertex shader
+	struct ArenaDraw {
+		glm::mat4 PVM;
+		glm::mat4 VM;
+		glm::mat4 normalMatrix;
+		glm::vec4 color;
+	};
+	struct ArenaBatch {
+		uint32_t variant;
+		size_t first; // in the command buffer
+		size_t count;
+	};
+	bool arenaSupported = false;
+	MeshArena arena;
+	std::vector<ArenaRange> arenaRanges; // per lods entry, appended as levels arrive
+	std::vector<ArenaDraw> arenaDraws;
+	std::vector<ArenaBatch> arenaBatches;
+	uint32_t arenaDrawBuffer = 0;   // SSBO binding 3
+	uint32_t arenaCommandBuffer = 0;
 };
 
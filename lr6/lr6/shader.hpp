@@ -1,64 +1,501 @@
 #pragma once
 
-#define glsl(s) _glsl(s)
-#define _glsl(s) #s
-
+#include <cstdint>
+#include <cstddef>
+#include <string>
 
 namespace shaders_source {
-	static const char* vertex_shader = glsl(
+	// Features a draw batch may need. Every combination is a separate program whose
+	// fragment source differs only in the FEATURE_* defines, so unused terms are removed
+	// by the GLSL preprocessor instead of being branched over on the GPU. The geometry
+	// features (tessellation, bufferless) also swap the vertex stage.
+	enum ShaderFeature : uint32_t {
+		FeatureSpecular = 1 << 0,
+		FeatureInstanceColor = 1 << 1, // objectColor uniform instead of the material constant
+		FeatureMultiLight = 1 << 2,    // loop over up to MaxLights lights
+		FeatureClustered = 1 << 3,     // any number of lights, binned per view-frustum cluster (GL 4.3 SSBOs)
+		FeatureTessellation = 1 << 4,  // base icosahedron subdivided by tessellation shaders (GL 4.0)
+		FeatureBufferless = 1 << 5,    // sphere rebuilt from gl_VertexID / gl_InstanceID, no vertex buffers
+		FeatureIndirect = 1 << 6,      // drawn from the mesh arena; matrices and colour per draw from an SSBO (GL 4.3)
+		FeatureTexture = 1 << 7,       // colour from colorTexture, mapped equirectangularly around the object's z axis
+	};
+	const uint32_t FeatureCount = 8;
+	const uint32_t VariantCount = 1 << FeatureCount;
+	const uint32_t MaxLights = 8;
+
+	struct PhongMaterial {
+		float color[3];
+		float ambientStrength;
+		float specularStrength;
+		float shininess;
+	};
+	constexpr PhongMaterial material = { { 1.0f, 0.84f, 0.0f }, 0.1f, 0.5f, 32.0f };
+
+	// #define block built at compile time for one feature mask
+	struct ShaderDefines {
+		char text[512] = {};
+		size_t length = 0;
 
-		\#version 440 core\n
+		constexpr void append(const char* s) {
+			while (*s)
+				text[length++] = *s++;
+		}
+		constexpr void appendInteger(unsigned long long v) {
+			char digits[20] = {};
+			int count = 0;
+			do {
+				digits[count++] = static_cast<char>('0' + v % 10);
+				v /= 10;
+			} while (v);
+			while (count)
+				text[length++] = digits[--count];
+		}
+		constexpr void appendNumber(float v) {
+			if (v < 0.0f)
+			{
+				append("-");
+				v = -v;
+			}
+			unsigned long long scaled = static_cast<unsigned long long>(v * 10000.0f + 0.5f);
+			appendInteger(scaled / 10000);
+			append(".");
+			for (unsigned long long div = 1000; div > 0; div /= 10)
+				text[length++] = static_cast<char>('0' + scaled / div % 10);
+		}
+		constexpr void appendDefine(const char* name, bool enabled) {
+			append("#define ");
+			append(name);
+			append(enabled ? " 1\n" : " 0\n");
+		}
+		constexpr void appendDefine(const char* name, float value) {
+			append("#define ");
+			append(name);
+			append(" ");
+			appendNumber(value);
+			append("\n");
+		}
+	};
+
+	constexpr ShaderDefines makeDefines(uint32_t features) {
+		ShaderDefines defines;
+		defines.appendDefine("FEATURE_SPECULAR", (features & FeatureSpecular) != 0);
+		defines.appendDefine("FEATURE_INSTANCE_COLOR", (features & FeatureInstanceColor) != 0);
+		defines.appendDefine("FEATURE_MULTI_LIGHT", (features & FeatureMultiLight) != 0);
+		defines.appendDefine("FEATURE_CLUSTERED", (features & FeatureClustered) != 0);
+		defines.appendDefine("FEATURE_TESSELLATION", (features & FeatureTessellation) != 0);
+		defines.appendDefine("FEATURE_BUFFERLESS", (features & FeatureBufferless) != 0);
+		defines.appendDefine("FEATURE_INDIRECT", (features & FeatureIndirect) != 0);
+		defines.appendDefine("FEATURE_TEXTURE", (features & FeatureTexture) != 0);
+		defines.append("#define MAX_LIGHTS ");
+		defines.appendInteger(MaxLights);
+		defines.append("\n");
+
+		defines.appendDefine("MATERIAL_AMBIENT", material.ambientStrength);
+		defines.appendDefine("MATERIAL_SPECULAR", material.specularStrength);
+		defines.appendDefine("MATERIAL_SHININESS", material.shininess);
+		defines.append("#define MATERIAL_COLOR vec3(");
+		for (int i = 0; i < 3; i++)
+		{
+			defines.appendNumber(material.color[i]);
+			defines.append(i < 2 ? ", " : ")\n");
+		}
+		return defines;
+	}
+
+	template<uint32_t Features>
+	struct ShaderVariant {
+		static constexpr uint32_t features = Features;
+		static constexpr ShaderDefines defines = makeDefines(Features);
+	};
+
+	static const char* vertex_shader = R"(#version 440 core
 		layout(location = 0) in vec3 vertex;
 		layout(location = 1) in vec3 normal;
 
+#if FEATURE_INDIRECT
+		struct DrawData {
+			mat4 PVM;
+			mat4 VM;
+			mat4 normalMatrix; // mat3 in the upper left
+			vec4 color;
+		};
+		layout(std430, binding = 3) readonly buffer Draws { DrawData draws[]; };
+		layout(location = 2) in uint drawIndex; // per instance, so it is the command's baseInstance
 
+		flat out vec3 objectColor;
+#else
 		uniform mat4 PVM;
 		uniform mat4 VM;
 		uniform mat3 NormalMatrix;
+#endif
 
 		out vec3 v_normal;
 		out vec3 FragPos;
+#if FEATURE_TEXTURE
+		out vec3 objectPosition;
+#endif
 
 		void main() {
+#if FEATURE_INDIRECT
+			mat4 PVM = draws[drawIndex].PVM;
+			mat4 VM = draws[drawIndex].VM;
+			mat3 NormalMatrix = mat3(draws[drawIndex].normalMatrix);
+			objectColor = draws[drawIndex].color.rgb;
+#endif
 			gl_Position = PVM * vec4(vertex,1.0f);
 			v_normal = normalize(NormalMatrix * normal);
 			FragPos = vec3(VM * vec4(vertex, 1.0f));
+#if FEATURE_TEXTURE
+			objectPosition = vertex;
+#endif
+		}
+	)";
+
+	// Tessellation path: only the 12 base vertices are uploaded. Each face is a patch;
+	// every edge is split by its own projected length, so the two patches sharing an
+	// edge agree on its level and no cracks open. Core GL 4.0 only (runs on llvmpipe).
+	static const char* tess_vertex_shader = R"(#version 440 core
+		layout(location = 0) in vec3 vertex;
+
+		out vec3 tc_position;
+
+		void main() {
+			tc_position = vertex;
 		}
+	)";
 
-	);
+	static const char* tess_control_shader = R"(#version 440 core
+		layout(vertices = 3) out;
 
-	static const char* fragment_shader = glsl(
+		in vec3 tc_position[];
+		out vec3 te_position[];
+
+		uniform mat4 VM;
+		uniform float pixelsPerUnit;    // screen pixels per world unit at distance 1
+		uniform float targetEdgePixels;
+		uniform float maxTessLevel;
+		uniform float nearPlane;
+
+		float edgeLevel(vec3 a, vec3 b) {
+			float depth = max(-(VM * vec4((a + b) * 0.5f, 1.0f)).z, nearPlane);
+			float length_view = length(mat3(VM) * (b - a));
+			return clamp(length_view * pixelsPerUnit / (depth * targetEdgePixels), 1.0f, maxTessLevel);
+		}
+
+		void main() {
+			te_position[gl_InvocationID] = tc_position[gl_InvocationID];
+			if (gl_InvocationID == 0)
+			{
+				// outer level i belongs to the edge opposite vertex i
+				gl_TessLevelOuter[0] = edgeLevel(tc_position[1], tc_position[2]);
+				gl_TessLevelOuter[1] = edgeLevel(tc_position[2], tc_position[0]);
+				gl_TessLevelOuter[2] = edgeLevel(tc_position[0], tc_position[1]);
+				gl_TessLevelInner[0] = max(gl_TessLevelOuter[0], max(gl_TessLevelOuter[1], gl_TessLevelOuter[2]));
+			}
+		}
+	)";
+
+	static const char* tess_evaluation_shader = R"(#version 440 core
+		layout(triangles, fractional_odd_spacing, ccw) in;
+
+		in vec3 te_position[];
+
+		uniform mat4 PVM;
+		uniform mat4 VM;
+		uniform mat3 NormalMatrix;
+		uniform float sphereRadius;
+
+		out vec3 v_normal;
+		out vec3 FragPos;
+#if FEATURE_TEXTURE
+		out vec3 objectPosition;
+#endif
+
+		void main() {
+			vec3 flat_position = gl_TessCoord.x * te_position[0] + gl_TessCoord.y * te_position[1] + gl_TessCoord.z * te_position[2];
+			vec3 normal = normalize(flat_position);
+			vec3 vertex = normal * sphereRadius;
+
+			gl_Position = PVM * vec4(vertex, 1.0f);
+			v_normal = normalize(NormalMatrix * normal);
+			FragPos = vec3(VM * vec4(vertex, 1.0f));
+#if FEATURE_TEXTURE
+			objectPosition = vertex;
+#endif
+		}
+	)";
 
-		\#version 440 core\n
+	static const char* fragment_shader = R"(#version 440 core
 
 		out vec4 FragColor;
 
 		in vec3 v_normal;
 		in vec3 FragPos;
 
+#if FEATURE_CLUSTERED
+		struct ClusterLight {
+			vec4 positionRadius;
+			vec4 color;
+		};
+		layout(std430, binding = 0) readonly buffer ClusterLights { ClusterLight clusterLights[]; };
+		layout(std430, binding = 1) readonly buffer ClusterGrid { uvec2 clusterRanges[]; };
+		layout(std430, binding = 2) readonly buffer ClusterIndexes { uint clusterIndexes[]; };
+		uniform uvec3 clusterCount;
+		uniform vec2 clusterTileSize; // pixels
+		uniform vec2 clusterDepth;    // slice = log(depth) * x + y
+#elif FEATURE_MULTI_LIGHT
+		uniform int lightCount;
+		uniform vec3 lightPositions[MAX_LIGHTS];
+		uniform vec3 lightColors[MAX_LIGHTS];
+#else
 		uniform vec3 lightPos;
+		uniform vec3 lightColor;
+#endif
 
-		void main() {
+#if FEATURE_INSTANCE_COLOR && FEATURE_INDIRECT
+		flat in vec3 objectColor;
+#elif FEATURE_INSTANCE_COLOR
+		uniform vec3 objectColor;
+#else
+		const vec3 objectColor = MATERIAL_COLOR;
+#endif
+		const vec3 viewPos = vec3(0.0f, 0.0f, 0.0f);
 
-			vec3 lightColor = vec3(1.0f, 1.0f, 1.0f);
-			vec3 objectColor = vec3(1.0f, 0.84f, 0.0f);
-			vec3 viewPos = vec3(0.0f, 0.0f, 0.0f);
+#if FEATURE_TEXTURE
+		in vec3 objectPosition;
+		uniform sampler2D colorTexture;
 
-			float ambientStrength = 0.1;
-			vec3 ambient = ambientStrength * lightColor;
+		// the TexturedSphere mapping: u from the longitude, v = 0 at +z. Of two u's, one
+		// with its jump at the seam and one opposite, the one continuous across the pixel
+		// quad is used, so mip selection does not break along the seam
+		vec3 textureColor() {
+			const float PI = 3.14159265f;
+			vec3 direction = normalize(objectPosition);
+			float u = atan(direction.y, direction.x) / (2.0f * PI) + 0.5f;
+			float opposite = fract(u + 0.5f) - 0.5f;
+			float v = acos(clamp(direction.z, -1.0f, 1.0f)) / PI;
+			return texture(colorTexture, vec2(fwidth(u) <= fwidth(opposite) ? u : opposite, v)).rgb;
+		}
+#endif
 
-			vec3 lightDir = normalize(lightPos - FragPos);
+		vec3 shade(vec3 position, vec3 color, vec3 viewDir) {
+			vec3 lightDir = normalize(position - FragPos);
 			float diff = max(dot(v_normal, lightDir), 0.0);
-			vec3 diffuse = diff * lightColor;
+			vec3 result = diff * color;
+#if FEATURE_SPECULAR
+			vec3 reflectDir = reflect(-lightDir, v_normal);
+			float spec = pow(max(dot(viewDir, reflectDir), 0.0), MATERIAL_SHININESS);
+			result += MATERIAL_SPECULAR * spec * color;
+#endif
+			return result;
+		}
 
-			float specularStrength = 0.5;
+		void main() {
 			vec3 viewDir = normalize(viewPos - FragPos);
-			vec3 reflectDir = reflect(-lightDir, v_normal);
-			float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
-			vec3 specular = specularStrength * spec * lightColor;
 
-			FragColor = vec4((ambient + diffuse + specular) * objectColor,1.0f);
+#if FEATURE_CLUSTERED
+			float slice = max(log(-FragPos.z) * clusterDepth.x + clusterDepth.y, 0.0f);
+			uvec3 cell = min(uvec3(uvec2(gl_FragCoord.xy / clusterTileSize), uint(slice)), clusterCount - 1u);
+			uvec2 range = clusterRanges[(cell.z * clusterCount.y + cell.y) * clusterCount.x + cell.x];
+
+			vec3 light = vec3(0.0f);
+			for (uint i = 0u; i < range.y; i++)
+			{
+				ClusterLight source = clusterLights[clusterIndexes[range.x + i]];
+				float ratio = length(source.positionRadius.xyz - FragPos) / source.positionRadius.w;
+				float falloff = clamp(1.0f - ratio * ratio, 0.0f, 1.0f);
+				light += falloff * falloff * (MATERIAL_AMBIENT * source.color.rgb + shade(source.positionRadius.xyz, source.color.rgb, viewDir));
+			}
+#elif FEATURE_MULTI_LIGHT
+			vec3 light = vec3(0.0f);
+			for (int i = 0; i < lightCount; i++)
+				light += MATERIAL_AMBIENT * lightColors[i] + shade(lightPositions[i], lightColors[i], viewDir);
+#else
+			vec3 light = MATERIAL_AMBIENT * lightColor + shade(lightPos, lightColor, viewDir);
+#endif
+
+#if FEATURE_TEXTURE && FEATURE_INSTANCE_COLOR
+			FragColor = vec4(light * objectColor * textureColor(), 1.0f);
+#elif FEATURE_TEXTURE
+			FragColor = vec4(light * textureColor(), 1.0f);
+#else
+			FragColor = vec4(light * objectColor, 1.0f);
+#endif
+		}
+	)";
+
+	// IcosphereGrid in GLSL, shared by the compute generator and the bufferless path
+	static const char* icosphere_grid_functions = R"(
+		vec3 toSphere(vec3 v, float radius) {
+			return v * (radius / length(v));
+		}
+
+		// the same descent as IcosphereGrid::gridPosition
+		vec3 gridPosition(vec3 p0, vec3 p1, vec3 p2, float radius, uint level, uint row, uint col) {
+			uint n = 1u << level;
+			uint a = n - row, b = row - col, c = col;
+			while (n > 1u)
+			{
+				if (a == n)
+					return p0;
+				if (b == n)
+					return p1;
+				if (c == n)
+					return p2;
+
+				uint h = n / 2u;
+				vec3 m0 = toSphere((p0 + p1) / vec3(2), radius);
+				vec3 m1 = toSphere((p1 + p2) / vec3(2), radius);
+				vec3 m2 = toSphere((p2 + p0) / vec3(2), radius);
+				if (a >= h)
+				{
+					p1 = m0; p2 = m2; a -= h;
+				}
+				else if (b >= h)
+				{
+					p0 = m0; p2 = m1; b -= h;
+				}
+				else if (c >= h)
+				{
+					p0 = m2; p1 = m1; c -= h;
+				}
+				else
+				{
+					uvec3 next = uvec3(h - a, h - b, h - c);
+					p0 = m1; p1 = m2; p2 = m0;
+					a = next.x; b = next.y; c = next.z;
+				}
+				n = h;
+			}
+			return a != 0u ? p0 : b != 0u ? p1 : p2;
+		}
+
+		// (row, col) of vertex i of the face grid, rows stored one after another
+		uvec2 gridVertex(uint i) {
+			uint row = uint((sqrt(8.0f * float(i) + 1.0f) - 1.0f) * 0.5f);
+			while ((row + 1u) * (row + 2u) / 2u <= i)
+				row++;
+			while (row * (row + 1u) / 2u > i)
+				row--;
+			return uvec2(row, i - row * (row + 1u) / 2u);
+		}
+
+		// (row, col) of the corners of triangle t of the face grid, see IcosphereGrid::triangle
+		void gridTriangle(uint t, out uvec2 v0, out uvec2 v1, out uvec2 v2) {
+			uint row = uint(sqrt(float(t)));
+			while ((row + 1u) * (row + 1u) <= t)
+				row++;
+			while (row * row > t)
+				row--;
+			uint k = t - row * row;
+			uint col = k / 2u;
+			v0 = uvec2(row, col);
+			if (k % 2u == 0u)
+			{
+				v1 = uvec2(row + 1u, col);
+				v2 = uvec2(row + 1u, col + 1u);
+			}
+			else
+			{
+				v1 = uvec2(row + 1u, col + 1u);
+				v2 = uvec2(row, col + 1u);
+			}
+		}
+	)";
+
+	// Writes level `level` of the icosphere in the IcosphereGrid layout: interleaved
+	// float position + normal (VertexFormat interleaved, 24 bytes) and uint32 indices.
+	// mode 0 runs one invocation per vertex, mode 1 one per triangle.
+	static const char* icosphere_compute_shader = R"(
+		layout(local_size_x = 64) in;
+
+		layout(std430, binding = 0) writeonly buffer Vertices { float vertices[]; };
+		layout(std430, binding = 1) writeonly buffer Indexes { uint indexes[]; };
+
+		uniform vec3 faceCorners[60];
+		uniform float sphereRadius;
+		uniform uint level;
+		uniform uint mode;
+		uniform uint count;
+
+		uint vertexAt(uint face, uvec2 v) {
+			uint n = 1u << level;
+			return face * ((n + 1u) * (n + 2u) / 2u) + v.x * (v.x + 1u) / 2u + v.y;
+		}
+
+		void main() {
+			// 2D dispatch: one row of groups holds at most 65535 * 64 invocations
+			uint id = gl_GlobalInvocationID.y * gl_NumWorkGroups.x * gl_WorkGroupSize.x + gl_GlobalInvocationID.x;
+			if (id >= count)
+				return;
+			uint n = 1u << level;
+
+			if (mode == 0u)
+			{
+				uint face_vertices = (n + 1u) * (n + 2u) / 2u;
+				uint face = id / face_vertices;
+				uvec2 v = gridVertex(id % face_vertices);
+
+				vec3 p = gridPosition(faceCorners[face * 3u], faceCorners[face * 3u + 1u], faceCorners[face * 3u + 2u], sphereRadius, level, v.x, v.y);
+				vec3 normal = normalize(p);
+				vertices[id * 6u] = p.x;
+				vertices[id * 6u + 1u] = p.y;
+				vertices[id * 6u + 2u] = p.z;
+				vertices[id * 6u + 3u] = normal.x;
+				vertices[id * 6u + 4u] = normal.y;
+				vertices[id * 6u + 5u] = normal.z;
+			}
+			else
+			{
+				uint face = id / (n * n);
+				uvec2 v0, v1, v2;
+				gridTriangle(id % (n * n), v0, v1, v2);
+				indexes[id * 3u] = vertexAt(face, v0);
+				indexes[id * 3u + 1u] = vertexAt(face, v1);
+				indexes[id * 3u + 2u] = vertexAt(face, v2);
+			}
+		}
+	)";
+
+	// Bufferless sphere: drawn with glDrawArraysInstanced(GL_TRIANGLES, 0, 3 n^2, 20) and
+	// an empty VAO. The instance is the base face, the vertex id picks triangle and
+	// corner; the only memory is the base-face table.
+	static const char* bufferless_vertex_shader = R"(
+		layout(std140, binding = 0) uniform BaseFaces {
+			vec4 faceCorners[60];
+		};
+
+		uniform mat4 PVM;
+		uniform mat4 VM;
+		uniform mat3 NormalMatrix;
+		uniform float sphereRadius;
+		uniform uint level;
+
+		out vec3 v_normal;
+		out vec3 FragPos;
+#if FEATURE_TEXTURE
+		out vec3 objectPosition;
+#endif
+
+		void main() {
+			uint face = uint(gl_InstanceID);
+			uvec2 corners[3];
+			gridTriangle(uint(gl_VertexID) / 3u, corners[0], corners[1], corners[2]);
+			uvec2 v = corners[uint(gl_VertexID) % 3u];
+
+			vec3 vertex = gridPosition(faceCorners[face * 3u].xyz, faceCorners[face * 3u + 1u].xyz, faceCorners[face * 3u + 2u].xyz,
+				sphereRadius, level, v.x, v.y);
+			gl_Position = PVM * vec4(vertex, 1.0f);
+			v_normal = normalize(NormalMatrix * normalize(vertex));
+			FragPos = vec3(VM * vec4(vertex, 1.0f));
+#if FEATURE_TEXTURE
+			objectPosition = vertex;
+#endif
 		}
+	)";
 
-	);
-}
\ No newline at end of file
+	// the #version line goes first, the defines are inserted right after it
+	inline std::string withGridFunctions(const char* body) {
+		return std::string("#version 440 core\n") + icosphere_grid_functions + body;
+	}
+}
@@ -0,0 +1,341 @@
+#include "shader_cache.h"
+
+#include <atomic>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <thread>
+
+namespace {
+	const uint32_t BinaryMagic = 0x4353524C; // "LRSC"
+	const uint32_t BinaryVersion = 1;
+
+	struct BinaryHeader {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t key;
+		uint32_t format;
+		uint32_t length;
+	};
+
+	uint64_t fnv1a(uint64_t hash, const std::string& data) {
+		for (unsigned char c : data)
+		{
+			hash ^= c;
+			hash *= 0x100000001B3ull;
+		}
+		// separator, so ("ab", "c") and ("a", "bc") differ
+		hash ^= 0xFF;
+		hash *= 0x100000001B3ull;
+		return hash;
+	}
+
+	// shader objects of one program being built; deleted on every way out, also when a
+	// later stage fails to compile or the program fails to link and the build throws
+	struct ShaderStages {
+		uint32_t shaders[4] = {};
+		uint32_t program = 0;
+
+		~ShaderStages() {
+			for (uint32_t shader : shaders)
+				if (shader)
+					glDeleteShader(shader);
+			if (program)
+				glDeleteProgram(program);
+		}
+	};
+}
+
+uint64_t ShaderCache::key(const ShaderProgramSource& source) const {
+	uint64_t hash = 0xCBF29CE484222325ull;
+	hash = fnv1a(hash, source.vertex);
+	hash = fnv1a(hash, source.tessControl);
+	hash = fnv1a(hash, source.tessEvaluation);
+	hash = fnv1a(hash, source.fragment);
+	hash = fnv1a(hash, source.compute);
+	hash = fnv1a(hash, source.defines);
+	hash = fnv1a(hash, driverId);
+	return hash;
+}
+
+std::string ShaderCache::filePath(uint64_t hash) const {
+	std::ostringstream name;
+	name << directory << "/" << std::hex << std::setw(16) << std::setfill('0') << hash << ".bin";
+	return name.str();
+}
+
+uint32_t ShaderCache::loadBinary(uint64_t hash) const {
+	std::ifstream fin(filePath(hash), std::ios::binary);
+	if (!fin)
+		return 0;
+
+	BinaryHeader header;
+	if (!fin.read(reinterpret_cast<char*>(&header), sizeof(header))
+		|| header.magic != BinaryMagic || header.version != BinaryVersion || header.key != hash)
+		return 0;
+
+	std::vector<char> data(header.length);
+	if (!fin.read(data.data(), data.size()))
+		return 0;
+
+	uint32_t program = glCreateProgram();
+	glProgramBinary(program, header.format, data.data(), header.length);
+	int32_t success = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &success);
+	if (!success)
+	{
+		glDeleteProgram(program);
+		return 0;
+	}
+	return program;
+}
+
+void ShaderCache::storeBinary(uint64_t hash, uint32_t program) const {
+	int32_t length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+
+	std::vector<char> data(length);
+	GLenum format = 0;
+	glGetProgramBinary(program, length, &length, &format, data.data());
+
+	BinaryHeader header = { BinaryMagic, BinaryVersion, hash, format, static_cast<uint32_t>(length) };
+	std::error_code error;
+	std::filesystem::create_directories(directory, error);
+	std::ofstream fout(filePath(hash), std::ios::binary);
+	fout.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	fout.write(data.data(), length);
+}
+
+uint32_t ShaderCache::loadOrCompile(const ShaderProgramSource& source) {
+	const uint64_t hash = key(source);
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		auto found = programs.find(hash);
+		if (found != programs.end())
+			return found->second;
+	}
+
+	uint32_t program = binarySupported ? loadBinary(hash) : 0;
+	if (!program)
+	{
+		program = compile(source);
+		if (binarySupported)
+			storeBinary(hash, program);
+	}
+
+	std::lock_guard<std::mutex> guard(lock);
+	programs.emplace(hash, program);
+	return program;
+}
+
+uint32_t ShaderCache::getProgram(const ShaderProgramSource& source) {
+	if (!queried)
+	{
+		// identifies the driver; binaries are only valid for the one that wrote them
+		driverId = std::string(reinterpret_cast<const char*>(glGetString(GL_VENDOR))) + "|"
+			+ reinterpret_cast<const char*>(glGetString(GL_RENDERER)) + "|"
+			+ reinterpret_cast<const char*>(glGetString(GL_VERSION));
+		int32_t formats = 0;
+		if (GLAD_GL_VERSION_4_1)
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		binarySupported = formats > 0;
+		queried = true;
+	}
+	return loadOrCompile(source);
+}
+
+void ShaderCache::precompile(GLFWwindow* mainWindow, const std::vector<ShaderProgramSource>& variants, uint32_t threadCount) {
+	// driver strings are read on the calling thread before any worker starts
+	if (variants.empty())
+		return;
+	getProgram(variants[0]);
+	if (variants.size() == 1)
+		return;
+
+	threadCount = std::max<uint32_t>(1, std::min<uint32_t>(threadCount, variants.size() - 1));
+
+	// GLFW windows (and with them the shared contexts) can only be created here
+	std::vector<GLFWwindow*> contexts;
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	for (uint32_t i = 0; i < threadCount; i++)
+	{
+		GLFWwindow* context = glfwCreateWindow(1, 1, "", NULL, mainWindow);
+		if (context == NULL)
+			break;
+		contexts.push_back(context);
+	}
+	glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+
+	std::atomic<size_t> next(1);
+	std::exception_ptr failure;
+	std::mutex failure_lock;
+	auto worker = [&](GLFWwindow* context) {
+		glfwMakeContextCurrent(context);
+		try {
+			for (size_t i = next++; i < variants.size(); i = next++)
+				loadOrCompile(variants[i]);
+		}
+		catch (...) {
+			std::lock_guard<std::mutex> guard(failure_lock);
+			failure = std::current_exception();
+		}
+		// programs are shared objects; make them complete before the main context uses them
+		glFinish();
+		glfwMakeContextCurrent(NULL);
+	};
+
+	std::vector<std::thread> threads;
+	for (auto context : contexts)
+		threads.emplace_back(worker, context);
+	for (auto& thread : threads)
+		thread.join();
+	for (auto context : contexts)
+		glfwDestroyWindow(context);
+
+	// anything left (no shared context could be created) is compiled here
+	for (size_t i = next++; i < variants.size(); i = next++)
+		loadOrCompile(variants[i]);
+
+	if (failure)
+		std::rethrow_exception(failure);
+}
+
+void ShaderCache::release() {
+	std::lock_guard<std::mutex> guard(lock);
+	for (auto& program : programs)
+		glDeleteProgram(program.second);
+	programs.clear();
+}
+
+std::string ShaderCache::withDefines(const std::string& source, const std::string& defines) {
+	if (defines.empty())
+		return source;
+	size_t version_end = source.find('\n', source.find("#version"));
+	if (version_end == std::string::npos)
+		return source;
+	return source.substr(0, version_end + 1) + defines + "\n" + source.substr(version_end + 1);
+}
+
+uint32_t ShaderCache::compileCompute(const ShaderProgramSource& source) {
+	std::string compute_source = withDefines(source.compute, source.defines);
+	const char* compute_ptr = compute_source.c_str();
+
+	ShaderStages stages;
+	uint32_t ComputeShader = stages.shaders[0] = glCreateShader(GL_COMPUTE_SHADER);
+	glShaderSource(ComputeShader, 1, &compute_ptr, NULL);
+	glCompileShader(ComputeShader);
+
+	if (getShaderErrors(ComputeShader))
+		throw std::exception("shader compile error");
+
+	uint32_t ShaderProgram = stages.program = glCreateProgram();
+	if (GLAD_GL_VERSION_4_1)
+		glProgramParameteri(ShaderProgram, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glAttachShader(ShaderProgram, ComputeShader);
+	glLinkProgram(ShaderProgram);
+
+	if (getShaderProgramLinkError(ShaderProgram))
+		throw std::exception("shader program link error");
+
+	stages.program = 0; // linked: the caller owns it
+	return ShaderProgram;
+}
+
+uint32_t ShaderCache::compile(const ShaderProgramSource& source) {
+	if (!source.compute.empty())
+		return compileCompute(source);
+
+	std::string vertex_source = withDefines(source.vertex, source.defines);
+	std::string fragment_source = withDefines(source.fragment, source.defines);
+	const char* vertex_ptr = vertex_source.c_str();
+	const char* fragment_ptr = fragment_source.c_str();
+
+	ShaderStages stages;
+	uint32_t VertexShader = stages.shaders[0] = glCreateShader(GL_VERTEX_SHADER);
+	glShaderSource(VertexShader, 1, &vertex_ptr, NULL);
+	glCompileShader(VertexShader);
+
+	if (getShaderErrors(VertexShader))
+		throw std::exception("shader compile error");
+
+	uint32_t TessControlShader = 0, TessEvaluationShader = 0;
+	if (!source.tessControl.empty())
+	{
+		std::string control_source = withDefines(source.tessControl, source.defines);
+		std::string evaluation_source = withDefines(source.tessEvaluation, source.defines);
+		const char* control_ptr = control_source.c_str();
+		const char* evaluation_ptr = evaluation_source.c_str();
+
+		TessControlShader = stages.shaders[1] = glCreateShader(GL_TESS_CONTROL_SHADER);
+		glShaderSource(TessControlShader, 1, &control_ptr, NULL);
+		glCompileShader(TessControlShader);
+		if (getShaderErrors(TessControlShader))
+			throw std::exception("shader compile error");
+
+		TessEvaluationShader = stages.shaders[2] = glCreateShader(GL_TESS_EVALUATION_SHADER);
+		glShaderSource(TessEvaluationShader, 1, &evaluation_ptr, NULL);
+		glCompileShader(TessEvaluationShader);
+		if (getShaderErrors(TessEvaluationShader))
+			throw std::exception("shader compile error");
+	}
+
+	uint32_t FragmentShader = stages.shaders[3] = glCreateShader(GL_FRAGMENT_SHADER);
+	glShaderSource(FragmentShader, 1, &fragment_ptr, NULL);
+	glCompileShader(FragmentShader);
+
+	if (getShaderErrors(FragmentShader))
+		throw std::exception("shader compile error");
+
+	uint32_t ShaderProgram = stages.program = glCreateProgram();
+	if (GLAD_GL_VERSION_4_1)
+		glProgramParameteri(ShaderProgram, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glAttachShader(ShaderProgram, VertexShader);
+	if (TessControlShader)
+	{
+		glAttachShader(ShaderProgram, TessControlShader);
+		glAttachShader(ShaderProgram, TessEvaluationShader);
+	}
+	glAttachShader(ShaderProgram, FragmentShader);
+	glLinkProgram(ShaderProgram);
+
+	if (getShaderProgramLinkError(ShaderProgram))
+		throw std::exception("shader program link error");
+
+	stages.program = 0; // linked: the caller owns it
+	return ShaderProgram;
+}
+
+bool ShaderCache::getShaderErrors(uint32_t shaderHandler) {
+	int32_t success;
+	std::vector<char> infoLog(1024);
+	glGetShaderiv(shaderHandler, GL_COMPILE_STATUS, &success);
+	if (!success)
+	{
+		int32_t writed = 0;
+		glGetShaderInfoLog(shaderHandler, 1023, &writed, infoLog.data());
+		infoLog[writed] = '\0';
+		std::cout << "ERROR::VERTEXSHADER::COMPILATION_FAILED\n" << infoLog.data() << std::endl;
+		return true;
+	}
+	return false;
+}
+
+bool ShaderCache::getShaderProgramLinkError(uint32_t shaderHandlerProgram) {
+	int32_t success;
+	std::vector<char> infoLog(1024);
+	glGetProgramiv(shaderHandlerProgram, GL_LINK_STATUS, &success);
+	if (!success)
+	{
+		int32_t writed = 0;
+		glGetProgramInfoLog(shaderHandlerProgram, 1023, &writed, infoLog.data());
+		infoLog[writed] = '\0';
+		std::cout << "ERROR::SHADERPROGRAM::LINKING_FAILED\n" << infoLog.data() << std::endl;
+		return true;
+	}
+	return false;
+}
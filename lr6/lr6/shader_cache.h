@@ -0,0 +1,61 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glfw3.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+struct ShaderProgramSource {
+	std::string vertex;
+	std::string tessControl;    // both tessellation stages or neither
+	std::string tessEvaluation;
+	std::string fragment;
+	std::string compute;        // set alone, for a compute-only program
+	std::string defines; // inserted after the #version line of every stage
+};
+
+// Linked programs cached on disk as glGetProgramBinary blobs.
+//
+// The file name is a hash of the sources, the defines and the GL vendor/renderer/
+// version strings, so a driver update or an edited shader simply misses the cache.
+// A blob the driver rejects falls back to compiling from source and is rewritten.
+class ShaderCache {
+public:
+	explicit ShaderCache(const std::string& _directory = "shader_cache") : directory(_directory) {}
+
+	// GL thread; throws on compile/link errors
+	uint32_t getProgram(const ShaderProgramSource& source);
+
+	// compiles (or loads) every variant on worker threads that own contexts shared
+	// with mainWindow; must be called from the thread that created mainWindow
+	void precompile(GLFWwindow* mainWindow, const std::vector<ShaderProgramSource>& variants, uint32_t threadCount);
+
+	// GL thread; deletes every program handed out
+	void release();
+
+	static uint32_t compile(const ShaderProgramSource& source);
+
+private:
+	uint64_t key(const ShaderProgramSource& source) const;
+	std::string filePath(uint64_t hash) const;
+	uint32_t loadBinary(uint64_t hash) const;
+	void storeBinary(uint64_t hash, uint32_t program) const;
+	uint32_t loadOrCompile(const ShaderProgramSource& source);
+
+	static uint32_t compileCompute(const ShaderProgramSource& source);
+	static bool getShaderErrors(uint32_t shaderHandler);
+	static bool getShaderProgramLinkError(uint32_t shaderHandlerProgram);
+	static std::string withDefines(const std::string& source, const std::string& defines);
+
+	std::string directory;
+	std::string driverId;
+	bool binarySupported = false;
+	bool queried = false;
+
+	std::mutex lock;
+	std::map<uint64_t, uint32_t> programs;
+};
@@ -0,0 +1,222 @@
+#include "streaming.h"
+
+#include <cstring>
+
+StreamingMesh::StreamingMesh(size_t _maxVertices, size_t _maxIndexes) :
+	maxVertices(_maxVertices),
+	maxIndexes(_maxIndexes)
+{
+	format.interleaved = true;
+	format.packedNormals = true;
+
+	// keep every region (and the index block inside it) aligned for the driver
+	auto align = [](size_t size) { return (size + 255) & ~size_t(255); };
+	indexOffset = align(maxVertices * format.stride());
+	regionSize = align(indexOffset + maxIndexes * format.indexSize());
+
+	glGenVertexArrays(1, &VAO);
+	glGenBuffers(1, &buffer);
+	glBindVertexArray(VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+
+	const size_t total_size = regionSize * RegionCount;
+	persistent = GLAD_GL_VERSION_4_4 != 0;
+	if (persistent)
+	{
+		const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_ARRAY_BUFFER, total_size, nullptr, flags);
+		mapped = static_cast<uint8_t*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, total_size, flags));
+	}
+	else
+	{
+		glBufferData(GL_ARRAY_BUFFER, total_size, nullptr, GL_DYNAMIC_DRAW);
+		staging.resize(total_size);
+		mapped = staging.data();
+	}
+
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+StreamingMesh::~StreamingMesh() {
+	close();
+}
+
+bool StreamingMesh::write(const Mesh& msh) {
+	const auto& vertices = msh.getVertices();
+	const auto& normals = msh.getNormals();
+	const auto& indexes = msh.getIndexes();
+	if (vertices.size() > maxVertices || indexes.size() > maxIndexes)
+		return false;
+
+	uint32_t region = NoRegion;
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		stateChanged.wait(guard, [&] {
+			if (closed)
+				return true;
+			for (uint32_t i = 0; i < RegionCount; i++)
+				if (regions[i].state == RegionState::Free)
+				{
+					region = i;
+					return true;
+				}
+			return false;
+		});
+		if (closed)
+			return false;
+		regions[region].state = RegionState::Writing;
+	}
+
+	// the region is owned by this thread until it is marked ready
+	uint8_t* dst = regionMemory(region);
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		VertexPacker::writePosition(format, vertices[i], dst + i * format.stride());
+		VertexPacker::writeNormal(format, normals[i], dst + i * format.stride() + format.positionSize());
+	}
+	std::memcpy(dst + indexOffset, indexes.data(), indexes.size() * sizeof(uint32_t));
+	MeshBounds bounds = BoundsBuilder::compute(msh);
+
+	std::lock_guard<std::mutex> guard(lock);
+	regions[region].bounds = std::move(bounds);
+	regions[region].countVertices = vertices.size();
+	regions[region].countElements = indexes.size();
+	regions[region].sequence = nextSequence++;
+	regions[region].state = RegionState::Ready;
+	stateChanged.notify_all();
+	return true;
+}
+
+void StreamingMesh::close() {
+	std::lock_guard<std::mutex> guard(lock);
+	closed = true;
+	stateChanged.notify_all();
+}
+
+void StreamingMesh::update() {
+	std::lock_guard<std::mutex> guard(lock);
+
+	bool freed = false;
+	uint32_t newest = NoRegion;
+	for (uint32_t i = 0; i < RegionCount; i++)
+	{
+		Region& region = regions[i];
+		if (region.state == RegionState::Retired)
+		{
+			GLenum status = glClientWaitSync(region.fence, 0, 0);
+			if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+			{
+				glDeleteSync(region.fence);
+				region.fence = nullptr;
+				region.state = RegionState::Free;
+				freed = true;
+			}
+		}
+		else if (region.state == RegionState::Ready)
+		{
+			if (newest != NoRegion && regions[newest].sequence < region.sequence)
+			{
+				// superseded before the GPU ever saw it
+				regions[newest].state = RegionState::Free;
+				freed = true;
+				newest = i;
+			}
+			else if (newest == NoRegion)
+				newest = i;
+			else
+			{
+				region.state = RegionState::Free;
+				freed = true;
+			}
+		}
+	}
+
+	if (newest != NoRegion)
+	{
+		if (displayed != NoRegion)
+		{
+			// draws already issued from the old region finish before this fence
+			regions[displayed].fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			regions[displayed].state = RegionState::Retired;
+		}
+		bindRegion(newest);
+		regions[newest].state = RegionState::Displayed;
+		displayed = newest;
+	}
+
+	if (freed)
+		stateChanged.notify_all();
+}
+
+void StreamingMesh::bindRegion(uint32_t region) {
+	glBindVertexArray(VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	if (!persistent)
+		glBufferSubData(GL_ARRAY_BUFFER, regionOffset(region), regionSize, regionMemory(region));
+
+	const size_t offset = regionOffset(region);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, format.stride(), (void*)(uintptr_t)offset);
+	glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, format.stride(), (void*)(uintptr_t)(offset + format.positionSize()));
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void StreamingMesh::draw() const {
+	const size_t offset = regionOffset(displayed) + indexOffset;
+	glDrawElements(GL_TRIANGLES, regions[displayed].countElements, GL_UNSIGNED_INT, (void*)(uintptr_t)offset);
+}
+
+void StreamingMesh::readBack(std::vector<glm::vec3>& vertices, std::vector<uint32_t>& indexes) const {
+	vertices.clear();
+	indexes.clear();
+	if (displayed == NoRegion)
+		return;
+	// the persistent mapping is write-only, so both paths read through GL
+	const Region& region = regions[displayed];
+	std::vector<uint8_t> packed(region.countVertices * format.stride());
+	indexes.resize(region.countElements);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glGetBufferSubData(GL_ARRAY_BUFFER, regionOffset(displayed), packed.size(), packed.data());
+	glGetBufferSubData(GL_ARRAY_BUFFER, regionOffset(displayed) + indexOffset, indexes.size() * sizeof(uint32_t), indexes.data());
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	vertices.resize(region.countVertices);
+	for (size_t i = 0; i < vertices.size(); i++)
+		std::memcpy(&vertices[i], packed.data() + i * format.stride(), sizeof(glm::vec3));
+}
+
+void StreamingMesh::release() {
+	close();
+	std::unique_lock<std::mutex> guard(lock);
+	// a writer that already owns a region may still be copying into it
+	stateChanged.wait(guard, [&] {
+		for (const auto& region : regions)
+			if (region.state == RegionState::Writing)
+				return false;
+		return true;
+	});
+	for (auto& region : regions)
+		if (region.fence)
+		{
+			glDeleteSync(region.fence);
+			region.fence = nullptr;
+		}
+
+	if (persistent && buffer)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, buffer);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+	glDeleteBuffers(1, &buffer);
+	glDeleteVertexArrays(1, &VAO);
+	buffer = 0;
+	VAO = 0;
+	mapped = nullptr;
+	displayed = NoRegion;
+}
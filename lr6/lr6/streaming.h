@@ -0,0 +1,103 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <cstdint>
+
+#include "figure.h"
+#include "vertex_format.h"
+#include "culling.h"
+
+// Dynamic geometry that worker threads write straight into GPU-visible memory.
+//
+// One buffer is split into RegionCount regions. With GL 4.4 the buffer is created
+// with glBufferStorage and mapped once (persistent + coherent); older contexts get
+// a CPU staging copy that is uploaded with glBufferSubData when a region is swapped in.
+// A region cycles Free -> Writing (worker) -> Ready -> Displayed -> Retired (fenced)
+// -> Free, so the CPU never overwrites memory the GPU may still read.
+class StreamingMesh {
+public:
+	static const uint32_t RegionCount = 3;
+
+	// GL thread
+	StreamingMesh(size_t maxVertices, size_t maxIndexes);
+	~StreamingMesh();
+
+	// any thread; waits only while every region is in flight, returns false if the
+	// mesh does not fit or the stream was closed
+	bool write(const Mesh& msh);
+	// wakes writers blocked in write(); later writes fail
+	void close();
+
+	// GL thread, once per frame: recycle regions whose fences signalled and swap
+	// in the newest ready one
+	void update();
+	// GL thread; deletes the buffer, VAO and pending fences
+	void release();
+
+	bool hasContent() const {
+		return displayed != NoRegion;
+	}
+	bool isPersistent() const {
+		return persistent;
+	}
+	uint32_t getVAO() const {
+		return VAO;
+	}
+	const MeshBounds& getBounds() const {
+		return regions[displayed].bounds;
+	}
+	void draw() const;
+	// GL thread; positions and indexes of the displayed region, read from the buffer (stalls)
+	void readBack(std::vector<glm::vec3>& vertices, std::vector<uint32_t>& indexes) const;
+
+private:
+	static const uint32_t NoRegion = UINT32_MAX;
+
+	enum class RegionState {
+		Free,
+		Writing,
+		Ready,
+		Displayed,
+		Retired
+	};
+	struct Region {
+		RegionState state = RegionState::Free;
+		GLsync fence = nullptr;
+		uint64_t sequence = 0;
+		size_t countVertices = 0;
+		size_t countElements = 0;
+		MeshBounds bounds;
+	};
+
+	uint8_t* regionMemory(uint32_t region) {
+		return mapped + region * regionSize;
+	}
+	size_t regionOffset(uint32_t region) const {
+		return region * regionSize;
+	}
+	void bindRegion(uint32_t region);
+
+	VertexFormat format;
+	size_t maxVertices;
+	size_t maxIndexes;
+	size_t indexOffset;
+	size_t regionSize;
+
+	bool persistent = false;
+	uint8_t* mapped = nullptr;
+	std::vector<uint8_t> staging;
+
+	uint32_t VAO = 0;
+	uint32_t buffer = 0;
+
+	std::mutex lock;
+	std::condition_variable stateChanged;
+	bool closed = false;
+	uint64_t nextSequence = 1;
+	Region regions[RegionCount];
+	uint32_t displayed = NoRegion;
+};
@@ -0,0 +1,327 @@
+#include "terrain.h"
+
+#include <algorithm>
+
+namespace {
+
+// SSE2 has no 32-bit mullo; multiply the even and odd lanes separately
+inline __m128i mullo(__m128i a, __m128i b) {
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+inline __m128 select(__m128 mask, __m128 a, __m128 b) {
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+inline __m128 floor4(__m128 x) {
+	__m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+	return _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, x), _mm_set1_ps(1.0f)));
+}
+
+inline __m128i hash4(__m128i i, __m128i j, __m128i k, __m128i seed) {
+	__m128i h = _mm_xor_si128(_mm_xor_si128(mullo(i, _mm_set1_epi32(73856093)), mullo(j, _mm_set1_epi32(19349663))),
+		_mm_xor_si128(mullo(k, _mm_set1_epi32(83492791)), seed));
+	h = _mm_xor_si128(h, _mm_srli_epi32(h, 13));
+	h = mullo(h, _mm_set1_epi32(0x5bd1e995));
+	return _mm_xor_si128(h, _mm_srli_epi32(h, 15));
+}
+
+// dot with one of the 12 cube edge directions picked by the low hash bits, as in improved Perlin noise
+inline __m128 gradient4(__m128i h, __m128 x, __m128 y, __m128 z) {
+	const __m128i low = _mm_and_si128(h, _mm_set1_epi32(15));
+	const __m128 lt8 = _mm_castsi128_ps(_mm_cmplt_epi32(low, _mm_set1_epi32(8)));
+	const __m128 lt4 = _mm_castsi128_ps(_mm_cmplt_epi32(low, _mm_set1_epi32(4)));
+	const __m128 x_instead = _mm_castsi128_ps(_mm_or_si128(_mm_cmpeq_epi32(low, _mm_set1_epi32(12)), _mm_cmpeq_epi32(low, _mm_set1_epi32(14))));
+	__m128 u = select(lt8, x, y);
+	__m128 v = select(lt4, y, select(x_instead, x, z));
+	u = _mm_xor_ps(u, _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(low, _mm_set1_epi32(1)), 31)));
+	v = _mm_xor_ps(v, _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(low, _mm_set1_epi32(2)), 30)));
+	return _mm_add_ps(u, v);
+}
+
+inline __m128 corner4(__m128 x, __m128 y, __m128 z, __m128i h) {
+	__m128 t = _mm_sub_ps(_mm_set1_ps(0.6f), _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+	t = _mm_max_ps(t, _mm_setzero_ps());
+	t = _mm_mul_ps(t, t);
+	return _mm_mul_ps(_mm_mul_ps(t, t), gradient4(h, x, y, z));
+}
+
+}
+
+__m128 SimplexNoise::noise4(__m128 x, __m128 y, __m128 z, uint32_t seed) {
+	const __m128 F3 = _mm_set1_ps(1.0f / 3.0f);
+	const __m128 G3 = _mm_set1_ps(1.0f / 6.0f);
+	const __m128 one = _mm_set1_ps(1.0f);
+
+	// skew to the simplex grid and find the containing cell
+	__m128 s = _mm_mul_ps(_mm_add_ps(_mm_add_ps(x, y), z), F3);
+	__m128 fi = floor4(_mm_add_ps(x, s));
+	__m128 fj = floor4(_mm_add_ps(y, s));
+	__m128 fk = floor4(_mm_add_ps(z, s));
+	__m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(fi, fj), fk), G3);
+	__m128 x0 = _mm_sub_ps(x, _mm_sub_ps(fi, t));
+	__m128 y0 = _mm_sub_ps(y, _mm_sub_ps(fj, t));
+	__m128 z0 = _mm_sub_ps(z, _mm_sub_ps(fk, t));
+
+	// which of the six tetrahedra of the cell, from the order of x0, y0, z0
+	const __m128 xy = _mm_cmpge_ps(x0, y0);
+	const __m128 yz = _mm_cmpge_ps(y0, z0);
+	const __m128 xz = _mm_cmpge_ps(x0, z0);
+	const __m128 i1 = _mm_and_ps(xy, xz);
+	const __m128 j1 = _mm_andnot_ps(xy, yz);
+	const __m128 k1 = _mm_andnot_ps(_mm_or_ps(yz, xz), _mm_castsi128_ps(_mm_set1_epi32(-1)));
+	const __m128 i2 = _mm_or_ps(xy, xz);
+	const __m128 j2 = _mm_or_ps(_mm_andnot_ps(xy, _mm_castsi128_ps(_mm_set1_epi32(-1))), yz);
+	const __m128 k2 = _mm_andnot_ps(_mm_and_ps(yz, xz), _mm_castsi128_ps(_mm_set1_epi32(-1)));
+
+	__m128 x1 = _mm_add_ps(_mm_sub_ps(x0, _mm_and_ps(i1, one)), G3);
+	__m128 y1 = _mm_add_ps(_mm_sub_ps(y0, _mm_and_ps(j1, one)), G3);
+	__m128 z1 = _mm_add_ps(_mm_sub_ps(z0, _mm_and_ps(k1, one)), G3);
+	__m128 x2 = _mm_add_ps(_mm_sub_ps(x0, _mm_and_ps(i2, one)), _mm_add_ps(G3, G3));
+	__m128 y2 = _mm_add_ps(_mm_sub_ps(y0, _mm_and_ps(j2, one)), _mm_add_ps(G3, G3));
+	__m128 z2 = _mm_add_ps(_mm_sub_ps(z0, _mm_and_ps(k2, one)), _mm_add_ps(G3, G3));
+	const __m128 G3x3 = _mm_set1_ps(0.5f);
+	__m128 x3 = _mm_add_ps(_mm_sub_ps(x0, one), G3x3);
+	__m128 y3 = _mm_add_ps(_mm_sub_ps(y0, one), G3x3);
+	__m128 z3 = _mm_add_ps(_mm_sub_ps(z0, one), G3x3);
+
+	// a true mask is -1, so subtracting it steps the cell coordinate
+	const __m128i ii = _mm_cvttps_epi32(fi), jj = _mm_cvttps_epi32(fj), kk = _mm_cvttps_epi32(fk);
+	const __m128i seeds = _mm_set1_epi32(static_cast<int>(seed));
+	const __m128i step = _mm_set1_epi32(1);
+	__m128i h0 = hash4(ii, jj, kk, seeds);
+	__m128i h1 = hash4(_mm_sub_epi32(ii, _mm_castps_si128(i1)), _mm_sub_epi32(jj, _mm_castps_si128(j1)), _mm_sub_epi32(kk, _mm_castps_si128(k1)), seeds);
+	__m128i h2 = hash4(_mm_sub_epi32(ii, _mm_castps_si128(i2)), _mm_sub_epi32(jj, _mm_castps_si128(j2)), _mm_sub_epi32(kk, _mm_castps_si128(k2)), seeds);
+	__m128i h3 = hash4(_mm_add_epi32(ii, step), _mm_add_epi32(jj, step), _mm_add_epi32(kk, step), seeds);
+
+	__m128 sum = _mm_add_ps(_mm_add_ps(corner4(x0, y0, z0, h0), corner4(x1, y1, z1, h1)),
+		_mm_add_ps(corner4(x2, y2, z2, h2), corner4(x3, y3, z3, h3)));
+	return _mm_mul_ps(sum, _mm_set1_ps(32.0f));
+}
+
+void SimplexNoise::fbm(const NoiseOctaves& octaves, const float* x, const float* y, const float* z, float* out, size_t count) {
+	float total = 0.0f;
+	for (uint32_t octave = 0; octave < octaves.octaves; octave++)
+		total += glm::pow(octaves.gain, float(octave));
+	const __m128 normalise = _mm_set1_ps(total > 0.0f ? 1.0f / total : 0.0f);
+
+	for (size_t i = 0; i < count; i += 4)
+	{
+		// the tail is evaluated in a padded copy
+		alignas(16) float px[4] = {}, py[4] = {}, pz[4] = {}, result[4];
+		const size_t lanes = std::min<size_t>(4, count - i);
+		for (size_t lane = 0; lane < lanes; lane++)
+		{
+			px[lane] = x[i + lane];
+			py[lane] = y[i + lane];
+			pz[lane] = z[i + lane];
+		}
+		__m128 vx = _mm_load_ps(px), vy = _mm_load_ps(py), vz = _mm_load_ps(pz);
+
+		__m128 sum = _mm_setzero_ps();
+		float frequency = octaves.frequency, amplitude = 1.0f;
+		for (uint32_t octave = 0; octave < octaves.octaves; octave++)
+		{
+			const __m128 f = _mm_set1_ps(frequency);
+			__m128 n = noise4(_mm_mul_ps(vx, f), _mm_mul_ps(vy, f), _mm_mul_ps(vz, f), octaves.seed + octave * 0x9e3779b9u);
+			sum = _mm_add_ps(sum, _mm_mul_ps(n, _mm_set1_ps(amplitude)));
+			frequency *= octaves.lacunarity;
+			amplitude *= octaves.gain;
+		}
+		_mm_store_ps(result, _mm_mul_ps(sum, normalise));
+		for (size_t lane = 0; lane < lanes; lane++)
+			out[i + lane] = result[lane];
+	}
+}
+
+float SimplexNoise::fbm(const NoiseOctaves& octaves, const glm::vec3& p) {
+	float result;
+	fbm(octaves, &p.x, &p.y, &p.z, &result, 1);
+	return result;
+}
+
+DisplacedSphere::DisplacedSphere(const TerrainSettings& _settings) :
+	settings(_settings)
+{
+}
+
+void DisplacedSphere::update(const Mesh& sphere, ThreadPool& pool) {
+	const size_t known = vertex.size();
+	const size_t count = sphere.getVertices().size();
+	if (count < known)
+		throw std::exception("DisplacedSphere: the source lost vertices; it can only be refined");
+	update(sphere, pool, known, count - known);
+}
+
+void DisplacedSphere::update(const Mesh& sphere, ThreadPool& pool, size_t firstVertex, size_t count) {
+	const auto& source = sphere.getVertices();
+	if (source.empty())
+		return;
+	if (radius == 0.0f)
+		radius = glm::length(source[0]);
+	if (vertex.size() < source.size())
+	{
+		vertex.resize(source.size());
+		height.resize(source.size());
+	}
+	displace(sphere, pool, firstVertex, count);
+
+	index = sphere.getIndexes();
+	patches = sphere.getPatches();
+	computeNormals(pool);
+	changed.clear();
+	whole = true;
+}
+
+void DisplacedSphere::update(const Mesh& sphere, ThreadPool& pool, const std::vector<uint32_t>& changedVertices, const std::vector<uint32_t>& changedPatches) {
+	const auto& source = sphere.getVertices();
+	const auto& source_indexes = sphere.getIndexes();
+	const auto& source_patches = sphere.getPatches();
+	bool moved = vertex.empty() || index.size() != source_indexes.size() || patches.size() != source_patches.size();
+	for (size_t p = 0; p < patches.size() && !moved; p++)
+		moved = patches[p].firstIndex != source_patches[p].firstIndex;
+	if (moved)
+	{
+		// without a previous state every vertex is new
+		if (vertex.empty())
+			update(sphere, pool, 0, source.size());
+		else
+		{
+			vertex.resize(source.size());
+			height.resize(source.size());
+			displace(sphere, pool, 0, changedVertices.size(), changedVertices.data());
+			index = source_indexes;
+			patches = source_patches;
+			computeNormals(pool);
+			changed.clear();
+			whole = true;
+		}
+		return;
+	}
+
+	vertex.resize(source.size());
+	height.resize(source.size());
+	normal.resize(source.size());
+	normalSum.resize(source.size(), glm::vec3(0.0f));
+	displace(sphere, pool, 0, changedVertices.size(), changedVertices.data());
+
+	// the old triangles leave the sums with the areas they were added with
+	touched.clear();
+	for (uint32_t p : changedPatches)
+		for (uint32_t t = patches[p].firstIndex / 3; t < (patches[p].firstIndex + patches[p].countIndexes) / 3; t++)
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				normalSum[index[t * 3 + k]] -= faceArea[t];
+				touched.push_back(index[t * 3 + k]);
+			}
+	// a reused id has no triangles left; clearing it drops the rounding the subtraction left
+	for (uint32_t v : changedVertices)
+		normalSum[v] = glm::vec3(0.0f);
+
+	for (uint32_t p : changedPatches)
+	{
+		const MeshPatch& old_range = patches[p];
+		const MeshPatch& range = source_patches[p];
+		std::copy(source_indexes.begin() + range.firstIndex, source_indexes.begin() + range.firstIndex + range.countIndexes, index.begin() + range.firstIndex);
+		// what the patch no longer uses is the source's padding
+		if (range.countIndexes < old_range.countIndexes)
+		{
+			std::copy(source_indexes.begin() + range.firstIndex + range.countIndexes, source_indexes.begin() + old_range.firstIndex + old_range.countIndexes,
+				index.begin() + range.firstIndex + range.countIndexes);
+			std::fill(faceArea.begin() + (range.firstIndex + range.countIndexes) / 3, faceArea.begin() + (old_range.firstIndex + old_range.countIndexes) / 3, glm::vec3(0.0f));
+			std::fill(normalFace.begin() + (range.firstIndex + range.countIndexes) / 3, normalFace.begin() + (old_range.firstIndex + old_range.countIndexes) / 3, glm::vec3(0.0f));
+		}
+		patches[p] = range;
+	}
+	pool.parallelFor(changedPatches.size(), 1, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+			computeFaces(patches[changedPatches[i]].firstIndex / 3, patches[changedPatches[i]].countIndexes / 3);
+	});
+	for (uint32_t p : changedPatches)
+		for (uint32_t t = patches[p].firstIndex / 3; t < (patches[p].firstIndex + patches[p].countIndexes) / 3; t++)
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				normalSum[index[t * 3 + k]] += faceArea[t];
+				touched.push_back(index[t * 3 + k]);
+			}
+
+	// once each and in order, for uploads merging neighbouring ids; a flag per vertex
+	// instead of sorting the repeats
+	touched.insert(touched.end(), changedVertices.begin(), changedVertices.end());
+	marked.resize(vertex.size(), 0);
+	changed.clear();
+	for (uint32_t v : touched)
+		if (!marked[v])
+		{
+			marked[v] = 1;
+			changed.push_back(v);
+		}
+	std::sort(changed.begin(), changed.end());
+	for (uint32_t v : changed)
+	{
+		marked[v] = 0;
+		const float length = glm::length(normalSum[v]);
+		normal[v] = length > 0.0f ? normalSum[v] / length : glm::normalize(vertex[v]);
+	}
+	whole = false;
+}
+
+void DisplacedSphere::displace(const Mesh& sphere, ThreadPool& pool, size_t first, size_t count, const uint32_t* ids) {
+	const auto& source = sphere.getVertices();
+	pool.parallelFor(count, 4096, [&](size_t begin, size_t end) {
+		// noise is sampled on the unit sphere, so it does not depend on the radius
+		std::vector<float> x(end - begin), y(end - begin), z(end - begin), noise(end - begin);
+		for (size_t i = begin; i < end; i++)
+		{
+			glm::vec3 direction = source[ids ? ids[first + i] : first + i] / radius;
+			x[i - begin] = direction.x;
+			y[i - begin] = direction.y;
+			z[i - begin] = direction.z;
+		}
+		SimplexNoise::fbm(settings.noise, x.data(), y.data(), z.data(), noise.data(), end - begin);
+		for (size_t i = begin; i < end; i++)
+		{
+			const size_t v = ids ? ids[first + i] : first + i;
+			height[v] = noise[i - begin];
+			vertex[v] = glm::vec3(x[i - begin], y[i - begin], z[i - begin]) * (radius * (1.0f + settings.amplitude * height[v]));
+		}
+	});
+}
+
+void DisplacedSphere::computeFaces(size_t first, size_t count) {
+	for (size_t t = first; t < first + count; t++)
+	{
+		const glm::vec3& p0 = vertex[index[t * 3]];
+		faceArea[t] = glm::cross(vertex[index[t * 3 + 1]] - p0, vertex[index[t * 3 + 2]] - p0);
+		// degenerate padding triangles have no direction
+		const float length = glm::length(faceArea[t]);
+		normalFace[t] = length > 0.0f ? faceArea[t] / length : glm::vec3(0.0f);
+	}
+}
+
+void DisplacedSphere::computeNormals(ThreadPool& pool) {
+	// area-weighted sums over flat arrays instead of per-vertex triangle lists
+	const size_t triangles = index.size() / 3;
+	faceArea.resize(triangles);
+	normalFace.resize(triangles);
+	pool.parallelFor(triangles, 8192, [&](size_t begin, size_t end) {
+		computeFaces(begin, end - begin);
+	});
+
+	normalSum.assign(vertex.size(), glm::vec3(0.0f));
+	for (size_t t = 0; t < triangles; t++)
+		for (size_t k = 0; k < 3; k++)
+			normalSum[index[t * 3 + k]] += faceArea[t];
+
+	normal.resize(vertex.size());
+	pool.parallelFor(normal.size(), 8192, [&](size_t begin, size_t end) {
+		for (size_t v = begin; v < end; v++)
+		{
+			const float length = glm::length(normalSum[v]);
+			// vertices no triangle uses point outwards
+			normal[v] = length > 0.0f ? normalSum[v] / length : glm::normalize(vertex[v]);
+		}
+	});
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include <immintrin.h>
+#include <glm.hpp>
+
+#include "figure.h"
+#include "thread_pool.h"
+
+struct NoiseOctaves {
+	uint32_t octaves = 6;
+	float frequency = 1.5f;  // of the first octave, per unit of the unit sphere
+	float lacunarity = 2.0f; // frequency step between octaves
+	float gain = 0.5f;       // amplitude step between octaves
+	uint32_t seed = 0;
+};
+
+// 3D simplex noise with hashed gradients instead of a permutation table, so four
+// points are evaluated together in SSE2 registers with no gathers.
+class SimplexNoise {
+public:
+	// fractal sum over the octaves, about [-1, 1], for count points given as x, y, z arrays
+	static void fbm(const NoiseOctaves& octaves, const float* x, const float* y, const float* z, float* out, size_t count);
+	static float fbm(const NoiseOctaves& octaves, const glm::vec3& p);
+
+	static __m128 noise4(__m128 x, __m128 y, __m128 z, uint32_t seed);
+};
+
+struct TerrainSettings {
+	NoiseOctaves noise;
+	float amplitude = 0.05f; // height of the noise extremes, as a fraction of the radius
+};
+
+// A sphere mesh moved along its radius by SimplexNoise, sampled on the unit direction of
+// every vertex. A height only depends on where the vertex lies on the sphere, so after
+// the source is refined only its new vertices need noise. A uniformly refined source
+// (Icosaedr) replaces every triangle, so its indexes are copied and all normals rebuilt;
+// there the saving is the noise alone, and a level costs about as much as from scratch.
+//
+// Vertex normals are kept as area-weighted sums, so a source that reports what it
+// rewrote (AdaptiveIcosphere) is followed incrementally: its changed vertices are
+// displaced, the old triangles of its changed patches are taken out of the sums, the new
+// ones added, and only the vertices of those triangles are renormalised.
+class DisplacedSphere : public Mesh {
+public:
+	explicit DisplacedSphere(const TerrainSettings& _settings = TerrainSettings());
+
+	// displaces the vertices the source gained since the last update, which is all of
+	// them the first time; for sources that only append vertices, as Icosaedr does when
+	// refined. Indexes and normals follow the source.
+	void update(const Mesh& sphere, ThreadPool& pool);
+	// for a source that rewrote [firstVertex, firstVertex + count) in place
+	void update(const Mesh& sphere, ThreadPool& pool, size_t firstVertex, size_t count);
+	// for a source that reuses vertex ids and rewrites getPatches() ranges in place, e.g.
+	// update(adaptive, pool, adaptive.changedVertices(), adaptive.changedFaces()). Every
+	// triangle using a changed vertex must lie in a changed patch. A source whose patch
+	// ranges moved, and the first update, are taken over whole.
+	void update(const Mesh& sphere, ThreadPool& pool, const std::vector<uint32_t>& changedVertices, const std::vector<uint32_t>& changedPatches);
+
+	const std::vector<float>& getHeights() const {
+		return height;
+	}
+	// after the patch-wise update: vertex ids whose position or normal it rewrote, ascending
+	const std::vector<uint32_t>& changedVertices() const {
+		return changed;
+	}
+	// the last update took the source over whole, so every vertex and index may differ
+	bool rebuilt() const {
+		return whole;
+	}
+
+	const std::vector<glm::vec3>& getVertices() const override {
+		return vertex;
+	}
+	const std::vector<glm::vec3>& getNormals() const override {
+		return normal;
+	}
+	const std::vector<uint32_t>& getIndexes() const override {
+		return index;
+	}
+	const std::vector<glm::vec3>& getFaceNormals() const override {
+		return normalFace;
+	}
+	const std::vector<MeshPatch>& getPatches() const override {
+		return patches;
+	}
+
+private:
+	// vertices first .. first + count - 1, or ids[first ..] when ids are given
+	void displace(const Mesh& sphere, ThreadPool& pool, size_t first, size_t count, const uint32_t* ids = nullptr);
+	void computeNormals(ThreadPool& pool);
+	// the areas of triangles [first, first + count) into faceArea and normalFace
+	void computeFaces(size_t first, size_t count);
+
+	TerrainSettings settings;
+	float radius = 0.0f; // of the source, from its first vertex
+
+	std::vector<float> height; // noise value per vertex
+	std::vector<glm::vec3> faceArea; // unnormalised face normals, weighting the vertex sums
+	std::vector<glm::vec3> normalSum; // per vertex, the faceArea of its triangles
+	std::vector<uint32_t> touched;    // vertices of the rewritten triangles, with repeats
+	std::vector<uint8_t> marked;      // per vertex, while touched is reduced to changed
+	std::vector<uint32_t> changed;
+	bool whole = true;
+	std::vector<glm::vec3> vertex;
+	std::vector<glm::vec3> normal;
+	std::vector<uint32_t> index;
+	std::vector<glm::vec3> normalFace;
+	std::vector<MeshPatch> patches;
+};
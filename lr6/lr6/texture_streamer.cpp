@@ -0,0 +1,184 @@
+#include "texture_streamer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <iostream>
+
+TextureStreamer::TextureStreamer(uint32_t threadCount) :
+	decoders(threadCount)
+{
+}
+
+uint32_t TextureStreamer::request(const std::string& path, MipFilter filter) {
+	Entry* entry;
+	uint32_t handle;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		auto found = handles.find(path);
+		if (found != handles.end())
+			return found->second;
+		entries.push_back(std::make_unique<Entry>());
+		entry = entries.back().get();
+		entry->path = path;
+		entry->filter = filter;
+		handle = static_cast<uint32_t>(entries.size());
+		handles.emplace(path, handle);
+		pending++;
+	}
+	decoders.submit([this, entry]() { decode(*entry); });
+	return handle;
+}
+
+void TextureStreamer::decode(Entry& entry) {
+	std::vector<Image> levels;
+	bool failed = false;
+	try {
+		levels = MipChain::build(ImageDecoder::decode(entry.path), entry.filter);
+	}
+	catch (std::exception& ex) {
+		std::cout << "\t\t[TEXTURES] " << ex.what() << std::endl;
+		failed = true;
+	}
+
+	std::lock_guard<std::mutex> guard(lock);
+	entry.levels = std::move(levels);
+	entry.failed = failed;
+	entry.decoded = true;
+	if (failed)
+		pending--;
+	else
+		decodedQueue.push_back(&entry);
+}
+
+void TextureStreamer::createTexture(Entry& entry) {
+	const GLsizei level_count = static_cast<GLsizei>(entry.levels.size());
+	glGenTextures(1, &entry.texture);
+	glBindTexture(GL_TEXTURE_2D, entry.texture);
+	if (GLAD_GL_VERSION_4_2)
+		glTexStorage2D(GL_TEXTURE_2D, level_count, GL_RGBA8, entry.levels[0].width, entry.levels[0].height);
+	else
+		for (GLsizei level = 0; level < level_count; level++)
+			glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, entry.levels[level].width, entry.levels[level].height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+	// u wraps around the sphere, v runs pole to pole
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level_count - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level_count - 1);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	entry.uploadLevel = level_count - 1;
+	entry.uploadRow = 0;
+}
+
+bool TextureStreamer::uploadRows(Entry& entry, size_t& budget) {
+	glBindTexture(GL_TEXTURE_2D, entry.texture);
+	while (entry.uploadLevel >= 0)
+	{
+		Image& image = entry.levels[entry.uploadLevel];
+		const size_t row_bytes = size_t(image.width) * 4;
+		// at least one row, so a budget below a row still makes progress
+		const uint32_t rows = static_cast<uint32_t>(std::min<size_t>(image.height - entry.uploadRow, std::max<size_t>(budget / row_bytes, 1)));
+		const size_t bytes = rows * row_bytes;
+
+		// appended to the buffer until it is full, then orphaned, as the indirect commands are
+		if (unpackOffset + bytes > unpackCapacity)
+		{
+			unpackCapacity = std::max(unpackCapacity, std::max<size_t>(bytes, 4 * 1024 * 1024));
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, unpackCapacity, NULL, GL_STREAM_DRAW);
+			unpackOffset = 0;
+		}
+		void* target = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, unpackOffset, bytes,
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		std::memcpy(target, &image.pixels[entry.uploadRow * row_bytes], bytes);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		// image rows go top first, so v = 0 ends up at t = 0
+		glTexSubImage2D(GL_TEXTURE_2D, entry.uploadLevel, 0, entry.uploadRow, image.width, rows, GL_RGBA, GL_UNSIGNED_BYTE,
+			(void*)(uintptr_t)unpackOffset);
+		unpackOffset += bytes;
+		budget -= std::min(budget, bytes);
+		entry.uploadRow += rows;
+
+		if (entry.uploadRow == image.height)
+		{
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, entry.uploadLevel);
+			image = Image();
+			entry.uploadLevel--;
+			entry.uploadRow = 0;
+		}
+		if (budget == 0)
+			break;
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return entry.uploadLevel < 0;
+}
+
+void TextureStreamer::poll(size_t budgetBytes) {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		for (Entry* entry : decodedQueue)
+			uploading.push_back(entry);
+		decodedQueue.clear();
+	}
+	if (uploading.empty())
+		return;
+	if (unpackBuffer == 0)
+		glGenBuffers(1, &unpackBuffer);
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, unpackBuffer);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	size_t budget = budgetBytes;
+	// every texture first gets its coarse levels before any one gets its full resolution
+	for (Entry* entry : uploading)
+		if (entry->texture == 0)
+		{
+			createTexture(*entry);
+			uploadRows(*entry, budget);
+		}
+	size_t finished = 0;
+	for (Entry*& entry : uploading)
+	{
+		if (budget > 0)
+			uploadRows(*entry, budget);
+		if (entry->uploadLevel < 0)
+		{
+			entry->levels.clear();
+			entry = nullptr;
+			finished++;
+		}
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	uploading.erase(std::remove(uploading.begin(), uploading.end(), nullptr), uploading.end());
+
+	std::lock_guard<std::mutex> guard(lock);
+	pending -= finished;
+}
+
+uint32_t TextureStreamer::texture(uint32_t handle) const {
+	std::lock_guard<std::mutex> guard(lock);
+	if (handle == 0 || handle > entries.size())
+		return 0;
+	return entries[handle - 1]->texture;
+}
+
+bool TextureStreamer::idle() const {
+	std::lock_guard<std::mutex> guard(lock);
+	return pending == 0;
+}
+
+void TextureStreamer::release() {
+	std::lock_guard<std::mutex> guard(lock);
+	for (auto& entry : entries)
+		if (entry->texture)
+		{
+			glDeleteTextures(1, &entry->texture);
+			entry->texture = 0;
+		}
+	uploading.clear();
+	decodedQueue.clear();
+	glDeleteBuffers(1, &unpackBuffer);
+	unpackBuffer = 0;
+}
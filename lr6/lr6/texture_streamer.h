@@ -0,0 +1,67 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "image.h"
+#include "mip_chain.h"
+#include "thread_pool.h"
+
+// Loads textures without stalling the GL thread. Decoding and mip generation run as
+// tasks on the streamer's own ThreadPool; poll() then creates the texture and copies
+// levels into it through a streamed pixel unpack buffer, coarsest first and within a
+// byte budget per call. GL_TEXTURE_BASE_LEVEL follows the finest complete level, so
+// a texture can be sampled from its first 1x1 level on and sharpens as levels arrive.
+class TextureStreamer {
+public:
+	explicit TextureStreamer(uint32_t threadCount = 2);
+
+	// any thread; a handle (never 0) right away, the same one for a path already requested
+	uint32_t request(const std::string& path, MipFilter filter = MipFilter::Kaiser);
+	// GL thread; uploads at most budgetBytes of texels
+	void poll(size_t budgetBytes);
+	// GL thread; 0 until the first level is resident or if the image failed to load
+	uint32_t texture(uint32_t handle) const;
+	// every requested texture is complete (or failed)
+	bool idle() const;
+	// GL thread
+	void release();
+
+private:
+	struct Entry {
+		std::string path;
+		MipFilter filter = MipFilter::Kaiser;
+		std::vector<Image> levels; // filled by the decode task, emptied level by level on upload
+		uint32_t texture = 0;
+		int32_t uploadLevel = -1;  // level being copied, -1 once done
+		uint32_t uploadRow = 0;    // rows of uploadLevel already copied
+		bool decoded = false;
+		bool failed = false;
+	};
+
+	void decode(Entry& entry);
+	void createTexture(Entry& entry);
+	// false when the budget ran out first
+	bool uploadRows(Entry& entry, size_t& budget);
+
+	mutable std::mutex lock;
+	std::vector<std::unique_ptr<Entry>> entries; // handle - 1
+	std::map<std::string, uint32_t> handles;
+	std::deque<Entry*> decodedQueue; // decoded, not yet created on the GL side
+	std::vector<Entry*> uploading;   // GL thread only
+	size_t pending = 0;              // requested, not yet complete or failed
+
+	uint32_t unpackBuffer = 0;
+	size_t unpackCapacity = 0;
+	size_t unpackOffset = 0;
+
+	// declared last so it is destroyed first: queued decode tasks finish while entries still exist
+	ThreadPool decoders;
+};
@@ -0,0 +1,133 @@
+#include "textured_sphere.h"
+
+#include <cmath>
+#include <unordered_map>
+
+TexturedSphere::TexturedSphere(const Mesh& sphere) :
+	sphereVertex(sphere.getVertices()),
+	vertex(sphere.getVertices()),
+	index(sphere.getIndexes()),
+	patches(sphere.getPatches())
+{
+	if (vertex.empty())
+		return;
+	radius = glm::length(vertex[0]);
+	sourceCount = vertex.size();
+
+	const float pi = glm::pi<float>();
+	std::vector<uint8_t> pole(sourceCount);
+	uv.resize(sourceCount);
+	sourceVertex.resize(sourceCount);
+	for (uint32_t i = 0; i < sourceCount; i++)
+	{
+		const glm::vec3 direction = vertex[i] / glm::length(vertex[i]);
+		pole[i] = glm::abs(direction.z) > 1.0f - 1e-6f;
+		uv[i] = glm::vec2(std::atan2(direction.y, direction.x) / (2.0f * pi) + 0.5f, glm::acos(glm::clamp(direction.z, -1.0f, 1.0f)) / pi);
+		sourceVertex[i] = i;
+	}
+
+	std::unordered_map<uint32_t, uint32_t> seam_copies; // source vertex -> its copy at u + 1
+	for (size_t t = 0; t < index.size(); t += 3)
+	{
+		float min_u = 2.0f, max_u = -1.0f;
+		for (size_t k = 0; k < 3; k++)
+			if (!pole[index[t + k]])
+			{
+				min_u = glm::min(min_u, uv[index[t + k]].x);
+				max_u = glm::max(max_u, uv[index[t + k]].x);
+			}
+
+		if (max_u - min_u > 0.5f)
+			for (size_t k = 0; k < 3; k++)
+			{
+				const uint32_t v = index[t + k];
+				if (pole[v] || uv[v].x >= 0.5f)
+					continue;
+				auto found = seam_copies.find(v);
+				if (found == seam_copies.end())
+					found = seam_copies.emplace(v, addCopy(v, uv[v] + glm::vec2(1.0f, 0.0f))).first;
+				index[t + k] = found->second;
+			}
+
+		for (size_t k = 0; k < 3; k++)
+		{
+			const uint32_t v = index[t + k];
+			if (v >= sourceCount || !pole[v])
+				continue;
+			const float u = (uv[index[t + (k + 1) % 3]].x + uv[index[t + (k + 2) % 3]].x) / 2.0f;
+			index[t + k] = addCopy(v, glm::vec2(u, uv[v].y));
+		}
+	}
+	computeNormals();
+}
+
+uint32_t TexturedSphere::addCopy(uint32_t v, const glm::vec2& coordinates) {
+	const uint32_t copy = static_cast<uint32_t>(vertex.size());
+	sphereVertex.push_back(sphereVertex[v]);
+	vertex.push_back(vertex[v]);
+	sourceVertex.push_back(sourceVertex[v]);
+	uv.push_back(coordinates);
+	return copy;
+}
+
+void TexturedSphere::displace(const Heightmap& heightmap, float amplitude, ThreadPool& pool) {
+	// a triangle covers about 4 pi / triangles steradians; its edge is the side of an
+	// equilateral triangle of that area
+	const float triangles = float(glm::max<size_t>(index.size() / 3, 1));
+	const float edge_angle = glm::sqrt(16.0f * glm::pi<float>() / (glm::sqrt(3.0f) * triangles));
+	const uint32_t level = heightmap.levelFor(edge_angle);
+	const float north = heightmap.poleHeight(level, true);
+	const float south = heightmap.poleHeight(level, false);
+
+	// the source vertices have canonical coordinates; seam and pole copies take their result
+	pool.parallelFor(sourceCount, 4096, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i += 4)
+		{
+			alignas(16) float u[4] = {}, v[4] = {}, height[4];
+			const size_t lanes = glm::min<size_t>(4, end - i);
+			for (size_t lane = 0; lane < lanes; lane++)
+			{
+				u[lane] = uv[i + lane].x;
+				v[lane] = uv[i + lane].y;
+			}
+			_mm_store_ps(height, heightmap.sample4(level, _mm_load_ps(u), _mm_load_ps(v)));
+
+			for (size_t lane = 0; lane < lanes; lane++)
+			{
+				const glm::vec3& p = sphereVertex[i + lane];
+				const glm::vec3 direction = p / glm::length(p);
+				// the pole rows are single points on the sphere
+				float h = height[lane];
+				if (direction.z > 1.0f - 1e-6f)
+					h = north;
+				else if (direction.z < -1.0f + 1e-6f)
+					h = south;
+				vertex[i + lane] = direction * (radius * (1.0f + amplitude * h));
+			}
+		}
+	});
+	for (size_t i = sourceCount; i < vertex.size(); i++)
+		vertex[i] = vertex[sourceVertex[i]];
+	computeNormals();
+}
+
+void TexturedSphere::computeNormals() {
+	std::vector<glm::vec3> sums(sourceCount, glm::vec3(0.0f));
+	normalFace.resize(index.size() / 3);
+	for (size_t t = 0; t < index.size(); t += 3)
+	{
+		const glm::vec3& p0 = vertex[index[t]];
+		const glm::vec3 area = glm::cross(vertex[index[t + 1]] - p0, vertex[index[t + 2]] - p0);
+		normalFace[t / 3] = glm::normalize(area);
+		for (size_t k = 0; k < 3; k++)
+			sums[sourceVertex[index[t + k]]] += area;
+	}
+
+	normal.resize(vertex.size());
+	for (size_t i = 0; i < vertex.size(); i++)
+	{
+		const glm::vec3& sum = sums[sourceVertex[i]];
+		const float length = glm::length(sum);
+		normal[i] = length > 0.0f ? sum / length : glm::normalize(vertex[i]);
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include <glm.hpp>
+
+#include "figure.h"
+#include "heightmap.h"
+#include "thread_pool.h"
+
+// A sphere mesh with equirectangular texture coordinates around the z axis: u from the
+// longitude, v from the polar angle, v = 0 at +z. Triangles crossing the u = 0 seam get
+// copies of their low-u vertices at u + 1, and every triangle at a pole gets its own
+// copy of the pole at the u of its other corners, so nothing is stretched across the
+// texture. Copies keep the position of their source vertex.
+class TexturedSphere : public Mesh {
+public:
+	explicit TexturedSphere(const Mesh& sphere);
+
+	// moves every vertex along its radius by amplitude * radius * height, from the
+	// heightmap level that matches the triangle size; copies move with their source
+	void displace(const Heightmap& heightmap, float amplitude, ThreadPool& pool);
+
+	const std::vector<glm::vec2>& getUVs() const {
+		return uv;
+	}
+	// the vertex of the source mesh each vertex was made from
+	const std::vector<uint32_t>& getSourceVertices() const {
+		return sourceVertex;
+	}
+
+	const std::vector<glm::vec3>& getVertices() const override {
+		return vertex;
+	}
+	const std::vector<glm::vec3>& getNormals() const override {
+		return normal;
+	}
+	const std::vector<uint32_t>& getIndexes() const override {
+		return index;
+	}
+	const std::vector<glm::vec3>& getFaceNormals() const override {
+		return normalFace;
+	}
+	const std::vector<MeshPatch>& getPatches() const override {
+		return patches;
+	}
+
+private:
+	uint32_t addCopy(uint32_t vertex, const glm::vec2& coordinates);
+	// over the source's vertices, so the seams do not show in the lighting
+	void computeNormals();
+
+	float radius = 0.0f;
+	size_t sourceCount = 0;
+	std::vector<glm::vec3> sphereVertex; // before displacement
+	std::vector<uint32_t> sourceVertex;
+	std::vector<glm::vec2> uv;
+
+	std::vector<glm::vec3> vertex;
+	std::vector<glm::vec3> normal;
+	std::vector<uint32_t> index;
+	std::vector<glm::vec3> normalFace;
+	std::vector<MeshPatch> patches;
+};
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+// Fixed set of worker threads for data-parallel loops. The calling thread takes part
+// in its own parallelFor, so a pool of size 0 still works (everything runs inline).
+class ThreadPool {
+public:
+	explicit ThreadPool(uint32_t threadCount = defaultThreadCount());
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	uint32_t size() const {
+		return static_cast<uint32_t>(workers.size());
+	}
+
+	// fn(begin, end) over [0, count) in chunks of at least grain items; returns once
+	// every chunk finished and rethrows the first exception a chunk threw
+	template<typename Fn>
+	void parallelFor(size_t count, size_t grain, Fn fn) {
+		if (count == 0)
+			return;
+		grain = std::max<size_t>(grain, 1);
+		const size_t chunks = std::min((count + grain - 1) / grain, size_t(size() + 1) * 4);
+		if (chunks <= 1)
+		{
+			fn(size_t(0), count);
+			return;
+		}
+
+		Batch batch;
+		batch.remaining = chunks;
+		auto run_chunk = [&batch, &fn, count, chunks](size_t chunk) {
+			try {
+				fn(chunk * count / chunks, (chunk + 1) * count / chunks);
+			}
+			catch (...) {
+				std::lock_guard<std::mutex> guard(batch.lock);
+				if (!batch.failure)
+					batch.failure = std::current_exception();
+			}
+			// decremented under the lock so the caller cannot return (and destroy batch) in between
+			std::lock_guard<std::mutex> guard(batch.lock);
+			if (--batch.remaining == 0)
+				batch.finished.notify_all();
+		};
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			for (size_t chunk = 1; chunk < chunks; chunk++)
+				tasks.push_back([run_chunk, chunk]() { run_chunk(chunk); });
+		}
+		wake.notify_all();
+
+		run_chunk(0);
+		// help with whatever is still queued instead of sleeping
+		while (batch.remaining > 0 && runOne())
+			;
+		std::unique_lock<std::mutex> guard(batch.lock);
+		batch.finished.wait(guard, [&]() { return batch.remaining == 0; });
+		if (batch.failure)
+			std::rethrow_exception(batch.failure);
+	}
+
+	// runs fn on a worker and returns at once; with no workers it runs inline.
+	// Exceptions must not escape fn. Queued tasks still run when the pool is destroyed;
+	// a parallelFor on the same pool may run one of them while it waits, so long tasks
+	// belong in a pool of their own.
+	void submit(std::function<void()> fn) {
+		if (workers.empty())
+		{
+			fn();
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			tasks.push_back(std::move(fn));
+		}
+		wake.notify_one();
+	}
+
+	static uint32_t defaultThreadCount() {
+		uint32_t cores = std::thread::hardware_concurrency();
+		return cores > 1 ? cores - 1 : 0;
+	}
+
+private:
+	struct Batch {
+		std::atomic<size_t> remaining{ 0 };
+		std::mutex lock;
+		std::condition_variable finished;
+		std::exception_ptr failure;
+	};
+
+	bool runOne();
+	void workerLoop();
+
+	std::vector<std::thread> workers;
+	std::mutex lock;
+	std::condition_variable wake;
+	std::deque<std::function<void()>> tasks;
+	bool stopping = false;
+};
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+#include <glm.hpp>
+#include <gtc/packing.hpp>
+
+#include "figure.h"
+
+// Layout of one mesh on the GPU. Chosen per mesh at upload time.
+struct VertexFormat {
+	bool interleaved = false;   // position and normal in one VBO
+	bool packedNormals = false; // normal as GL_INT_2_10_10_10_REV
+	bool halfPositions = false; // position as 4 x GL_HALF_FLOAT (w = 1)
+	bool shortIndices = false;  // GL_UNSIGNED_SHORT element buffer
+
+	// the layout used before packed formats existed: two float VBOs, 32-bit indices
+	static VertexFormat separate() {
+		return VertexFormat();
+	}
+
+	static VertexFormat choose(const Mesh& msh) {
+		VertexFormat format;
+		format.interleaved = true;
+		format.packedNormals = true;
+		format.shortIndices = msh.getVertices().size() < 65536;
+
+		// half floats keep 11 bits of mantissa, so allow them only while the
+		// quantization step stays well below the shortest edge of the mesh
+		const auto& vertices = msh.getVertices();
+		const auto& indexes = msh.getIndexes();
+		float max_coord = 0.0f;
+		for (const auto& v : vertices)
+			max_coord = glm::max(max_coord, glm::max(glm::abs(v.x), glm::max(glm::abs(v.y), glm::abs(v.z))));
+
+		float min_edge = std::numeric_limits<float>::max();
+		for (uint32_t i = 0; i + 2 < indexes.size(); i += 3)
+			for (uint32_t j = 0; j < 3; j++)
+				min_edge = glm::min(min_edge, glm::distance(vertices[indexes[i + j]], vertices[indexes[i + (j + 1) % 3]]));
+
+		const float half_step = glm::exp2(glm::floor(glm::log2(glm::max(max_coord, 1e-6f))) - 10.0f);
+		format.halfPositions = max_coord < 60000.0f && half_step * 16.0f <= min_edge;
+		return format;
+	}
+
+	uint32_t positionSize() const {
+		return halfPositions ? 4 * sizeof(uint16_t) : sizeof(glm::vec3);
+	}
+	uint32_t normalSize() const {
+		return packedNormals ? sizeof(uint32_t) : sizeof(glm::vec3);
+	}
+	uint32_t stride() const {
+		return interleaved ? positionSize() + normalSize() : positionSize();
+	}
+	uint32_t indexSize() const {
+		return shortIndices ? sizeof(uint16_t) : sizeof(uint32_t);
+	}
+};
+
+// CPU-side images of the buffers described by a VertexFormat.
+class VertexPacker {
+public:
+	static void writePosition(const VertexFormat& format, const glm::vec3& v, uint8_t* dst) {
+		if (format.halfPositions)
+		{
+			uint16_t half[4] = {
+				glm::packHalf1x16(v.x),
+				glm::packHalf1x16(v.y),
+				glm::packHalf1x16(v.z),
+				glm::packHalf1x16(1.0f)
+			};
+			std::memcpy(dst, half, sizeof(half));
+		}
+		else
+			std::memcpy(dst, &v, sizeof(glm::vec3));
+	}
+
+	static void writeNormal(const VertexFormat& format, const glm::vec3& n, uint8_t* dst) {
+		if (format.packedNormals)
+		{
+			uint32_t packed = glm::packSnorm3x10_1x2(glm::vec4(glm::clamp(n, -1.0f, 1.0f), 0.0f));
+			std::memcpy(dst, &packed, sizeof(packed));
+		}
+		else
+			std::memcpy(dst, &n, sizeof(glm::vec3));
+	}
+
+	// interleaved: [position normal] per vertex; otherwise positions only
+	static std::vector<uint8_t> packVertices(const VertexFormat& format, const Mesh& msh) {
+		const auto& vertices = msh.getVertices();
+		const auto& normals = msh.getNormals();
+		std::vector<uint8_t> data(format.stride() * vertices.size());
+
+		for (uint32_t i = 0; i < vertices.size(); i++)
+		{
+			uint8_t* dst = data.data() + i * format.stride();
+			writePosition(format, vertices[i], dst);
+			if (format.interleaved)
+				writeNormal(format, normals[i], dst + format.positionSize());
+		}
+		return data;
+	}
+
+	static std::vector<uint8_t> packNormals(const VertexFormat& format, const Mesh& msh) {
+		const auto& normals = msh.getNormals();
+		std::vector<uint8_t> data(format.normalSize() * normals.size());
+
+		for (uint32_t i = 0; i < normals.size(); i++)
+			writeNormal(format, normals[i], data.data() + i * format.normalSize());
+		return data;
+	}
+
+	static std::vector<uint8_t> packIndexes(const VertexFormat& format, const Mesh& msh) {
+		const auto& indexes = msh.getIndexes();
+		std::vector<uint8_t> data(format.indexSize() * indexes.size());
+
+		if (format.shortIndices)
+		{
+			uint16_t* dst = reinterpret_cast<uint16_t*>(data.data());
+			for (uint32_t i = 0; i < indexes.size(); i++)
+				dst[i] = static_cast<uint16_t>(indexes[i]);
+		}
+		else
+			std::memcpy(data.data(), indexes.data(), data.size());
+		return data;
+	}
+};